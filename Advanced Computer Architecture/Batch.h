@@ -0,0 +1,856 @@
+#pragma once
+#include "RunRequest.h"
+#include "Functional.h"
+#include "StationSlots.h"
+#include <bit>
+#include <chrono>
+#include <sstream>
+#include <charconv>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//Runs a batch of instances of one program in lockstep, each with its own registers and memory, and gives each the
+//results FunctionalCPU would. Register r of lane l is registers[r * width + l] and word a of its memory is
+//memory[a * width + l], so one instruction reads and writes the same register or word of every lane side by side.
+//Each instruction is done for every unfinished lane at the lowest pc any of them is at: while all lanes agree that
+//is all of them, and lanes a branch sends ahead wait there until the others catch up. A batch that stays split for
+//fallbackSteps instructions in a row gives up and runs its lanes one at a time to the end.
+//Arithmetic, branches and loads work on 8 lanes at once with AVX2 where the compiler may use it; everything else,
+//and all of it without AVX2, goes lane by lane through the same functions as the other models
+class BatchFunctionalCPU {
+public:
+	static const int maxLanes = 64;
+
+	//Instructions done for the batch, and the instructions of single lanes they added up to
+	long long steps = 0;
+	long long laneInstructions = 0;
+	//Set once it ran lanes one at a time
+	bool fellBack = false;
+
+	int laneCount() {
+		return lanes;
+	}
+
+	bool finished(int lane) {
+		return registers[3 * width + lane] == 1 || (halted >> lane & 1) != 0;
+	}
+
+	//Whether the lane was stopped at the instruction limit instead
+	bool stopped(int lane) {
+		return (limited >> lane & 1) != 0;
+	}
+
+	long long executed(int lane) {
+		settleCounts();
+		return counts[lane];
+	}
+
+	word memoryWord(int lane, size_t address) {
+		return memory[address * width + lane];
+	}
+
+	word registerOf(int lane, int reg) {
+		return reg <= 0 || reg >= 32 ? 0 : registers[reg * width + lane];
+	}
+
+	//For giving each lane its own input before it runs
+	void setWord(int lane, size_t address, word value) {
+		memory[address * width + lane] = value;
+		written = std::max(written, address + 1);
+	}
+
+	size_t memoryLength() {
+		return memoryWords;
+	}
+
+	//Runs every lane until it finishes, or has executed maxInstructions when that isn't 0
+	void run(long long maxInstructions = 0) {
+		limit = maxInstructions;
+		while (active != 0) {
+			uint64_t mask = select();
+			if (pc < 0 || pc >= (int)instructions.size())
+				throw assembler::ProgramError("Instance " + std::to_string(firstInstance + std::countr_zero(mask)) + " left the program (pc " + std::to_string(pc) + ")");
+			if (mask != runMask) {
+				settleCounts();
+				runMask = mask;
+				headroom = LLONG_MAX;
+				if (limit > 0)
+					for (uint64_t m = mask; m != 0; m &= m - 1)
+						headroom = std::min(headroom, limit - counts[std::countr_zero(m)]);
+			}
+			if (runSteps >= headroom) {
+				settleCounts();
+				for (uint64_t m = mask; m != 0; m &= m - 1)
+					if (counts[std::countr_zero(m)] >= limit)
+						limited |= uint64_t(1) << std::countr_zero(m);
+				active &= ~limited;
+				runMask = 0;
+				continue;
+			}
+			runSteps += 1;
+			steps += 1;
+			laneInstructions += std::popcount(mask);
+			apartSteps = together ? 0 : apartSteps + 1;
+			if (fallbackSteps > 0 && apartSteps >= fallbackSteps)
+				fellBack = true;
+			execute(mask);
+		}
+		settleCounts();
+	}
+
+	//Starts lanes new instances, up to the number the batch was built for, from the program's own state. Only the
+	//words some lane may have written are set back, so a batch is cheap to use again. The first instance is numbered
+	//firstInstance in errors
+	void start(int lanes, int firstInstance) {
+		if (lanes < 1 || lanes > width)
+			throw assembler::ProgramError("A batch has between 1 and " + std::to_string(width) + " lanes");
+		this->lanes = lanes;
+		this->firstInstance = firstInstance;
+		for (size_t address = 0; address < written; address++)
+			std::fill_n(&memory[address * width], width, image[address]);
+		written = dataLength;
+		std::fill(registers.begin(), registers.end(), 0);
+		std::fill(vectors.begin(), vectors.end(), 0);
+		std::fill(pcs.begin(), pcs.end(), 0);
+		std::fill(counts.begin(), counts.end(), 0);
+		active = lanes == 64 ? ~uint64_t(0) : (uint64_t(1) << lanes) - 1;
+		halted = limited = runMask = 0;
+		together = true;
+		fellBack = false;
+		pc = 0;
+		steps = laneInstructions = runSteps = apartSteps = 0;
+	}
+
+	//Runs up to lanes instances side by side, up to maxLanes
+	BatchFunctionalCPU(const assembler::CompileResult& program, int lanes, long long fallbackSteps = 1024, int vectorLength = GlobalData::vector.length) :
+		lanes(lanes),
+		width(tagMatch::paddedLength(std::clamp(lanes, 1, maxLanes))),
+		instructions(program.instructions),
+		memoryWords(program.memory.size()),
+		image(program.memory.data(), program.memory.data() + memoryWords),
+		dataLength(std::min(size_t(program.dataLength), memoryWords)),
+		written(memoryWords),
+		registers(32 * size_t(width), 0),
+		memory(memoryWords * width),
+		vectorLength(vectorLength),
+		vectors(size_t(vectorRegisterCount) * vectorLength * width, 0),
+		pcs(width, 0),
+		counts(width, 0),
+		fallbackSteps(fallbackSteps)
+	{
+		if (lanes < 1 || lanes > maxLanes)
+			throw assembler::ProgramError("A batch has between 1 and " + std::to_string(maxLanes) + " lanes");
+		for (Instruction& instruction : instructions)
+			decoded.push_back(decode(instruction));
+		gathers = memoryWords * width <= size_t(INT_MAX);
+		start(lanes, 0);
+	}
+
+private:
+	enum class Kind : uint8_t {
+		//Arithmetic AVX2 does 8 lanes of at once
+		Wide,
+		Simple, Complex, Branch, Jump, Call, Return, Halt, Load, Store, Atomic, Vector, Nothing
+	};
+	struct Decoded {
+		Kind kind;
+		//Its second source is the instruction's own value rather than a register
+		bool immediate;
+		//It writes the global pointer, so lanes may finish
+		bool mayFinish;
+	};
+
+	int lanes, width;
+	std::vector<Instruction> instructions;
+	std::vector<Decoded> decoded;
+	size_t memoryWords;
+	//The program's memory, and how much of it its data fills
+	std::vector<word> image;
+	size_t dataLength;
+	//Every word any lane may have changed is below this
+	size_t written;
+	std::vector<word> registers;
+	std::vector<word> memory;
+	int vectorLength;
+	std::vector<word> vectors;
+
+	//Lanes still running, lanes that halted and lanes stopped at the limit
+	uint64_t active = 0, halted = 0, limited = 0;
+	//While together every running lane is at pc and pcs is out of date; otherwise pcs has each lane's
+	bool together = true;
+	int pc = 0;
+	std::vector<int32_t> pcs;
+	//Instructions executed by each lane, not counting the runSteps all the lanes of runMask did since
+	std::vector<long long> counts;
+	uint64_t runMask = 0;
+	long long runSteps = 0;
+	//How many more instructions the lanes of runMask may do before the first reaches limit
+	long long headroom = LLONG_MAX;
+	long long limit = 0;
+	long long fallbackSteps;
+	long long apartSteps = 0;
+	int firstInstance;
+	//Whether every word's index in memory fits in an int, as a gather needs
+	bool gathers = true;
+
+	static Decoded decode(const Instruction& instruction) {
+		Opcode op = instruction.operation;
+		//The ones wideOperation does; shifts wrap differently in AVX2 and division has no instruction
+		static const std::unordered_set<Opcode> wide = { IAdd, IAnd, IOr, IXor, ISlt, Add, Sub, And, Or, Xor, Slt, Mul };
+		Decoded d{ Kind::Nothing, groups::immediates.count(op) > 0, false };
+		if (wide.count(op) > 0)
+			d.kind = Kind::Wide;
+		else if (groups::simpleArithmetic.count(op) > 0)
+			d.kind = Kind::Simple;
+		else if (groups::complexArithmetic.count(op) > 0)
+			d.kind = Kind::Complex;
+		else if (groups::conditionalBranches.count(op) > 0)
+			d.kind = Kind::Branch;
+		else if (op == Jmp)
+			d.kind = Kind::Jump;
+		else if (op == Jlr)
+			d.kind = Kind::Call;
+		else if (op == Rtl)
+			d.kind = Kind::Return;
+		else if (op == Halt)
+			d.kind = Kind::Halt;
+		else if (groups::loads.count(op) > 0)
+			d.kind = Kind::Load;
+		else if (groups::stores.count(op) > 0)
+			d.kind = Kind::Store;
+		else if (groups::atomics.count(op) > 0)
+			d.kind = Kind::Atomic;
+		else if (isVector(op))
+			d.kind = Kind::Vector;
+		bool writesRegister = d.kind == Kind::Wide || d.kind == Kind::Simple || d.kind == Kind::Complex || d.kind == Kind::Load
+			|| d.kind == Kind::Atomic || op == VSum || op == VLen;
+		d.mayFinish = writesRegister && instruction.destination == 3;
+		return d;
+	}
+
+	//Picks the pc to execute next and returns the lanes at it
+	uint64_t select() {
+		if (fellBack) {
+			int lane = std::countr_zero(active);
+			pc = pcs[lane];
+			return uint64_t(1) << lane;
+		}
+		if (together)
+			return active;
+		pc = INT_MAX;
+		for (uint64_t m = active; m != 0; m &= m - 1)
+			pc = std::min(pc, pcs[std::countr_zero(m)]);
+		uint64_t mask = 0;
+		for (int b = 0; b < width; b += tagMatch::block)
+			mask |= uint64_t(tagMatch::equal(&pcs[b], pc)) << b;
+		mask &= active;
+		together = mask == active;
+		return mask;
+	}
+
+	void settleCounts() {
+		for (uint64_t m = runMask; m != 0; m &= m - 1)
+			counts[std::countr_zero(m)] += runSteps;
+		runSteps = 0;
+	}
+
+	word* row(word reg) {
+		return &registers[size_t(reg <= 0 || reg >= 32 ? 0 : reg) * width];
+	}
+	word read(word reg, int lane) {
+		return row(reg)[lane];
+	}
+	//Register 0 is never written, so it always reads as 0
+	void write(word reg, int lane, word value) {
+		if (reg > 0 && reg < 32)
+			registers[size_t(reg) * width + lane] = value;
+	}
+
+	word& at(int lane, word address, int length = 1) {
+		if (address < 0 || size_t(address) + length > memoryWords)
+			throw assembler::ProgramError("Instance " + std::to_string(firstInstance + lane) + " went outside memory at word " + std::to_string(address));
+		return memory[size_t(address) * width + lane];
+	}
+
+	word& vector(word reg, int lane, int index) {
+		return vectors[(size_t(reg) * vectorLength + index) * width + lane];
+	}
+
+	//Moves the lanes of mask, which may be going different ways, on to next(lane)
+	template<class Next>
+	void moveTo(uint64_t mask, Next next) {
+		if (together) {
+			int first = next(std::countr_zero(mask));
+			bool agree = true;
+			for (uint64_t m = mask; m != 0 && agree; m &= m - 1)
+				agree = next(std::countr_zero(m)) == first;
+			if (agree) {
+				pc = first;
+				return;
+			}
+			together = false;
+		}
+		for (uint64_t m = mask; m != 0; m &= m - 1)
+			pcs[std::countr_zero(m)] = next(std::countr_zero(m));
+	}
+
+	//All the lanes of mask go to target
+	void jumpTo(uint64_t mask, int target) {
+		if (together)
+			pc = target;
+		else
+			for (uint64_t m = mask; m != 0; m &= m - 1)
+				pcs[std::countr_zero(m)] = target;
+	}
+
+	void execute(uint64_t mask) {
+		Instruction& instruction = instructions[pc];
+		Decoded d = decoded[pc];
+		switch (d.kind) {
+		case Kind::Wide:
+			if (!fellBack) {
+				wideArithmetic(instruction, d, mask);
+				break;
+			}
+			[[fallthrough]];
+		case Kind::Simple:
+		case Kind::Complex:
+			for (uint64_t m = mask; m != 0; m &= m - 1) {
+				int lane = std::countr_zero(m);
+				PipelineEntry e = entryFor(instruction, d, lane);
+				write(instruction.destination, lane, d.kind == Kind::Complex || e.opcode == Mul ? getComplexArithmetic(nullptr, e) : getSimpleArithmetic(nullptr, e));
+			}
+			break;
+		case Kind::Branch: {
+			uint64_t taken = branches(instruction, mask);
+			int target = instruction.destination, fallThrough = pc + 1;
+			moveTo(mask, [&](int lane) { return (taken >> lane & 1) != 0 ? target : fallThrough; });
+			return;
+		}
+		case Kind::Jump:
+			jumpTo(mask, instruction.destination);
+			return;
+		case Kind::Call:
+			for (uint64_t m = mask; m != 0; m &= m - 1)
+				write(1, std::countr_zero(m), pc + 1);
+			jumpTo(mask, instruction.destination);
+			return;
+		case Kind::Return: {
+			word* returnAddresses = row(1);
+			moveTo(mask, [&](int lane) { return returnAddresses[lane]; });
+			return;
+		}
+		case Kind::Halt:
+			//Like FunctionalCPU, a halted lane stays on the halt
+			halted |= mask;
+			active &= ~mask;
+			return;
+		case Kind::Load:
+			loads(instruction, mask);
+			break;
+		case Kind::Store:
+			for (uint64_t m = mask; m != 0; m &= m - 1) {
+				int lane = std::countr_zero(m);
+				word address = instruction.destination + read(instruction.source1, lane);
+				at(lane, address) = read(instruction.source2, lane);
+				written = std::max(written, size_t(address) + 1);
+			}
+			break;
+		case Kind::Atomic:
+			for (uint64_t m = mask; m != 0; m &= m - 1) {
+				int lane = std::countr_zero(m);
+				word address = read(instruction.source1, lane);
+				word& w = at(lane, address);
+				written = std::max(written, size_t(address) + 1);
+				word old = w;
+				w = instruction.operation == AmoAdd ? old + read(instruction.source2, lane) : read(instruction.source2, lane);
+				write(instruction.destination, lane, old);
+			}
+			break;
+		case Kind::Vector:
+			for (uint64_t m = mask; m != 0; m &= m - 1)
+				vectorStep(instruction, std::countr_zero(m));
+			break;
+		case Kind::Nothing:
+			break;
+		}
+		if (d.mayFinish)
+			for (uint64_t m = mask; m != 0; m &= m - 1)
+				if (registers[3 * width + std::countr_zero(m)] == 1)
+					active &= ~(uint64_t(1) << std::countr_zero(m));
+		jumpTo(mask, pc + 1);
+	}
+
+	//What FunctionalCPU would give the execution functions for this lane
+	PipelineEntry entryFor(const Instruction& instruction, Decoded d, int lane) {
+		PipelineEntry e(pc + 1, instruction.destination);
+		e.opcode = instruction.operation;
+		e.sourceValue1 = read(instruction.source1, lane);
+		e.sourceValue2 = d.immediate ? instruction.source2 : read(instruction.source2, lane);
+		return e;
+	}
+
+	//Bit l is set when lane l of mask takes the branch
+	uint64_t branches(const Instruction& instruction, uint64_t mask) {
+		uint64_t taken = 0;
+		if (!fellBack) {
+#if defined(__AVX2__)
+			word* a = row(instruction.source1);
+			word* b = row(instruction.source2);
+			for (int block = 0; block < width; block += 8) {
+				if ((mask >> block & 0xff) == 0)
+					continue;
+				uint32_t bits = wideBranch(instruction.operation, load(a + block), load(b + block));
+				taken |= uint64_t(bits) << block;
+			}
+			return taken & mask;
+#endif
+		}
+		for (uint64_t m = mask; m != 0; m &= m - 1) {
+			int lane = std::countr_zero(m);
+			PipelineEntry e = entryFor(instruction, Decoded{ Kind::Branch, false, false }, lane);
+			taken |= uint64_t(checkIfBranchTaken(e)) << lane;
+		}
+		return taken;
+	}
+
+	void loads(const Instruction& instruction, uint64_t mask) {
+#if defined(__AVX2__)
+		if (!fellBack && gathers && instruction.destination > 0 && instruction.destination < 32) {
+			word* base = row(instruction.source1);
+			word* destination = row(instruction.destination);
+			__m256i offset = _mm256_set1_epi32(instruction.source2);
+			__m256i length = _mm256_set1_epi32(int(memoryWords));
+			__m256i stride = _mm256_set1_epi32(width);
+			bool inside = true;
+			for (int block = 0; block < width && inside; block += 8) {
+				uint32_t bits = uint32_t(mask >> block & 0xff);
+				if (bits == 0)
+					continue;
+				__m256i address = _mm256_add_epi32(load(base + block), offset);
+				__m256i valid = _mm256_and_si256(_mm256_cmpgt_epi32(length, address), _mm256_cmpgt_epi32(address, _mm256_set1_epi32(-1)));
+				//Anything outside memory is left to the lane by lane loop, which says which instance it was
+				if ((uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(valid))) & bits) != bits) {
+					inside = false;
+					break;
+				}
+				__m256i index = _mm256_add_epi32(_mm256_mullo_epi32(address, stride), _mm256_add_epi32(_mm256_set1_epi32(block), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+				__m256i value = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), memory.data(), index, blockMask(bits), 4);
+				storeLanes(destination + block, value, bits);
+			}
+			if (inside)
+				return;
+		}
+#endif
+		for (uint64_t m = mask; m != 0; m &= m - 1) {
+			int lane = std::countr_zero(m);
+			write(instruction.destination, lane, at(lane, read(instruction.source1, lane) + instruction.source2));
+		}
+	}
+
+	//Sources were read as scalar registers in FunctionalCPU::step; the ones that are vector registers are read here
+	void vectorStep(const Instruction& instruction, int lane) {
+		Opcode op = instruction.operation;
+		if (op == VLen)
+			write(instruction.destination, lane, vectorLength);
+		else if (op == VSum) {
+			word sum = 0;
+			for (int i = 0; i < vectorLength; i++)
+				sum += vector(instruction.source1, lane, i);
+			write(instruction.destination, lane, sum);
+		}
+		else if (op == VSplat)
+			for (int i = 0; i < vectorLength; i++)
+				vector(instruction.destination, lane, i) = read(instruction.source1, lane);
+		else if (op == VLda) {
+			word address = read(instruction.source1, lane) + instruction.source2;
+			at(lane, address, vectorLength);
+			for (int i = 0; i < vectorLength; i++)
+				vector(instruction.destination, lane, i) = memory[size_t(address + i) * width + lane];
+		}
+		else if (op == VSta) {
+			word address = instruction.destination + read(instruction.source1, lane);
+			at(lane, address, vectorLength);
+			written = std::max(written, size_t(address) + vectorLength);
+			for (int i = 0; i < vectorLength; i++)
+				memory[size_t(address + i) * width + lane] = vector(instruction.source2, lane, i);
+		}
+		else {
+			Opcode scalar = groups::vectorArithmetic.at(op);
+			for (int i = 0; i < vectorLength; i++)
+				vector(instruction.destination, lane, i) = getVectorLane(scalar, vector(instruction.source1, lane, i), vector(instruction.source2, lane, i));
+		}
+	}
+
+	void wideArithmetic(const Instruction& instruction, Decoded d, uint64_t mask) {
+#if defined(__AVX2__)
+		if (instruction.destination <= 0 || instruction.destination >= 32)
+			return;
+		word* a = row(instruction.source1);
+		word* b = row(instruction.source2);
+		word* destination = row(instruction.destination);
+		for (int block = 0; block < width; block += 8) {
+			uint32_t bits = uint32_t(mask >> block & 0xff);
+			if (bits == 0)
+				continue;
+			__m256i second = d.immediate ? _mm256_set1_epi32(instruction.source2) : load(b + block);
+			storeLanes(destination + block, wideOperation(instruction.operation, load(a + block), second), bits);
+		}
+#else
+		for (uint64_t m = mask; m != 0; m &= m - 1) {
+			int lane = std::countr_zero(m);
+			PipelineEntry e = entryFor(instruction, d, lane);
+			write(instruction.destination, lane, e.opcode == Mul ? getComplexArithmetic(nullptr, e) : getSimpleArithmetic(nullptr, e));
+		}
+#endif
+	}
+
+#if defined(__AVX2__)
+	static __m256i load(const word* from) {
+		return _mm256_loadu_si256((const __m256i*)from);
+	}
+
+	//All ones in the lanes bits has set
+	static __m256i blockMask(uint32_t bits) {
+		const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(bits)), laneBits), laneBits);
+	}
+
+	//Writes only the lanes bits has set
+	static void storeLanes(word* to, __m256i value, uint32_t bits) {
+		if (bits == 0xff)
+			_mm256_storeu_si256((__m256i*)to, value);
+		else
+			_mm256_maskstore_epi32(to, blockMask(bits), value);
+	}
+
+	//getSimpleArithmetic and getComplexArithmetic for 8 lanes
+	static __m256i wideOperation(Opcode op, __m256i a, __m256i b) {
+		switch (op) {
+		case IAdd:
+		case Add:
+			return _mm256_add_epi32(a, b);
+		case Sub:
+			return _mm256_sub_epi32(a, b);
+		case IAnd:
+		case And:
+			return _mm256_and_si256(a, b);
+		case IOr:
+		case Or:
+			return _mm256_or_si256(a, b);
+		case IXor:
+		case Xor:
+			return _mm256_xor_si256(a, b);
+		case ISlt:
+		case Slt:
+			return _mm256_srli_epi32(_mm256_cmpgt_epi32(b, a), 31);
+		case Mul:
+			return _mm256_mullo_epi32(a, b);
+		default:
+			throw SimulationError("Not wide arithmetic: opcode " + std::to_string(op));
+		}
+	}
+
+	//checkIfBranchTaken for 8 lanes; bit i is set when lane i is taken
+	static uint32_t wideBranch(Opcode op, __m256i a, __m256i b) {
+		__m256i compared;
+		bool inverted = op == Bne || op == Bge;
+		if (op == Beq || op == Bne)
+			compared = _mm256_cmpeq_epi32(a, b);
+		else
+			compared = _mm256_cmpgt_epi32(b, a);
+		uint32_t bits = uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(compared)));
+		return inverted ? ~bits & 0xff : bits;
+	}
+#endif
+};
+
+//batch program [inputs] [-instances n] [-lanes n] [-fallback n] [-max-instructions n] [-words label n] [-config file] [-check] [-json]
+struct BatchRequest {
+	std::string filename = "";
+	//One instance a line; without one, instances copies of the program run on its own data
+	std::string inputsFile = "";
+	std::string configFile = "";
+	int instances = 16;
+	int lanes = 16;
+	//Instructions a batch may stay split for before running its lanes one at a time; 0 never gives up
+	long long fallbackSteps = 1024;
+	long long maxInstructions = 0;
+	//Printed for every instance: how many words from which label
+	std::vector<std::pair<std::string, int>> words;
+	//Also runs every instance on FunctionalCPU, which it must match exactly
+	bool check = false;
+	bool json = false;
+};
+
+//arguments are as typed, starting with "batch" and the program. Returns what was wrong with them, or ""
+inline std::string parseBatchArguments(const std::vector<std::string>& arguments, BatchRequest& request) {
+	if (arguments.size() < 2)
+		return "batch needs a program";
+	request.filename = arguments[1];
+	size_t i = 2;
+	if (i < arguments.size() && arguments[i].rfind("-", 0) != 0)
+		request.inputsFile = arguments[i++];
+	for (; i < arguments.size(); i++) {
+		std::string option = arguments[i].rfind("--", 0) == 0 ? arguments[i].substr(1) : arguments[i];
+		bool hasValue = i + 1 < arguments.size();
+		if (option == "-instances" && hasValue)
+			request.instances = std::atoi(arguments[++i].c_str());
+		else if (option == "-lanes" && hasValue)
+			request.lanes = std::atoi(arguments[++i].c_str());
+		else if (option == "-fallback" && hasValue)
+			request.fallbackSteps = std::atoll(arguments[++i].c_str());
+		else if (option == "-max-instructions" && hasValue)
+			request.maxInstructions = std::atoll(arguments[++i].c_str());
+		else if (option == "-words" && i + 2 < arguments.size()) {
+			request.words.emplace_back(arguments[i + 1], std::atoi(arguments[i + 2].c_str()));
+			if (request.words.back().second < 1)
+				return "-words needs a label and how many words to print";
+			i += 2;
+		}
+		else if (option == "-config" && hasValue)
+			request.configFile = arguments[++i];
+		else if (option == "-check")
+			request.check = true;
+		else if (option == "-json")
+			request.json = true;
+		else
+			return "Unknown option " + arguments[i];
+	}
+	if (request.lanes < 1 || request.lanes > BatchFunctionalCPU::maxLanes)
+		return "batch needs between 1 and " + std::to_string(BatchFunctionalCPU::maxLanes) + " lanes";
+	if (request.inputsFile == "" && request.instances < 1)
+		return "batch needs at least one instance";
+	return "";
+}
+
+//The words one instance starts with other than the program's own data
+using BatchInput = std::vector<std::pair<size_t, word>>;
+
+//Each line of an inputs file is one instance: labels of the program, each followed by the words to write from it
+//on, e.g. "array 3 1 2 count 3". Empty lines and lines starting with # are skipped
+inline std::vector<BatchInput> readBatchInputs(const std::string& filename, const assembler::CompileResult& program) {
+	std::ifstream file(filename);
+	if (!file)
+		throw assembler::ProgramError("Could not open inputs " + filename);
+	std::vector<BatchInput> inputs;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber += 1;
+		if (line.size() > 0 && line.back() == '\r')
+			line.pop_back();
+		if (line.size() == 0 || line[0] == '#')
+			continue;
+		BatchInput& input = inputs.emplace_back();
+		std::string where = filename + " line " + std::to_string(lineNumber) + ": ";
+		long long address = -1;
+		for (auto& token : assembler::splitLine(line)) {
+			if (token.size() == 0)
+				continue;
+			auto label = program.labels.find(token);
+			word value = 0;
+			auto [end, problem] = std::from_chars(token.data(), token.data() + token.size(), value);
+			if (label != program.labels.end())
+				address = label->second;
+			else if (problem != std::errc() || end != token.data() + token.size())
+				throw assembler::ProgramError(where + "'" + token + "' is neither a label of the program nor a number");
+			else if (address < 0)
+				throw assembler::ProgramError(where + "the words have to come after a label");
+			else if (size_t(address) >= program.memory.size())
+				throw assembler::ProgramError(where + "the words go past the end of memory");
+			else
+				input.emplace_back(size_t(address++), value);
+		}
+	}
+	return inputs;
+}
+
+struct BatchInstanceResult {
+	long long instructions = 0;
+	//"finished", "halted" or "instruction limit"
+	std::string status = "";
+	std::vector<word> words;
+};
+
+struct BatchResult {
+	std::string error = "";
+	std::vector<BatchInstanceResult> instances;
+	int lanes = 0;
+	int batches = 0;
+	//Batches that ran their lanes one at a time in the end
+	int fallbacks = 0;
+	long long steps = 0;
+	long long laneInstructions = 0;
+	double hostSeconds = 0;
+	//How long FunctionalCPU took over the same instances when checking; 0 otherwise
+	double functionalSeconds = 0;
+	std::vector<std::string> mismatches;
+
+	//How much of the lanes' width the instructions used
+	float busy() {
+		return steps == 0 ? 0 : float(laneInstructions) / float(steps * lanes);
+	}
+
+	float instructionsPerSecond() {
+		return hostSeconds == 0 ? 0 : float(laneInstructions / hostSeconds);
+	}
+
+	bool complete() {
+		for (auto& instance : instances)
+			if (instance.status == "instruction limit")
+				return false;
+		return true;
+	}
+
+	int status() {
+		if (error != "")
+			return RunError;
+		if (!complete())
+			return RunOutOfBudget;
+		return mismatches.size() == 0 ? RunOk : RunError;
+	}
+};
+
+//Everything that differs between lane lane of the batch and a functional run of the same instance
+inline void compareWithFunctional(BatchFunctionalCPU& batch, int lane, FunctionalCPU& functional, int instance, std::vector<std::string>& mismatches) {
+	std::string name = "Instance " + std::to_string(instance);
+	if (batch.executed(lane) != functional.executed)
+		mismatches.emplace_back(name + " executed " + std::to_string(batch.executed(lane)) + " instructions, the functional model " + std::to_string(functional.executed));
+	for (int reg = 1; reg < 32; reg++)
+		if (batch.registerOf(lane, reg) != functional(reg))
+			mismatches.emplace_back(name + " r" + std::to_string(reg) + " is " + std::to_string(batch.registerOf(lane, reg)) + ", the functional model has " + std::to_string(functional(reg)));
+	for (size_t address = 0; address < batch.memoryLength(); address++)
+		if (batch.memoryWord(lane, address) != functional[int(address)])
+			mismatches.emplace_back(name + " word " + std::to_string(address) + " is " + std::to_string(batch.memoryWord(lane, address))
+				+ ", the functional model has " + std::to_string(functional[int(address)]));
+}
+
+//Runs the instances in batches of request.lanes. Checking runs each batch's instances again on FunctionalCPU as soon
+//as the batch is done, timed separately
+inline BatchResult executeBatch(const BatchRequest& request) {
+	BatchResult result;
+	auto program = assembler::load(request.filename, GlobalData::memorySize);
+	std::vector<BatchInput> inputs = request.inputsFile != "" ? readBatchInputs(request.inputsFile, program) : std::vector<BatchInput>(request.instances);
+	if (inputs.size() == 0)
+		throw assembler::ProgramError(request.inputsFile + " has no instances");
+	std::vector<int> wordAddresses;
+	for (auto& [label, count] : request.words) {
+		auto found = program.labels.find(label);
+		if (found == program.labels.end())
+			throw assembler::ProgramError("No label named " + label);
+		wordAddresses.push_back(found->second);
+	}
+	result.lanes = request.lanes;
+	result.instances.resize(inputs.size());
+
+	std::chrono::steady_clock::duration batchTime{}, functionalTime{};
+	auto start = std::chrono::steady_clock::now();
+	BatchFunctionalCPU batch(program, request.lanes, request.fallbackSteps);
+	for (size_t first = 0; first < inputs.size(); first += request.lanes) {
+		int lanes = int(std::min(inputs.size() - first, size_t(request.lanes)));
+		batch.start(lanes, int(first));
+		for (int lane = 0; lane < lanes; lane++)
+			for (auto& [address, value] : inputs[first + lane])
+				batch.setWord(lane, address, value);
+		batch.run(request.maxInstructions);
+
+		result.batches += 1;
+		result.fallbacks += batch.fellBack ? 1 : 0;
+		result.steps += batch.steps;
+		result.laneInstructions += batch.laneInstructions;
+		for (int lane = 0; lane < lanes; lane++) {
+			BatchInstanceResult& instance = result.instances[first + lane];
+			instance.instructions = batch.executed(lane);
+			instance.status = batch.stopped(lane) ? "instruction limit" : batch.registerOf(lane, 3) == 1 ? "finished" : "halted";
+			for (size_t w = 0; w < request.words.size(); w++)
+				for (int i = 0; i < request.words[w].second; i++) {
+					size_t address = size_t(wordAddresses[w] + i);
+					instance.words.push_back(address < batch.memoryLength() ? batch.memoryWord(lane, address) : 0);
+				}
+		}
+		auto now = std::chrono::steady_clock::now();
+		batchTime += now - start;
+		start = now;
+
+		if (!request.check)
+			continue;
+		for (int lane = 0; lane < lanes; lane++) {
+			assembler::CompileResult instance = program;
+			for (auto& [address, value] : inputs[first + lane])
+				instance.memory[address] = value;
+			FunctionalCPU functional(std::move(instance));
+			TraceRecord record;
+			while (!functional.finished() && (request.maxInstructions == 0 || functional.executed < request.maxInstructions))
+				functional.step(record);
+			compareWithFunctional(batch, lane, functional, int(first) + lane, result.mismatches);
+		}
+		now = std::chrono::steady_clock::now();
+		functionalTime += now - start;
+		start = now;
+	}
+	result.hostSeconds = std::chrono::duration<double>(batchTime).count();
+	result.functionalSeconds = std::chrono::duration<double>(functionalTime).count();
+	return result;
+}
+
+inline std::string batchJson(const BatchRequest& request, BatchResult& result) {
+	std::stringstream s;
+	s << "{\"program\": \"" << jsonEscape(request.filename) << "\", ";
+	if (result.error != "") {
+		s << "\"status\": \"error\", \"error\": \"" << jsonEscape(result.error) << "\"}";
+		return s.str();
+	}
+	s << "\"status\": \"" << (result.complete() ? "finished" : "instruction limit") << "\", \"instances\": " << result.instances.size()
+		<< ", \"lanes\": " << result.lanes << ", \"batches\": " << result.batches << ", \"fallbacks\": " << result.fallbacks
+		<< ", \"steps\": " << result.steps << ", \"instructions\": " << result.laneInstructions << ", \"busy\": " << result.busy()
+		<< ", \"hostSeconds\": " << result.hostSeconds;
+	if (request.check)
+		s << ", \"functionalSeconds\": " << result.functionalSeconds << ", \"mismatches\": " << result.mismatches.size();
+	s << ", \"perInstance\": [";
+	for (size_t i = 0; i < result.instances.size(); i++) {
+		BatchInstanceResult& instance = result.instances[i];
+		s << (i > 0 ? ", " : "") << "{\"status\": \"" << instance.status << "\", \"instructions\": " << instance.instructions;
+		if (request.words.size() > 0) {
+			s << ", \"words\": [";
+			for (size_t w = 0; w < instance.words.size(); w++)
+				s << (w > 0 ? ", " : "") << instance.words[w];
+			s << "]";
+		}
+		s << "}";
+	}
+	s << "]}";
+	return s.str();
+}
+
+inline std::string batchText(const BatchRequest& request, BatchResult& result) {
+	if (result.error != "")
+		return result.error + "\n";
+	std::stringstream s;
+	if (!result.complete())
+		s << "Some instances stopped at the instruction limit: ";
+	s << result.instances.size() << " instances in " << result.batches << " batches of " << result.lanes << " lanes executed " << result.laneInstructions
+		<< " instructions in " << result.hostSeconds << " seconds, " << result.instructionsPerSecond() / 1e6 << " million a second\n";
+	s << "\tLanes were " << 100 * result.busy() << "% busy; " << result.fallbacks << " batches fell back to one lane at a time\n";
+	for (size_t i = 0; i < result.instances.size(); i++) {
+		BatchInstanceResult& instance = result.instances[i];
+		s << "\tInstance " << i << ": " << instance.instructions << " instructions, " << instance.status;
+		size_t w = 0;
+		for (auto& [label, count] : request.words) {
+			s << "; " << label;
+			for (int j = 0; j < count; j++)
+				s << " " << instance.words[w++];
+		}
+		s << "\n";
+	}
+	if (request.check) {
+		s << "\tThe functional model took " << result.functionalSeconds << " seconds, " << (result.hostSeconds == 0 ? 0 : result.functionalSeconds / result.hostSeconds)
+			<< " times as long\n";
+		if (result.mismatches.size() == 0)
+			s << "\tEvery instance matched the functional model\n";
+		for (auto& mismatch : result.mismatches)
+			s << "\tMISMATCH " << mismatch << "\n";
+	}
+	return s.str();
+}
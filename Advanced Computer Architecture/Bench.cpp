@@ -0,0 +1,178 @@
+#include "Simulation.h"
+#include <chrono>
+#include <sstream>
+
+//Runs the bundled programs under the default hardware and powerConfig.txt, timing the simulator itself and
+//recording what it modelled. Against a baseline, any change in modelled cycles or commits is a failure and
+//a drop in simulated cycles per second beyond the threshold is reported (and fails with --strict-time)
+
+const std::vector<std::string> workloads = { "Ackermann.txt", "fibonnaci.txt", "colatz.txt", "VectorAdd.txt", "test_grounds.txt" };
+const std::string predictorName = "Always";
+
+struct BenchResult {
+	std::string config;
+	std::string program;
+	RunStats stats;
+	double hostSeconds = 0;
+
+	double cyclesPerSecond() {
+		return hostSeconds == 0 ? 0 : double(stats.cycles) / hostSeconds;
+	}
+
+	std::string toJson() {
+		std::stringstream s;
+		s.precision(10);
+		s << "{\"config\": \"" << config << "\", \"program\": \"" << program << "\", \"cycles\": " << stats.cycles
+			<< ", \"commits\": " << stats.commited << ", \"ipc\": " << stats.ipc() << ", \"flushes\": " << stats.flushes
+			<< ", \"hostSeconds\": " << hostSeconds << ", \"cyclesPerSecond\": " << cyclesPerSecond() << "}";
+		return s.str();
+	}
+};
+
+//Only has to read back what toJson writes: one result per line
+std::string jsonString(const std::string& line, const std::string& key) {
+	size_t at = line.find("\"" + key + "\": \"");
+	if (at == std::string::npos)
+		return "";
+	at += key.size() + 5;
+	return line.substr(at, line.find('"', at) - at);
+}
+double jsonNumber(const std::string& line, const std::string& key) {
+	size_t at = line.find("\"" + key + "\": ");
+	if (at == std::string::npos)
+		return 0;
+	return std::atof(line.c_str() + at + key.size() + 4);
+}
+
+std::vector<BenchResult> readBaseline(const std::string& filename) {
+	std::vector<BenchResult> results;
+	std::ifstream file(filename);
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.find("\"program\"") == std::string::npos)
+			continue;
+		BenchResult r;
+		r.config = jsonString(line, "config");
+		r.program = jsonString(line, "program");
+		r.stats.cycles = (long long)jsonNumber(line, "cycles");
+		r.stats.commited = (long long)jsonNumber(line, "commits");
+		r.stats.flushes = (long long)jsonNumber(line, "flushes");
+		r.hostSeconds = jsonNumber(line, "hostSeconds");
+		results.emplace_back(r);
+	}
+	return results;
+}
+
+//Repeats the run until minSeconds have passed and keeps the fastest, which is the least disturbed by the host
+BenchResult benchmark(const std::string& config, const std::string& program, double minSeconds) {
+	BenchResult result;
+	result.config = config;
+	result.program = program;
+	auto compiled = assembler::load(program, GlobalData::memorySize);
+
+	double total = 0;
+	int repeats = 0;
+	while (repeats < 3 || total < minSeconds) {
+		BranchPredictor* bp = makeBranchPredictor(predictorName);
+		CPU cpu(GlobalData::width, compiled, bp);
+		auto start = std::chrono::steady_clock::now();
+		RunStats stats = simulate(cpu);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		delete bp;
+
+		if (repeats == 0 || seconds < result.hostSeconds)
+			result.hostSeconds = seconds;
+		result.stats = stats;
+		total += seconds;
+		repeats += 1;
+	}
+	return result;
+}
+
+int main(int argc, char** argv) {
+	std::string outFile = "";
+	std::string baselineFile = "";
+	double maxSlowdown = 0.25;
+	double minSeconds = 0.2;
+	bool strictTime = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--out" && i + 1 < argc)
+			outFile = argv[++i];
+		else if (arg == "--baseline" && i + 1 < argc)
+			baselineFile = argv[++i];
+		else if (arg == "--max-slowdown" && i + 1 < argc)
+			maxSlowdown = std::atof(argv[++i]);
+		else if (arg == "--min-time" && i + 1 < argc)
+			minSeconds = std::atof(argv[++i]);
+		else if (arg == "--strict-time")
+			strictTime = true;
+		else {
+			printf("Usage: sim_bench [--out results.json] [--baseline baseline.json] [--max-slowdown fraction] [--min-time seconds] [--strict-time]\n");
+			return 2;
+		}
+	}
+
+	std::vector<BenchResult> results;
+	try {
+		for (auto& program : workloads)
+			results.emplace_back(benchmark("default", program, minSeconds));
+		GlobalData::loadFrom("powerConfig.txt");
+		for (auto& program : workloads)
+			results.emplace_back(benchmark("powerConfig.txt", program, minSeconds));
+	}
+	catch (assembler::ProgramError& e) {
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+
+	std::stringstream json;
+	json << "{\n\"build\": \"" << simulatorBuild << "\",\n\"predictor\": \"" << predictorName << "\",\n\"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+		json << results[i].toJson() << (i + 1 < results.size() ? ",\n" : "\n");
+	json << "]\n}\n";
+	std::cout << json.str();
+	if (outFile != "") {
+		std::ofstream file(outFile);
+		file << json.str();
+	}
+
+	if (baselineFile == "")
+		return 0;
+	auto baseline = readBaseline(baselineFile);
+	if (baseline.size() == 0) {
+		printf("Baseline %s has no results\n", baselineFile.c_str());
+		return 1;
+	}
+
+	bool modelChanged = false;
+	double logSpeedup = 0;
+	int compared = 0;
+	for (auto& b : baseline) {
+		auto r = std::find_if(results.begin(), results.end(), [&](BenchResult& r) { return r.config == b.config && r.program == b.program; });
+		if (r == results.end()) {
+			printf("MISSING  %s under %s\n", b.program.c_str(), b.config.c_str());
+			modelChanged = true;
+			continue;
+		}
+		if (r->stats.cycles != b.stats.cycles || r->stats.commited != b.stats.commited || r->stats.flushes != b.stats.flushes) {
+			printf("CHANGED  %s under %s: %lld cycles %lld commits %lld flushes, baseline %lld %lld %lld\n", b.program.c_str(), b.config.c_str(),
+				r->stats.cycles, r->stats.commited, r->stats.flushes, b.stats.cycles, b.stats.commited, b.stats.flushes);
+			modelChanged = true;
+		}
+		if (b.hostSeconds > 0 && r->hostSeconds > 0) {
+			logSpeedup += std::log(b.hostSeconds / r->hostSeconds);
+			compared += 1;
+		}
+	}
+
+	double speedup = compared == 0 ? 1 : std::exp(logSpeedup / compared);
+	printf("Simulator speed is %.3fx the baseline (geometric mean over %d runs)\n", speedup, compared);
+	bool tooSlow = speedup < 1.0 - maxSlowdown;
+	if (tooSlow)
+		printf("%s: simulator is more than %.0f%% slower than the baseline\n", strictTime ? "FAIL" : "WARNING", maxSlowdown * 100);
+	if (modelChanged)
+		printf("FAIL: modelled results differ from the baseline\n");
+	return (modelChanged || (tooSlow && strictTime)) ? 1 : 0;
+}
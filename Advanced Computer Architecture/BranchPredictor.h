@@ -6,6 +6,12 @@ public:
 	virtual bool predictJump(int currentPC, int destination) = 0;
 
 	virtual void reportResult(bool correct, int instructionAddress) = 0;
+
+	//Forgets everything learned, as if newly made
+	virtual void reset() = 0;
+
+	//makeBranchPredictor hands out predictors that are deleted through this class
+	virtual ~BranchPredictor() = default;
 };
 
 class SimpleBranchPredictor final: public BranchPredictor {
@@ -16,6 +22,8 @@ public:
 
 	void reportResult(bool, int)final override {}
 
+	void reset()final override {}
+
 	bool predictJump(int currentPC, int destination)final override {
 		switch (mode) {
 		case Mode::Always:
@@ -27,7 +35,7 @@ public:
 		case Mode::AlwaysBackwards:
 			return destination < currentPC;
 		default:
-			throw(0);
+			throw SimulationError("Unknown branch predictor mode");
 		}
 	}
 
@@ -48,6 +56,9 @@ public:
 	void reportResult(bool correct, int instructionAddress)final override {
 		maskedPrediction[instructionAddress & mask] = correct;
 	}
+	void reset()final override {
+		maskedPrediction.clear();
+	}
 
 	OneBitBranchPredictor(int bitsForAddress):
 		mask(pow(2, bitsForAddress) - 1)
@@ -78,10 +89,31 @@ public:
 		}
 	}
 
+	void reset()final override {
+		maskedPrediction.clear();
+	}
+
 	TwoBitBranchPredictor(int bitsForAddress) :
 		mask(pow(2, bitsForAddress) - 1)
 	{}
 private:
 	const int mask;
 	std::unordered_map<int, char> maskedPrediction;
-};
\ No newline at end of file
+};
+
+//The predictors a run can ask for by name; nullptr if the name isn't one of them
+inline BranchPredictor* makeBranchPredictor(const std::string& name) {
+	if (name == "Always")
+		return new SimpleBranchPredictor(SimpleBranchPredictor::Mode::Always);
+	if (name == "Never")
+		return new SimpleBranchPredictor(SimpleBranchPredictor::Mode::Never);
+	if (name == "Forwards")
+		return new SimpleBranchPredictor(SimpleBranchPredictor::Mode::AlwaysForwards);
+	if (name == "Backwards")
+		return new SimpleBranchPredictor(SimpleBranchPredictor::Mode::AlwaysBackwards);
+	if (name == "1bit")
+		return new OneBitBranchPredictor(8);
+	if (name == "2bit")
+		return new TwoBitBranchPredictor(8);
+	return nullptr;
+}
@@ -5,10 +5,15 @@
 #include "rob.h"
 #include "ExecutionGroup.h"
 #include "operations.h"
+#include "Trace.h"
+#include "ProgramImage.h"
+#include "FrontEnd.h"
+#include "RegisterFile.h"
+#include "ValuePredictor.h"
 #include <queue>
 #include <iostream>
 
-std::vector<PipelineEntry> operator+(std::vector<PipelineEntry> left, const std::vector<PipelineEntry>& right) {
+inline std::vector<PipelineEntry> operator+(std::vector<PipelineEntry> left, const std::vector<PipelineEntry>& right) {
 	left.insert(left.end(), right.begin(), right.end());
 	return left;
 }
@@ -16,16 +21,55 @@ std::vector<PipelineEntry> operator+(std::vector<PipelineEntry> left, const std:
 #include "MattQueue.h"
 
 class CPU {
+	//Clocks several CPUs as the hardware threads of one core
+	friend class SMTCore;
+	//Clocks several CPUs as cores sharing memory
+	friend class Multicore;
 public:
 	int commited = 0;
 	int flushes = 0;
+	//Cycles where fetch was blocked by a full ROB
+	int robStalls = 0;
+	//Cycles where the oldest decoded instruction had no reservation station space
+	int issueStalls = 0;
+	//Conditional branches committed, and how many of those went the other way to the prediction
+	int branches = 0;
+	int mispredictions = 0;
+	//Flushes for a load that ran ahead of a store to the same address
+	int orderingFlushes = 0;
+	//Loads fetched with a predicted value, and flushes for the ones that read something else
+	int valuePredictions = 0;
+	int valueFlushes = 0;
+	//Cycles where fetch had room but waited on the I-cache, a taken branch bubble or the branch predictor
+	int frontEndStalls = 0;
+	//Cycles where fetch waited for a free physical register to rename to
+	int renameStalls = 0;
+	//Instructions decoded, and the pairs among them fused into one
+	int decoded = 0;
+	int fusedPairs = 0;
+	//Only counted when cores share memory: cycles where a store or atomic waited to commit for the right to write
+	//its line, and flushes for loads that read a line another core then took to write
+	int coherenceStalls = 0;
+	int coherenceFlushes = 0;
+
+	//What is in flight at one moment, and each group's busy unit cycles so far. Groups are in config order:
+	//alu, calu, bu, lsu, vu
+	struct Occupancy {
+		static const int groups = 5;
+		int rob;
+		int stations[groups];
+		long long busyCycles[groups];
+		int units[groups];
+	};
 
 	void update() {
 		commit();
 		execute();
-		issue();
-		decode();
+		issue(issueWidth);
+		decode(decodeWidth);
+		predict();
 		fetch();
+		cycle += 1;
 	}
 
 	void regPrint(const char* prior) {
@@ -36,7 +80,49 @@ public:
 
 	void printMemory(const char* prior, int from, int upTo) {
 		for (int i = from; i < upTo; i++)
-			printf("%s%d:\t%d\n", prior, i, memory[i]);
+			printf("%s%d:\t%d\n", prior, i, dataMemory()[i]);
+	}
+
+	//Replays a recorded run instead of computing values; the trace must stay alive for the whole run. Returns why
+	//it can't be, or "". Hardware that squashes a load on the traced path, which would have to take its record
+	//again, that checks values, or that predicts ahead of fetch can't be replayed
+	std::string replay(TraceReader* reader) {
+		if (!reader->isValid())
+			return "it isn't a readable version " + std::to_string(trace::version) + " trace";
+		if (reader->instructionCount() != instructions.size())
+			return "it was recorded from a " + std::to_string(reader->instructionCount()) + " instruction program, not this "
+				+ std::to_string(instructions.size()) + " instruction one";
+		std::vector<std::string> unsupported;
+		if (storeSets != nullptr)
+			unsupported.push_back("store sets");
+		if (targetQueue > 0)
+			unsupported.push_back("a decoupled front end");
+		if (std::find(&fusable[0][0], &fusable[Halt][Halt] + 1, true) != &fusable[Halt][Halt] + 1)
+			unsupported.push_back("fused pairs");
+		if (loadValues != nullptr)
+			unsupported.push_back("load value prediction");
+		if (unsupported.size() > 0) {
+			std::string list = unsupported[0];
+			for (size_t i = 1; i < unsupported.size(); i++)
+				list += (i + 1 == unsupported.size() ? " or " : ", ") + unsupported[i];
+			return "replays can't model " + list;
+		}
+		trace = reader;
+		offTrace = false;
+		return "";
+	}
+
+	bool finished() {
+		if (halted)
+			return true;
+		if (trace != nullptr)
+			return commited >= (long long)trace->recordCount();
+		return (*this)(3) == 1;
+	}
+
+	//True once a halt instruction has committed
+	bool hasHalted() {
+		return halted;
 	}
 
 	int operator[](const std::string& index) {
@@ -44,7 +130,7 @@ public:
 	}
 	//Get memory value
 	int operator[](int index) {
-		return memory[index];
+		return dataMemory()[index];
 	}
 	//Get reguister value
 	int operator()(int index) {
@@ -52,23 +138,159 @@ public:
 		return registers[index];
 	}
 
+	Occupancy occupancy() {
+		Occupancy o;
+		o.rob = rob.length();
+		ExecutionGroup* groups[Occupancy::groups] = { &eu_simpleArthmatic, &eu_complexArithmatic, &eu_branches, &eu_loadStore, &eu_vector };
+		for (int i = 0; i < Occupancy::groups; i++) {
+			o.stations[i] = groups[i]->stationOccupancy();
+			o.busyCycles[i] = groups[i]->busyCycles();
+			o.units[i] = groups[i]->unitCount();
+		}
+		return o;
+	}
+
+	//How many of the coming cycles are sure to change nothing but execution unit progress and the stall
+	//counts: nothing can commit, dispatch, finish, issue, decode or fetch. 0 if the next cycle may do something
+	long long quietCycles() {
+		if (rob.length() > 0 && rob.isReady(rob.headIndex()))
+			return 0;
+		if (fetchedInstructions.size() > 0 && decodedInstructions.size() < decodeLatch)
+			return 0;
+		if (decodedInstructions.size() > 0 && groupFor(decodedInstructions.front().unitOpcode()).canTakeInstruction(decodedInstructions.front().unitOpcode()))
+			return 0;
+		int soonest = INT_MAX;
+		//A wait ends in the cycle fetch (or prediction) goes on, so the quiet stretch ends just before
+		if (!fetchHalted && cycle < fetchReadyAt)
+			soonest = int(std::min<long long>(INT_MAX, fetchReadyAt - cycle + 1));
+		else if (!fetchHalted && rob.hasRoom() && (pc >= instructions.size() || pc < 0 || (fetchedInstructions.size() < fetchLatch && !renameBlocked()))
+			&& (!decoupled() || targets.size() > 0))
+			return 0;
+		if (decoupled() && !predictHalted && targets.size() < targetQueue) {
+			if (cycle >= predictReadyAt)
+				return 0;
+			soonest = int(std::min<long long>(soonest, predictReadyAt - cycle + 1));
+		}
+		for (ExecutionGroup* group : { &eu_simpleArthmatic, &eu_complexArithmatic, &eu_branches, &eu_loadStore, &eu_vector }) {
+			if (group->canDispatch())
+				return 0;
+			soonest = std::min(soonest, group->cyclesUntilFinish());
+		}
+		//With nothing in flight the machine is stuck, and skipping would never end
+		if (soonest == INT_MAX)
+			return 0;
+		return soonest - 1;
+	}
+
+	//Lines the I-cache has had to fill, prefetches included
+	int icacheMisses() {
+		return int(icache.misses);
+	}
+
+	//Stands in for that many update calls, which must all be quiet
+	void skipQuietCycles(long long cycles) {
+		for (ExecutionGroup* group : { &eu_simpleArthmatic, &eu_complexArithmatic, &eu_branches, &eu_loadStore, &eu_vector })
+			group->skip(int(cycles));
+		if (!fetchHalted && cycle < fetchReadyAt)
+			frontEndStalls += cycles;
+		else if (!fetchHalted && !rob.hasRoom())
+			robStalls += cycles;
+		else if (!fetchHalted && fetchedInstructions.size() < fetchLatch && renameBlocked())
+			renameStalls += cycles;
+		else if (!fetchHalted && decoupled() && targets.size() == 0 && fetchedInstructions.size() < fetchLatch)
+			frontEndStalls += cycles;
+		cycle += cycles;
+		if (decodedInstructions.size() > 0)
+			issueStalls += cycles;
+	}
+
+	//Starts a program from scratch, keeping the ROB, reservation stations and execution units already
+	//allocated. The hardware stays what this CPU was built with, whatever GlobalData says now
+	void reset(const assembler::CompileResult& program) {
+		trace = nullptr;
+		offTrace = false;
+		flushEverything(0);
+		instructions = program.instructions;
+		labels = program.labels;
+		memory.copyFrom(program.memory);
+		std::fill(registers.begin(), registers.end(), 0);
+		branchPredictor->reset();
+		if (storeSets != nullptr)
+			storeSets->reset();
+		if (physicalRegisters != nullptr)
+			physicalRegisters->reset();
+		if (vectors != nullptr)
+			vectors->reset();
+		else if (usesVectors(instructions))
+			vectors = std::make_unique<VectorRegisterFile>(vectorLength, robTags);
+		context.vectors = vectors.get();
+		commited = flushes = robStalls = issueStalls = branches = mispredictions = orderingFlushes = frontEndStalls = renameStalls = 0;
+		decoded = fusedPairs = valuePredictions = valueFlushes = coherenceStalls = coherenceFlushes = 0;
+		if (loadValues != nullptr)
+			loadValues->reset();
+		icache.reset();
+		returns.clear();
+		committedReturns.clear();
+		cycle = fetchReadyAt = predictReadyAt = 0;
+		for (ExecutionGroup* group : { &eu_simpleArthmatic, &eu_complexArithmatic, &eu_branches, &eu_loadStore, &eu_vector })
+			group->resetCounters();
+		fetchHalted = halted = false;
+	}
+
+	//The ROB refers to the program in place
+	CPU(const CPU&) = delete;
+
 	CPU(int width, std::string filename, BranchPredictor* branchPredictor) :
+		CPU(width, assembler::load(filename, GlobalData::memorySize), branchPredictor)
+	{}
+
+	//With shared, the CPU is hardware thread thread of threads running on those groups: it gets its share of the
+	//ROB, numbered apart from the others', and flushes only its own instructions from the groups
+	CPU(int width, assembler::CompileResult program, BranchPredictor* branchPredictor, ExecutionGroups* shared = nullptr, int thread = 0, int threads = 1) :
 		width(width),
+		fetchWidth(GlobalData::frontEnd.fetchWidth > 0 ? GlobalData::frontEnd.fetchWidth : width),
+		decodeWidth(GlobalData::frontEnd.decodeWidth > 0 ? GlobalData::frontEnd.decodeWidth : width),
+		issueWidth(GlobalData::frontEnd.issueWidth > 0 ? GlobalData::frontEnd.issueWidth : width),
+		commitWidth(GlobalData::frontEnd.commitWidth > 0 ? GlobalData::frontEnd.commitWidth : width),
+		fetchLatch(GlobalData::frontEnd.fetchLatch > 0 ? GlobalData::frontEnd.fetchLatch : width),
+		decodeLatch(GlobalData::frontEnd.decodeLatch > 0 ? GlobalData::frontEnd.decodeLatch : width),
+		fetchBlock(GlobalData::frontEnd.fetchBlock),
+		takenBubble(GlobalData::frontEnd.takenBubble),
+		targetQueue(GlobalData::frontEnd.targetQueue),
+		icache(GlobalData::frontEnd.icacheSets, GlobalData::frontEnd.icacheWays, GlobalData::frontEnd.icacheLine, GlobalData::frontEnd.icacheMiss),
 		pc(0),
-		rob(GlobalData::reorderBufferSize),
-		eu_simpleArthmatic(GlobalData::simpleInteger, false),
-		eu_complexArithmatic(GlobalData::complexInteger, false),
-		eu_branches(GlobalData::branchUnits, false),
-		eu_loadStore(GlobalData::loadStoreUnits, true),
+		rob(GlobalData::reorderBufferSize / threads, instructions, thread * (GlobalData::reorderBufferSize / threads), GlobalData::vector.length),
+		ownGroups(shared == nullptr ? std::make_unique<ExecutionGroups>() : nullptr),
+		units(shared == nullptr ? *ownGroups : *shared),
+		eu_simpleArthmatic(units.simpleArithmetic),
+		eu_complexArithmatic(units.complexArithmetic),
+		eu_branches(units.branches),
+		eu_loadStore(units.loadStore),
+		eu_vector(units.vector),
+		storeSets(units.storeSets.get()),
+		physicalRegisters(GlobalData::physicalRegisters > 0 ? std::make_unique<PhysicalRegisterFile>(GlobalData::physicalRegisters, GlobalData::reorderBufferSize) : nullptr),
+		thread(thread),
+		context{ branchPredictor, &registers, &memory },
+		loadValues(GlobalData::loadValueSize > 0 ? std::make_unique<LoadValuePredictor>(GlobalData::loadValueSize, GlobalData::loadValueConfidence) : nullptr),
+		vectorLength(GlobalData::vector.length),
+		robTags(GlobalData::reorderBufferSize),
 		branchPredictor(branchPredictor)
 	{
+		for (ExecutionGroup* group : { &eu_simpleArthmatic, &eu_complexArithmatic, &eu_branches, &eu_loadStore, &eu_vector })
+			usePriorities |= group->usesPriorities();
+		if (usePriorities)
+			seats.resize(robTags);
+		for (auto& pair : GlobalData::fusedPairs)
+			fusable[pair.first][pair.second] = true;
 
 		for (int i = 0; i < 32; i++)registers.emplace_back(0);
 
-		auto result = assembler::compile(filename, GlobalData::memorySize);
-		instructions = std::move(result.instructions);
-		memory = std::move(result.memory);
-		labels = result.labels;
+		instructions = std::move(program.instructions);
+		memory = std::move(program.memory);
+		labels = std::move(program.labels);
+		if (usesVectors(instructions))
+			vectors = std::make_unique<VectorRegisterFile>(vectorLength, robTags);
+		context.vectors = vectors.get();
 	}
 
 private:
@@ -76,23 +298,87 @@ private:
 	std::vector<Instruction> instructions;
 	std::unordered_map<std::string, int> labels;
 	int pc;
-	std::vector<word> memory;
+	MainMemory memory;
 	std::vector<word> registers;
 	ReOrderBuffer rob;
 	BranchPredictor* branchPredictor;
-
-	ExecutionGroup eu_simpleArthmatic;
-	ExecutionGroup eu_complexArithmatic;
-	ExecutionGroup eu_branches;
-	ExecutionGroup eu_loadStore;
+	//Only built when the groups aren't shared with other threads
+	std::unique_ptr<ExecutionGroups> ownGroups;
+	ExecutionGroups& units;
+	ExecutionGroup& eu_simpleArthmatic;
+	ExecutionGroup& eu_complexArithmatic;
+	ExecutionGroup& eu_branches;
+	ExecutionGroup& eu_loadStore;
+	ExecutionGroup& eu_vector;
+	//Only there when loads may run ahead of older stores
+	StoreSetPredictor* storeSets;
+	//Only there when results are renamed to a limited register file; otherwise they wait in the ROB
+	std::unique_ptr<PhysicalRegisterFile> physicalRegisters;
+	//Which hardware thread this is, and what its instructions execute against
+	int thread;
+	ThreadContext context;
+	//Only there when load values are predicted
+	std::unique_ptr<LoadValuePredictor> loadValues;
+	//Only there when the program has vector instructions, built for vectors of vectorLength words and ROB entries
+	//numbered up to robTags
+	std::unique_ptr<VectorRegisterFile> vectors;
+	int vectorLength;
+	int robTags;
 
 	int width;
+	//Each stage's width and the depth of the latch after fetch and after decode, from width unless set apart
+	int fetchWidth, decodeWidth, issueWidth, commitWidth;
+	int fetchLatch, decodeLatch;
+	int fetchBlock;
+	int takenBubble;
+	int targetQueue;
+	InstructionCache icache;
+	//Cycles clocked, for timing I-cache fills and bubbles
+	long long cycle = 0;
+	//Fetch does nothing before this cycle
+	long long fetchReadyAt = 0;
+	//Fetch targets predicted and not yet fetched, and where prediction has got to
+	MattQueue<FetchTarget> targets;
+	int predictPC = 0;
+	bool predictHalted = false;
+	long long predictReadyAt = 0;
+	ReturnStack returns;
+	ReturnStack committedReturns;
+	//Set when any group selects by something other than age
+	bool usePriorities = false;
+	//Only kept when usePriorities: by ROB tag, the group an issued instruction waits in and the tag it waits under,
+	//which for the second half of a fused pair is the first half's
+	struct StationSeat {
+		ExecutionGroup* group = nullptr;
+		word tag = -1;
+	};
+	std::vector<StationSeat> seats;
+	//Which instruction pairs decode fuses, first by second
+	bool fusable[Halt + 1][Halt + 1] = {};
 	MattQueue<PipelineEntry> fetchedInstructions;
 	MattQueue<PipelineEntry> decodedInstructions;
 
+	//Fetch stops at a halt, and only starts again if a flush shows the halt was on the wrong path. It also stops at
+	//a fence or an atomic until that commits
+	bool fetchHalted = false;
+	bool halted = false;
+	TraceReader* trace = nullptr;
+	//Set once fetch goes down a path the trace doesn't cover (a misprediction, or past the end)
+	bool offTrace = false;
+
 	InstructionType getRobType(Opcode op) {
+		if (op == Halt)
+			return InstructionType::Halt;
 		if (groups::stores.count(op) > 0)
 			return InstructionType::Store;
+		if (groups::atomics.count(op) > 0)
+			return InstructionType::Atomic;
+		if (op == Fence)
+			return InstructionType::Fence;
+		if (groups::vectorStores.count(op) > 0)
+			return InstructionType::VectorStore;
+		if (writesVector(op))
+			return InstructionType::Vector;
 		if (groups::conditionalBranches.count(op) > 0 || groups::jump.count(op) > 0)
 			return InstructionType::Branch;
 		return InstructionType::RegisterOp;
@@ -103,23 +389,38 @@ private:
 			source = 0;
 			return;
 		}
-		word neccessaryRobIndex = rob.getRobOrMinus(
-			[](RobEntry& entry, word requestedReg) {
-				return (entry.type == InstructionType::RegisterOp && entry.desination == requestedReg && entry.active == true)
-					|| (
-						entry.instruction.operation == Jlr && requestedReg == 1 && entry.active
-						)
-					;
-			}, requestedReg);
+		if (physicalRegisters != nullptr) {
+			int physical = physicalRegisters->mapOf(requestedReg);
+			if (physicalRegisters->isReady(physical))
+				source = physicalRegisters->valueOf(physical);
+			else robIndex = physicalRegisters->writerOf(physical);
+			return;
+		}
+		word neccessaryRobIndex = rob.lastWriter(requestedReg);
 		if (neccessaryRobIndex == -1)
 			source = registers[requestedReg];
 		else {
-			if (rob[neccessaryRobIndex].ready)
-				source = rob[neccessaryRobIndex].valueField;
+			if (rob.hasValue(neccessaryRobIndex))
+				source = rob.valueOf(neccessaryRobIndex);
 			else robIndex = neccessaryRobIndex;
 		}
 	}
 
+	//A vector source is the physical register holding it, once its writer has finished
+	void getVectorSource(word& robIndex, word& source, word requestedReg) {
+		int physical = vectors->mapOf(requestedReg);
+		if (vectors->isReady(physical))
+			source = physical;
+		else robIndex = vectors->writerOf(physical);
+	}
+
+	static bool usesVectors(const std::vector<Instruction>& program) {
+		for (auto& instruction : program)
+			if (isVector(instruction.operation))
+				return true;
+		return false;
+	}
+
 	int fetchLastReturnAddress() {
 		for (auto& f : fetchedInstructions)
 			if (f.opcode == Jlr)
@@ -127,39 +428,67 @@ private:
 		for (auto& f : decodedInstructions)
 			if (f.opcode == Jlr)
 				return f.instructionAddress;
-		auto possibleRA = eu_branches.getReturnAddress();
+		auto possibleRA = eu_branches.getReturnAddress(thread);
 		if (possibleRA.has_value())
 			return *possibleRA;
-		auto& head = rob.head();
-		if (head.ready && head.active && head.desination == 1 && head.type == InstructionType::RegisterOp)
-			return head.valueField;
+		int head = rob.headIndex();
+		if (rob.isReady(head) && rob.isActive(head) && rob.destinationOf(head) == 1 && rob.typeOf(head) == InstructionType::RegisterOp)
+			return rob.valueOf(head);
 		return registers[1];
 	}
 
-	void getRobIndexOrMemoryValue(word& robIndex, word& source, word memoryAddress) {
-		word neccessaryRobIndex = rob.getRobOrMinus(
-			[](RobEntry& entry, word memoryAddress) {
-				return entry.type == InstructionType::Store && entry.desination == memoryAddress;
-			}, memoryAddress);
-		if (neccessaryRobIndex == -1)
-			source = memory[memoryAddress];
-		else
-			robIndex = neccessaryRobIndex;
+	//While replaying, each instruction fetched on the correct path takes the next record
+	bool nextTraceRecord(TraceRecord& record) {
+		if (trace == nullptr || offTrace)
+			return false;
+		if (!trace->next(record)) {
+			offTrace = true;
+			return false;
+		}
+		if (record.pc != pc)
+			throw SimulationError("Trace expected pc " + std::to_string(record.pc) + " but fetched " + std::to_string(pc));
+		return true;
 	}
 
-	PipelineEntry fetchInstruction() {
+	//With a target, branches were predicted when it was made and only its last instruction can be taken
+	PipelineEntry fetchInstruction(const FetchTarget* target = nullptr) {
 		Instruction& fetchedInstruction = instructions[pc];
+		bool endsTarget = target != nullptr && pc == target->end - 1;
+		TraceRecord record;
+		bool onTrace = nextTraceRecord(record);
 		pc += 1;
 		PipelineEntry pipelinedInstruction(pc, fetchedInstruction.destination);
 		pipelinedInstruction.opcode = fetchedInstruction.operation;
+		pipelinedInstruction.replayed = trace != nullptr;
+		pipelinedInstruction.replayAddress = record.address;
+		pipelinedInstruction.replayValue = record.returnTarget;
+		pipelinedInstruction.thread = uint8_t(thread);
 		RobEntry newEntry(getRobType(fetchedInstruction.operation));
 		newEntry.desination = fetchedInstruction.destination;
-		newEntry.instruction = fetchedInstruction;
 		newEntry.instructionIndex = pc;
 
-		if (fetchedInstruction.operation == Rtl) {
+		if (fetchedInstruction.operation == Halt) {
+			//Nothing to execute, so it waits in the ROB until everything older has committed
+			newEntry.ready = true;
+			fetchHalted = true;
+			pc -= 1;
+		}
+		else if (fetchedInstruction.operation == Fence) {
+			newEntry.ready = true;
+			fetchHalted = true;
+		}
+		else if (fetchedInstruction.operation == Rtl) {
 			newEntry.valueField = 1;
-			pc = fetchLastReturnAddress();
+			if (target != nullptr)
+				pc = target->next;
+			else
+				pc = fetchLastReturnAddress();
+			//Only a guess while ra may still be in flight; checked against the real ra at commit, or when
+			//replaying against the trace, which fetch leaves until then if the guess was wrong
+			newEntry.pcIfBadlyPredicted = pc;
+			newEntry.returnTarget = onTrace ? record.returnTarget : pc;
+			if (onTrace && record.returnTarget != pc)
+				offTrace = true;
 		}
 		else if (groups::jump.count(fetchedInstruction.operation) > 0) {
 			pipelinedInstruction.destination = pipelinedInstruction.instructionAddress;
@@ -171,7 +500,19 @@ private:
 			getRobIndexOrRegisterValue(pipelinedInstruction.inputRobIndex1, pipelinedInstruction.sourceValue1, fetchedInstruction.source1);
 			getRobIndexOrRegisterValue(pipelinedInstruction.inputRobIndex2, pipelinedInstruction.sourceValue2, fetchedInstruction.source2);
 
-			if (branchPredictor->predictJump(pc - 1, fetchedInstruction.destination)) {
+			bool prediction = target != nullptr ? endsTarget && target->taken : branchPredictor->predictJump(pc - 1, fetchedInstruction.destination);
+			if (onTrace) {
+				pipelinedInstruction.replayTaken = record.taken;
+				if (record.taken != prediction)
+					offTrace = true;
+			}
+			else {
+				//Off the traced path there is no outcome to learn from, so it resolves as predicted
+				pipelinedInstruction.replayTaken = prediction;
+				pipelinedInstruction.trainPredictor = false;
+			}
+
+			if (prediction) {
 				newEntry.pcIfBadlyPredicted = pc;
 				newEntry.predictedToJump = true;
 				pc = fetchedInstruction.destination;
@@ -200,97 +541,440 @@ private:
 			getRobIndexOrRegisterValue(pipelinedInstruction.inputRobIndex2, pipelinedInstruction.sourceValue2, fetchedInstruction.source2);
 			getRobIndexOrRegisterValue(pipelinedInstruction.inputRobIndex1, pipelinedInstruction.sourceValue1, fetchedInstruction.source1);
 		}
+		//Executes to find its address and operand; memory is read and written as it commits
+		else if (groups::atomics.count(fetchedInstruction.operation) > 0) {
+			getRobIndexOrRegisterValue(pipelinedInstruction.inputRobIndex1, pipelinedInstruction.sourceValue1, fetchedInstruction.source1);
+			getRobIndexOrRegisterValue(pipelinedInstruction.inputRobIndex2, pipelinedInstruction.sourceValue2, fetchedInstruction.source2);
+			fetchHalted = true;
+		}
+		//vlen has no sources. A vector load's second source is its offset, and a store's destination its base
+		else if (isVector(fetchedInstruction.operation)) {
+			int vectorSources = vectorOperands(fetchedInstruction.operation);
+			if (fetchedInstruction.operation == VLen) {}
+			else if ((vectorSources & 0b010) != 0)
+				getVectorSource(pipelinedInstruction.inputRobIndex1, pipelinedInstruction.sourceValue1, fetchedInstruction.source1);
+			else
+				getRobIndexOrRegisterValue(pipelinedInstruction.inputRobIndex1, pipelinedInstruction.sourceValue1, fetchedInstruction.source1);
+			if ((vectorSources & 0b100) != 0)
+				getVectorSource(pipelinedInstruction.inputRobIndex2, pipelinedInstruction.sourceValue2, fetchedInstruction.source2);
+			else if (fetchedInstruction.operation == VLda)
+				pipelinedInstruction.sourceValue2 = fetchedInstruction.source2;
+		}
 
 		pipelinedInstruction.outputRobIndex = rob.push(newEntry);
+		//After its sources were read, in case it overwrites one of them
+		if (writesVector(fetchedInstruction.operation))
+			pipelinedInstruction.destination = vectors->rename(fetchedInstruction.destination, pipelinedInstruction.outputRobIndex);
+		if (physicalRegisters != nullptr) {
+			word renamed = renamedRegister(fetchedInstruction);
+			if (renamed != -1)
+				physicalRegisters->rename(renamed, pipelinedInstruction.outputRobIndex);
+			else physicalRegisters->noRename(pipelinedInstruction.outputRobIndex);
+		}
+		if (loadValues != nullptr && groups::loads.count(fetchedInstruction.operation) > 0 && renamedRegister(fetchedInstruction) != -1)
+			predictLoadValue(pipelinedInstruction.outputRobIndex, pc - 1);
 		return pipelinedInstruction;
 	}
 
+	//Everything younger reads a predicted value as if the load had completed, and nothing older can be waiting on it
+	void predictLoadValue(int robIndex, int address) {
+		std::optional<word> predicted = loadValues->predict(address);
+		if (!predicted.has_value())
+			return;
+		valuePredictions += 1;
+		rob.predictValue(robIndex, *predicted);
+		if (physicalRegisters != nullptr)
+			physicalRegisters->complete(robIndex, *predicted);
+	}
+
+	//The register an instruction is given a physical register for: its destination, or ra for a jump and link.
+	//-1 for one that writes no register
+	word renamedRegister(const Instruction& instruction) {
+		if (instruction.operation == Jlr)
+			return 1;
+		InstructionType type = getRobType(instruction.operation);
+		if ((type == InstructionType::RegisterOp || type == InstructionType::Atomic) && instruction.destination > 0 && instruction.destination < 32)
+			return instruction.destination;
+		return -1;
+	}
+
+	//Whether the instruction at pc needs a physical register and none is free
+	bool renameBlocked() {
+		return physicalRegisters != nullptr && !physicalRegisters->hasFree() && renamedRegister(instructions[pc]) != -1;
+	}
+
 	void fetch() {
-		for (size_t i = 0; i < width; i++) {
-			if (!rob.hasRoom())return;
-			if (pc >= instructions.size() || pc < 0)throw(0);
-			if (fetchedInstructions.size() < width) {
-				fetchedInstructions.emplace(fetchInstruction());
+		if (!fetchHalted && cycle < fetchReadyAt) {
+			frontEndStalls += 1;
+			return;
+		}
+		for (size_t i = 0; i < fetchWidth; i++) {
+			if (fetchHalted)
+				return;
+			if (!rob.hasRoom()) {
+				robStalls += 1;
+				return;
 			}
+			if (pc >= instructions.size() || pc < 0)
+				throw SimulationError("Fetch left the program (pc " + std::to_string(pc) + ")");
+			if (fetchedInstructions.size() < fetchLatch) {
+				//Registers are only freed at commit, so nothing can be fetched until then
+				if (renameBlocked()) {
+					renameStalls += 1;
+					return;
+				}
+				FetchTarget* target = nullptr;
+				if (decoupled()) {
+					if (targets.size() == 0) {
+						if (i == 0)
+							frontEndStalls += 1;
+						return;
+					}
+					target = &targets.front();
+				}
+				if (icache.enabled()) {
+					long long readyAt = icache.access(pc, cycle);
+					if (readyAt > cycle) {
+						fetchReadyAt = readyAt;
+						if (i == 0)
+							frontEndStalls += 1;
+						return;
+					}
+				}
+				PipelineEntry fetched = fetchInstruction(target);
+				if (fetched.opcode != Halt && fetched.opcode != Fence)
+					fetchedInstructions.emplace(fetched);
+				//One target a cycle. Its taken branch bubbles were paid for when it was predicted
+				if (target != nullptr) {
+					if (fetched.instructionAddress == target->end) {
+						targets.pop();
+						return;
+					}
+				}
+				else if (fetched.opcode != Halt && pc != fetched.instructionAddress) {
+					if (takenBubble > 0)
+						fetchReadyAt = cycle + 1 + takenBubble;
+					if (fetchBlock > 0 || takenBubble > 0)
+						return;
+				}
+				else if (fetchBlock > 0 && pc % fetchBlock == 0)
+					return;
+			}
+		}
+	}
+
+	//Runs ahead of fetch when there is a target queue, making the next fetch target from the predictions for
+	//the branches in it. Targets are one fetch block long, or fetchWidth instructions without blocks, and end
+	//early at the first taken branch or jump
+	void predict() {
+		if (!decoupled() || predictHalted || targets.size() >= targetQueue || cycle < predictReadyAt)
+			return;
+		if (predictPC >= instructions.size() || predictPC < 0)
+			throw SimulationError("Branch prediction left the program (pc " + std::to_string(predictPC) + ")");
+		int limit = fetchBlock > 0 ? (predictPC / fetchBlock + 1) * fetchBlock : predictPC + fetchWidth;
+		FetchTarget target{ predictPC, predictPC, predictPC, false };
+		for (int address = predictPC; address < limit && address < int(instructions.size()); address++) {
+			Instruction& instruction = instructions[address];
+			target.end = target.next = address + 1;
+			if (instruction.operation == Halt) {
+				predictHalted = true;
+				break;
+			}
+			if (instruction.operation == Rtl)
+				target.next = returns.pop(registers[1]);
+			else if (groups::jump.count(instruction.operation) > 0) {
+				if (instruction.operation == Jlr)
+					returns.push(address + 1);
+				target.next = instruction.destination;
+			}
+			else if (groups::conditionalBranches.count(instruction.operation) == 0 || !branchPredictor->predictJump(address, instruction.destination))
+				continue;
+			else
+				target.next = instruction.destination;
+			target.taken = true;
+			break;
 		}
+		targets.push(target);
+		predictPC = target.next;
+		//Fetch finds the lines already coming in
+		if (icache.enabled())
+			for (int address = target.start; address < target.end; address++)
+				icache.access(address, cycle);
+		if (target.taken && takenBubble > 0)
+			predictReadyAt = cycle + 1 + takenBubble;
+	}
+
+	//While predicting ahead, returns are predicted from a stack kept as fetch targets are made. A flush goes back
+	//to the stack committed instructions left
+	bool decoupled() {
+		return targetQueue > 0;
+	}
+
+	void retireReturns(Opcode operation, int address) {
+		if (operation == Jlr)
+			committedReturns.push(address + 1);
+		else if (operation == Rtl)
+			committedReturns.pop(0);
 	}
 
-	void decode() {
-		for (size_t i = 0; i < width; i++) {
-			if (fetchedInstructions.size() > 0 && decodedInstructions.size() < width) {
+	//Decodes up to slots instructions, returning how many slots it used
+	size_t decode(size_t slots) {
+		size_t used = 0;
+		for (size_t i = 0; i < slots; i++) {
+			if (fetchedInstructions.size() > 0 && decodedInstructions.size() < decodeLatch) {
+				used += 1;
+				decoded += 1;
+				//A fused pair goes on as one instruction, in one decode slot and one latch entry
+				if (fetchedInstructions.size() > 1 && tryFuse(fetchedInstructions[0], fetchedInstructions[1])) {
+					fetchedInstructions.erase(fetchedInstructions.begin() + 1);
+					decoded += 1;
+				}
 				decodedInstructions.emplace(fetchedInstructions.front());
 				fetchedInstructions.pop();
 			}
 		}
+		return used;
+	}
+
+	//Folds second into first when the config fuses the pair, second directly follows first, and between them they
+	//wait on no more than the two results an entry can
+	bool tryFuse(PipelineEntry& first, const PipelineEntry& second) {
+		if (!fusable[first.opcode][second.opcode] || second.instructionAddress != first.instructionAddress + 1)
+			return false;
+		FusedSecond fused{ second.opcode, second.instructionAddress, second.destination, second.outputRobIndex,
+			second.sourceValue1, second.sourceValue2, OperandSource::Own, OperandSource::Own };
+		if (!fusedOperand(first, second.inputRobIndex1, fused.from1) || !fusedOperand(first, second.inputRobIndex2, fused.from2))
+			return false;
+		first.fused = true;
+		first.second = fused;
+		fusedPairs += 1;
+		return true;
+	}
+
+	//Where a source of the second instruction waiting on tag will come from, if the pair can provide it
+	static bool fusedOperand(const PipelineEntry& first, word tag, OperandSource& from) {
+		if (tag == -1)
+			from = OperandSource::Own;
+		else if (tag == first.outputRobIndex)
+			from = OperandSource::FirstResult;
+		else if (tag == first.inputRobIndex1)
+			from = OperandSource::FirstSource1;
+		else if (tag == first.inputRobIndex2)
+			from = OperandSource::FirstSource2;
+		else
+			return false;
+		return true;
+	}
+
+	bool speculativeLoads() {
+		return storeSets != nullptr;
+	}
+
+	ExecutionGroup& groupFor(Opcode opcode) {
+		if (groups::simpleArithmetic.count(opcode) > 0)
+			return eu_simpleArthmatic;
+		if (groups::complexArithmetic.count(opcode) > 0)
+			return eu_complexArithmatic;
+		if (groups::loads.count(opcode) > 0 || groups::stores.count(opcode) > 0 || groups::atomics.count(opcode) > 0)
+			return eu_loadStore;
+		if (isVector(opcode))
+			return groups::vectorUnit.count(opcode) > 0 ? eu_vector : eu_loadStore;
+		//Branch or jump
+		return eu_branches;
 	}
 
 	bool tryIssue(PipelineEntry& pipeEntry, ExecutionGroup& eGroup) {
-		if (eGroup.canTakeInstruction(pipeEntry.opcode)) {
+		if (eGroup.canTakeInstruction(pipeEntry.unitOpcode())) {
 			eGroup.pushInstruction(pipeEntry);
+			if (usePriorities) {
+				seats[pipeEntry.outputRobIndex] = { &eGroup, pipeEntry.outputRobIndex };
+				if (pipeEntry.fused)
+					seats[pipeEntry.second.outputRobIndex] = { &eGroup, pipeEntry.outputRobIndex };
+				raiseProducers(pipeEntry, eGroup);
+			}
 			return true;
 		}
 		return false;
 	}
 
-	void issue() {
+	//Tells the groups of the instructions pipeEntry still waits on, so select policies can put them first
+	void raiseProducers(const PipelineEntry& pipeEntry, ExecutionGroup& eGroup) {
+		bool branchOrLoad = &eGroup == &eu_branches || groups::loads.count(pipeEntry.unitOpcode()) > 0;
+		//Producers issued before pipeEntry, in order, so each has its seat
+		for (word producer : { pipeEntry.inputRobIndex1, pipeEntry.inputRobIndex2 })
+			if (producer != -1 && seats[producer].group != nullptr)
+				seats[producer].group->waitedOnBy(seats[producer].tag, eGroup.latency(), branchOrLoad);
+	}
+
+	//Issues up to slots instructions, returning how many slots it used
+	size_t issue(size_t slots) {
+		size_t used = 0;
 		//Used to itterate through the decodedInstructions
-		for (size_t i = 0; i < width; i++) {
+		for (size_t i = 0; i < slots; i++) {
 			if (decodedInstructions.size() > 0) {//We have an instruction to send!!
 				PipelineEntry& pipeEntry = decodedInstructions.front();
-				bool issued = false;
-				if (groups::simpleArithmetic.count(pipeEntry.opcode) > 0)
-					issued = tryIssue(pipeEntry, eu_simpleArthmatic);
-				else if (groups::complexArithmetic.count(pipeEntry.opcode) > 0)
-					issued = tryIssue(pipeEntry, eu_complexArithmatic);
-				else if (groups::loads.count(pipeEntry.opcode) > 0 ||
-					groups::stores.count(pipeEntry.opcode) > 0)
-					issued = tryIssue(pipeEntry, eu_loadStore);
-				else//Branch or jump
-					issued = tryIssue(pipeEntry, eu_branches);
-				
-				if(issued)
+				bool issued = tryIssue(pipeEntry, groupFor(pipeEntry.unitOpcode()));
+				if (issued) {
 					decodedInstructions.pop();
+					used += 1;
+				}
+				else {
+					issueStalls += 1;
+					return used;
+				}
 			}
 		}
+		return used;
 	}
 
 	void execute() {
-		auto s1 = eu_simpleArthmatic.update(branchPredictor, registers, memory);
-		auto s2 = eu_complexArithmatic.update(branchPredictor, registers, memory);
-		auto s3 = eu_branches.update(branchPredictor, registers, memory);
-		auto s4 = eu_loadStore.update(branchPredictor, registers, memory);
-		auto finishedValues = s1 + s2 + s3 + s4;
+		auto s1 = eu_simpleArthmatic.update(&context);
+		auto s2 = eu_complexArithmatic.update(&context);
+		auto s3 = eu_branches.update(&context);
+		auto s4 = eu_loadStore.update(&context);
+		auto s5 = eu_vector.update(&context);
+		auto finishedValues = s1 + s2 + s3 + s4 + s5;
 			
 		if (finishedValues.size() == 0)
 			return;
+		complete(finishedValues);
+	}
+
+	//Takes in results this thread's instructions finished with this cycle
+	void complete(std::vector<PipelineEntry>& finishedValues) {
+		//Stores only reach memory at commit, so a load has to take its value from the youngest older store
+		//still in the ROB. Stores are filled in first, as one may finish in the same cycle as the load
+		for (auto& fVal : finishedValues) {
+			if (groups::atomics.count(fVal.opcode) > 0)
+				rob.completeStore(fVal.outputRobIndex, fVal.replayed ? fVal.replayAddress : fVal.sourceValue1, fVal.sourceValue2);
+			else if (groups::stores.count(fVal.opcode) > 0) {
+				word address = fVal.replayed ? fVal.replayAddress : fVal.destination + fVal.sourceValue1;
+				rob.completeStore(fVal.outputRobIndex, address, fVal.sourceValue2);
+				if (speculativeLoads()) {
+					int staleLoad = rob.checkLoadsAfterStore(fVal.outputRobIndex, address);
+					if (staleLoad != -1)
+						storeSets->violation(rob.addressOf(staleLoad), rob.addressOf(fVal.outputRobIndex));
+				}
+			}
+			else if (groups::loads.count(fVal.opcode) > 0 && !fVal.replayed) {
+				word address = fVal.sourceValue1 + fVal.sourceValue2;
+				word forwardingStore = rob.olderStoreTo(fVal.outputRobIndex, address);
+				if (forwardingStore != -1)
+					fVal.result = storedWord(forwardingStore, address);
+				//Loads are also noted when cores share memory, in case another core takes the line
+				if (speculativeLoads() || context.cache != nullptr)
+					rob.recordLoad(fVal.outputRobIndex, address, forwardingStore);
+			}
+			else if (groups::vectorStores.count(fVal.opcode) > 0) {
+				word address = fVal.replayed ? fVal.replayAddress : fVal.destination + fVal.sourceValue1;
+				rob.completeStore(fVal.outputRobIndex, address, fVal.sourceValue2);
+				if (speculativeLoads()) {
+					int staleLoad = rob.checkLoadsAfterStore(fVal.outputRobIndex, address, vectorLength);
+					if (staleLoad != -1)
+						storeSets->violation(rob.addressOf(staleLoad), rob.addressOf(fVal.outputRobIndex));
+				}
+			}
+			else if (groups::vectorLoads.count(fVal.opcode) > 0 && !fVal.replayed)
+				forwardToVectorLoad(fVal);
+		}
 
 		for (auto& fVal : finishedValues) {
 			eu_simpleArthmatic.commonDataBus(fVal.outputRobIndex, fVal.result);
 			eu_complexArithmatic.commonDataBus(fVal.outputRobIndex, fVal.result);
 			eu_branches.commonDataBus(fVal.outputRobIndex, fVal.result);
 			eu_loadStore.commonDataBus(fVal.outputRobIndex, fVal.result);
+			//Only this thread's instructions wait on its results, and without vectors none of them are vector ones
+			if (vectors != nullptr)
+				eu_vector.commonDataBus(fVal.outputRobIndex, fVal.result);
 
 			for (auto& d : decodedInstructions)
 				d.commonDataBus(fVal.outputRobIndex, fVal.result);
 			for (auto& f : fetchedInstructions)
 				f.commonDataBus(fVal.outputRobIndex, fVal.result);
 
-			rob[fVal.outputRobIndex].ready = true;
-			rob[fVal.outputRobIndex].valueField = fVal.result;
-			if (groups::stores.count(fVal.opcode) > 0) {
-				rob[fVal.outputRobIndex].desination = fVal.destination + fVal.sourceValue1;// registers[fVal.sourceValue1];
-				rob[fVal.outputRobIndex].valueField = fVal.sourceValue2;
+			if (groups::stores.count(fVal.opcode) == 0 && groups::atomics.count(fVal.opcode) == 0 && groups::vectorStores.count(fVal.opcode) == 0) {
+				rob.complete(fVal.outputRobIndex, fVal.result);
+				if (physicalRegisters != nullptr)
+					physicalRegisters->complete(fVal.outputRobIndex, fVal.result);
+				if (writesVector(fVal.opcode))
+					vectors->complete(fVal.outputRobIndex);
 			}
 		}
 	}
 
+	//The word a ready store in the ROB writes to address: a scalar store's value, or one of a vector store's words
+	word storedWord(int store, word address) {
+		if (rob.typeOf(store) == InstructionType::VectorStore)
+			return vectors->lanes(rob.valueOf(store))[address - rob.destinationOf(store)];
+		return rob.valueOf(store);
+	}
+
+	//A vector load read every word from memory as it finished; any an older store in the ROB writes are taken from
+	//the youngest such store instead. It only counts as forwarded from a store if every word came from that store
+	void forwardToVectorLoad(const PipelineEntry& load) {
+		word address = load.sourceValue1 + load.sourceValue2;
+		word* lanes = vectors->lanes(load.destination);
+		word forwardedFrom = -1;
+		for (int i = 0; i < vectorLength; i++) {
+			word store = rob.olderStoreTo(load.outputRobIndex, address + i);
+			if (store != -1)
+				lanes[i] = storedWord(store, address + i);
+			forwardedFrom = i == 0 || store == forwardedFrom ? store : -1;
+		}
+		if (speculativeLoads() || context.cache != nullptr)
+			rob.recordLoad(load.outputRobIndex, address, forwardedFrom, vectorLength);
+	}
+
 	void commit() {
-		for (size_t i = 0; i < width; i++) {
+		for (size_t i = 0; i < commitWidth; i++) {
 			if (rob.length() == 0)return;
-			if (rob.head().ready) {
-				auto result = rob.head().commit(memory, registers);
+			//Whatever was fetched past the end of a trace never ran
+			if (trace != nullptr && commited >= (long long)trace->recordCount())return;
+			if (rob.isReady(rob.headIndex())) {
+				//The load and everything after it go, and the load is fetched again
+				if (rob.isStale(rob.headIndex())) {
+					if (rob.lostLine(rob.headIndex()))
+						coherenceFlushes += 1;
+					else orderingFlushes += 1;
+					flushEverything(rob.addressOf(rob.headIndex()));
+					return;
+				}
+				int index = rob.headIndex();
+				int address = rob.addressOf(index);
+				bool valueWrong = rob.isValueWrong(index);
+				if (context.cache != nullptr && !mayCommit(index)) {
+					coherenceStalls += 1;
+					return;
+				}
+				if (loadValues != nullptr && groups::loads.count(instructions[address].operation) > 0)
+					loadValues->train(address, rob.valueOf(index));
+				auto result = rob.commitHead(dataMemory(), registers, vectors.get());
+				//An atomic's result only exists now, and fetch waited for it
+				if (rob.typeOf(index) == InstructionType::Atomic || rob.typeOf(index) == InstructionType::Fence) {
+					if (physicalRegisters != nullptr)
+						physicalRegisters->complete(index, rob.valueOf(index));
+					fetchHalted = false;
+				}
 				auto popped = rob.pop();
 				commited += 1;
+				if (physicalRegisters != nullptr)
+					physicalRegisters->retire(index);
+				if (vectors != nullptr && rob.typeOf(index) == InstructionType::Vector)
+					vectors->retire(index);
+				if (decoupled())
+					retireReturns(popped.operation, address);
+				//The load itself read the right value; everything after it may have used the wrong one
+				if (valueWrong) {
+					valueFlushes += 1;
+					flushEverything(address + 1);
+					return;
+				}
+				//A taken branch commits as BranchCorrect and an untaken one as FlushEverything
+				if (result == CommitResult::BranchCorrect || result == CommitResult::FlushEverything) {
+					branches += 1;
+					if ((result == CommitResult::BranchCorrect) != popped.predictedToJump)
+						mispredictions += 1;
+				}
 				if (result == CommitResult::FlushEverything && popped.predictedToJump) {
 					flushEverything(popped.pcIfBadlyPredicted);
 					return;
@@ -303,21 +987,88 @@ private:
 					//branchHistory.pop();
 					return;
 				}
+				else if (result == CommitResult::Halt) {
+					halted = true;
+					return;
+				}
+				//Replays don't keep register values, so the return target comes from the trace
+				else if (popped.operation == Rtl) {
+					int target = trace == nullptr ? registers[1] : popped.returnTarget;
+					if (popped.pcIfBadlyPredicted != target) {
+						flushEverything(target);
+						return;
+					}
+				}
 			}
 			else return;
 		}
 	}
 
 
+	//A store or atomic only changes memory once this core's data cache may write the line; a vector store needs
+	//every line it writes
+	bool mayCommit(int index) {
+		InstructionType type = rob.typeOf(index);
+		size_t address = size_t(uint32_t(rob.destinationOf(index)));
+		if (type == InstructionType::VectorStore) {
+			bool writable = true;
+			for (int i = 0; i < vectorLength; i++)
+				writable &= context.cache->canWrite(address + i);
+			return writable;
+		}
+		if (type != InstructionType::Store && type != InstructionType::Atomic)
+			return true;
+		return context.cache->canWrite(address);
+	}
+
+	//What loads, stores and atomics work on: the CPU's own memory, or the memory cores share
+	MainMemory& dataMemory() {
+		return *context.memory;
+	}
+
+	//Makes this CPU core number core of several sharing memory through cache. The core's number starts in tp
+	void joinSystem(MainMemory& shared, DataCache* cache, int core) {
+		context.memory = &shared;
+		context.cache = cache;
+		memory = MainMemory();
+		registers[4] = core;
+		if (physicalRegisters != nullptr)
+			physicalRegisters->setCommitted(4, core);
+	}
+
+	//Another core is taking the line from first to first + count to write it. A load that already read it may
+	//have read what, in program order, it should only see after that write, so it is fetched again once it
+	//reaches the head of the ROB; older instructions still running are kept
+	void loseLine(word first, int count) {
+		rob.loseLoadsFrom(first, count);
+	}
+
 	void flushEverything(int newPC) {
 		flushes += 1;
 		rob.flushEverything();
-		eu_simpleArthmatic.flushEverything();
-		eu_complexArithmatic.flushEverything();
-		eu_loadStore.flushEverything();
-		eu_branches.flushEverything();
+		if (physicalRegisters != nullptr)
+			physicalRegisters->flushEverything();
+		if (vectors != nullptr)
+			vectors->flushEverything();
+		if (loadValues != nullptr)
+			loadValues->flushEverything();
+		for (ExecutionGroup* group : { &eu_simpleArthmatic, &eu_complexArithmatic, &eu_loadStore, &eu_branches, &eu_vector }) {
+			if (ownGroups != nullptr)
+				group->flushEverything();
+			else group->flushThread(thread);
+		}
 		while (fetchedInstructions.size() > 0)fetchedInstructions.pop();
 		while (decodedInstructions.size() > 0)decodedInstructions.pop();
+		fetchHalted = false;
+		//A fill already started carries on, but fetch no longer waits for it
+		fetchReadyAt = 0;
+		targets.clear();
+		predictPC = newPC;
+		predictHalted = false;
+		predictReadyAt = 0;
+		returns = committedReturns;
+		if (trace != nullptr)
+			offTrace = trace->finished();
 		//auto fix = branchHistory.front();
 		pc = newPC;
 	}
@@ -0,0 +1,295 @@
+#pragma once
+#include "globalValues.h"
+#include <atomic>
+#include <bit>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+//What a core's data cache and the directory say to each other. A cache asks for a line to read (GetS) or to write
+//(GetM); the directory grants it, takes it back from the others (Invalidate) or takes away the right to write it
+//(Downgrade). Lines are numbered by word address over the line length
+enum class CoherenceKind : uint8_t {
+	GetS, GetM, Grant, Invalidate, Downgrade
+};
+
+struct CoherenceMessage {
+	CoherenceKind kind;
+	int line;
+	//For a request, the cycle it was made in; for a grant, the cycle the line arrives in
+	long long at = 0;
+	//For a grant, whether the line comes Modified rather than Shared
+	bool writable = false;
+};
+
+//A fixed size ring between one producer and one consumer that never wait on each other: the producer only moves
+//tail and the consumer only head, each published with release and read with acquire
+template<class T>
+class MessageQueue {
+public:
+	bool push(const T& item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == slots.size())
+			return false;
+		slots[t & mask] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		item = slots[h & mask];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	//How many more the producer can push for certain
+	size_t space() {
+		return slots.size() - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+	}
+
+	//capacity is rounded up to a power of two
+	MessageQueue(size_t capacity) :
+		slots(std::bit_ceil(std::max<size_t>(capacity, 2))),
+		mask(slots.size() - 1)
+	{}
+
+private:
+	std::vector<T> slots;
+	size_t mask;
+	alignas(64) std::atomic<size_t> head{ 0 };
+	alignas(64) std::atomic<size_t> tail{ 0 };
+};
+
+//A core's private data cache as far as coherence needs it: which lines it holds, and whether Shared (it may read)
+//or Modified (it may also write). The words themselves stay in the memory the cores share, which only the holder
+//of a Modified line writes and nobody writes while a line is Shared, so no two cores ever touch a word at once.
+//A miss is sent to the directory and the access waits until the line arrives. Lines are dropped silently, so
+//the directory may still count a core as holding a line it has evicted; its messages about it are then ignored
+class DataCache {
+public:
+	enum State : uint8_t {
+		Invalid, Shared, Modified
+	};
+
+	//Requests to the directory, and its answers
+	MessageQueue<CoherenceMessage> toBus;
+	MessageQueue<CoherenceMessage> fromBus;
+	//The cycle the core is in, kept up to date by whoever clocks it
+	long long now = 0;
+
+	long long readMisses = 0;
+	long long writeMisses = 0;
+	//Lines other cores took back, and Modified lines evicted
+	long long invalidations = 0;
+	long long writebacks = 0;
+
+	int lineLength() {
+		return words;
+	}
+
+	//Whether the word can be read this cycle; if not, the line has been asked for. Words past the end of memory
+	//are never shared, and read as 0
+	bool canRead(size_t address) {
+		return access(address, false);
+	}
+
+	//Whether the word can be written this cycle; if not, the right to has been asked for
+	bool canWrite(size_t address) {
+		return access(address, true);
+	}
+
+	//Takes in a message from the directory. True when it takes away a line, so the core can throw out loads
+	//that read it early
+	bool receive(const CoherenceMessage& message) {
+		Way* way = find(message.line);
+		if (message.kind == CoherenceKind::Grant) {
+			std::erase_if(pending, [&](const Request& request) { return request.line == message.line && (message.writable || !request.write); });
+			//An upgrade from Shared only waits for the right to write; the words are already there
+			if (way != nullptr && message.writable) {
+				way->state = Modified;
+				way->writableAt = message.at;
+				return false;
+			}
+			if (way == nullptr)
+				way = victim(message.line);
+			*way = Way{ message.line, message.writable ? Modified : Shared, message.at, message.at, now };
+			return false;
+		}
+		if (message.kind == CoherenceKind::Downgrade) {
+			if (way != nullptr && way->state == Modified)
+				way->state = Shared;
+			return false;
+		}
+		if (way != nullptr) {
+			invalidations += 1;
+			way->state = Invalid;
+		}
+		//Loads may have read it before it was evicted
+		return true;
+	}
+
+	DataCache(const DataCacheData& data, size_t memoryWords) :
+		toBus(queueLength),
+		fromBus(queueLength),
+		sets(data.sets),
+		associativity(data.ways),
+		words(data.line),
+		memoryWords(memoryWords),
+		ways(size_t(data.sets) * data.ways)
+	{}
+
+	//Enough for every request a core can have waiting, and a quantum's answers
+	static const size_t queueLength = 1024;
+
+private:
+	struct Way {
+		int line = -1;
+		State state = Invalid;
+		//The cycles it can first be read and written in
+		long long readableAt = 0;
+		long long writableAt = 0;
+		long long lastUsed = -1;
+	};
+	struct Request {
+		int line;
+		bool write;
+	};
+	int sets, associativity, words;
+	size_t memoryWords;
+	std::vector<Way> ways;
+	//Asked for and not yet granted, so each is only asked for once
+	std::vector<Request> pending;
+
+	Way* find(int line) {
+		Way* set = &ways[size_t(line % sets) * associativity];
+		for (int i = 0; i < associativity; i++)
+			if (set[i].line == line && set[i].state != Invalid)
+				return &set[i];
+		return nullptr;
+	}
+
+	//The way a new line goes in: an empty one, or the least recently used
+	Way* victim(int line) {
+		Way* set = &ways[size_t(line % sets) * associativity];
+		Way* chosen = set;
+		for (int i = 0; i < associativity; i++) {
+			if (set[i].state == Invalid)
+				return &set[i];
+			if (set[i].lastUsed < chosen->lastUsed)
+				chosen = &set[i];
+		}
+		if (chosen->state == Modified)
+			writebacks += 1;
+		return chosen;
+	}
+
+	bool access(size_t address, bool write) {
+		if (address >= memoryWords)
+			return true;
+		int line = int(address / words);
+		Way* way = find(line);
+		if (way != nullptr && (!write || way->state == Modified)) {
+			if (now < (write ? way->writableAt : way->readableAt))
+				return false;
+			way->lastUsed = now;
+			return true;
+		}
+		for (Request& request : pending)
+			if (request.line == line && request.write == write)
+				return false;
+		//A full queue just means asking again next cycle
+		if (toBus.push(CoherenceMessage{ write ? CoherenceKind::GetM : CoherenceKind::GetS, line, now })) {
+			pending.push_back(Request{ line, write });
+			(write ? writeMisses : readMisses) += 1;
+		}
+		return false;
+	}
+};
+
+//The bus side of MSI: for each line some core has asked for, which cores may hold it Shared and which one, if any,
+//holds it Modified. It only runs between quanta, when no core is running, and answers everything asked in the
+//quantum oldest first, ties going to the lower numbered core. A line changes hands at most once a quantum: a
+//request for a line already granted to another core this time round waits for the next, so every core gets to
+//use what it was granted before it can be taken away, and two cores can't keep taking a line from each other
+class Directory {
+public:
+	//Requests answered and messages sent
+	long long messages = 0;
+
+	//Answers what the caches asked for, in the quantum that ends at boundary. A grant arrives missCycles after it
+	//was asked for, but not before boundary
+	void serve(const std::vector<DataCache*>& caches, long long boundary) {
+		for (int core = 0; core < int(caches.size()); core++) {
+			CoherenceMessage message;
+			while (caches[core]->toBus.pop(message))
+				waiting.push_back(Waiting{ core, message });
+		}
+		std::stable_sort(waiting.begin(), waiting.end(), [](const Waiting& a, const Waiting& b) {
+			return a.message.at != b.message.at ? a.message.at < b.message.at : a.core < b.core;
+		});
+		std::unordered_map<int, int> grantedTo;
+		std::vector<Waiting> later;
+		for (Waiting& request : waiting) {
+			auto granted = grantedTo.find(request.message.line);
+			if ((granted != grantedTo.end() && granted->second != request.core) || !answer(caches, request, boundary)) {
+				later.push_back(request);
+				continue;
+			}
+			grantedTo[request.message.line] = request.core;
+		}
+		waiting = std::move(later);
+	}
+
+	Directory(int missCycles) :
+		missCycles(missCycles)
+	{}
+
+private:
+	struct Line {
+		//Bit c set when core c may hold the line
+		uint64_t sharers = 0;
+		int owner = -1;
+	};
+	struct Waiting {
+		int core;
+		CoherenceMessage message;
+	};
+	std::unordered_map<int, Line> lines;
+	//Carried over from earlier quanta, older than anything new
+	std::vector<Waiting> waiting;
+	int missCycles;
+
+	//False, changing nothing, if a cache it has to tell is out of room for now
+	bool answer(const std::vector<DataCache*>& caches, const Waiting& request, long long boundary) {
+		Line& line = lines[request.message.line];
+		int core = request.core;
+		bool write = request.message.kind == CoherenceKind::GetM || line.owner == core;
+		uint64_t others = write ? line.sharers & ~(uint64_t(1) << core) : (line.owner != -1 ? uint64_t(1) << line.owner : 0);
+		if (caches[core]->fromBus.space() == 0)
+			return false;
+		for (int c = 0; c < int(caches.size()); c++)
+			if ((others >> c & 1) != 0 && caches[c]->fromBus.space() == 0)
+				return false;
+
+		CoherenceKind take = write ? CoherenceKind::Invalidate : CoherenceKind::Downgrade;
+		for (int c = 0; c < int(caches.size()); c++)
+			if ((others >> c & 1) != 0) {
+				caches[c]->fromBus.push(CoherenceMessage{ take, request.message.line });
+				messages += 1;
+			}
+		if (write) {
+			line.sharers = uint64_t(1) << core;
+			line.owner = core;
+		}
+		else {
+			line.sharers |= uint64_t(1) << core;
+			line.owner = -1;
+		}
+		caches[core]->fromBus.push(CoherenceMessage{ CoherenceKind::Grant, request.message.line, std::max(boundary, request.message.at + missCycles), write });
+		messages += 2;
+		return true;
+	}
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include "ReservationStation.h"
+#include <memory>
 
 class ExecutionGroup {
 public:
@@ -21,18 +22,88 @@ public:
 			eu.flushEverything();
 	}
 
-	std::vector<PipelineEntry> update(BranchPredictor* branchPredictor, std::vector<word>& registers, std::vector<word>& memory) {
+	void flushThread(int thread) {
+		station->flushThread(thread);
+		for (auto& eu : eus)
+			eu.flushThread(thread);
+	}
+
+	//threads is indexed by the thread each entry belongs to
+	std::vector<PipelineEntry> update(const ThreadContext* threads) {
 		updateReservationStations();
-		return updateEUs(branchPredictor, registers, memory);
+		return updateEUs(threads);
+	}
+
+	int stationOccupancy() {
+		return station->occupancy();
+	}
+
+	int stationOccupancyOf(int thread) {
+		return station->occupancyOf(thread);
+	}
+
+	long long busyCycles() {
+		long long busy = 0;
+		for (auto& eu : eus)
+			busy += eu.busyCycles;
+		return busy;
+	}
+
+	//Whether the next cycle would start an instruction on one of the units
+	bool canDispatch() {
+		for (auto& eu : eus)
+			if (eu.hasSpace())
+				return station->readyToExecute();
+		return false;
+	}
+
+	//Cycles until the first busy unit finishes, counting the one it finishes in; INT_MAX when none are busy
+	int cyclesUntilFinish() {
+		int soonest = INT_MAX;
+		for (auto& eu : eus)
+			if (!eu.hasSpace())
+				soonest = std::min(soonest, eu.cyclesRemaining());
+		return soonest;
+	}
+
+	void skip(int cycles) {
+		for (auto& eu : eus)
+			eu.skip(cycles);
+	}
+
+	void resetCounters() {
+		for (auto& eu : eus)
+			eu.busyCycles = 0;
+	}
+
+	int unitCount() {
+		return eus.size();
+	}
+
+	int latency() {
+		return cyclesToComplete;
 	}
 
-	std::optional<word> getReturnAddress() {
-		auto ra = station->getReturnAddress();
+	bool usesPriorities() {
+		return policy != SelectPolicy::Oldest;
+	}
+
+	//An instruction just issued still waiting on producer, which may be in this group's station. consumerLatency
+	//is the cycles the consumer's own units take
+	void waitedOnBy(word producer, int consumerLatency, bool consumerIsBranchOrLoad) {
+		if (policy == SelectPolicy::Critical)
+			station->raisePriority(producer, consumerLatency);
+		else if (policy == SelectPolicy::BranchLoad && consumerIsBranchOrLoad)
+			station->raisePriority(producer, 1);
+	}
+
+	std::optional<word> getReturnAddress(int thread) {
+		auto ra = station->getReturnAddress(thread);
 		if (ra.has_value())
 			return ra;
 		int leastCycles = INT_MAX;
 		for (auto& eu : eus) {
-			auto nra = eu.fetchReturnAddress();
+			auto nra = eu.fetchReturnAddress(thread);
 			if (nra.has_value() && eu.currrentCompleteCycles() < leastCycles) {
 				leastCycles = eu.currrentCompleteCycles();//Make sure you have the least executed
 				ra = nra;
@@ -41,22 +112,28 @@ public:
 		return ra;
 	}
 
-	ExecutionGroup(int reservationCapacity, int numberOfEus, int cyclesToComplete, bool loadStore){
+	ExecutionGroup(int reservationCapacity, int numberOfEus, int cyclesToComplete, bool loadStore, StoreSetPredictor* storeSets = nullptr,
+		SelectPolicy policy = SelectPolicy::Oldest):
+		cyclesToComplete(cyclesToComplete),
+		policy(policy)
+	{
 		for (int i = 0; i < numberOfEus; i++)
-			eus.emplace_back(cyclesToComplete);
+			eus.emplace_back(cyclesToComplete, GlobalData::vector.extraCycles());
 
 		if (loadStore)
-			station = new LoadStoreQueue(reservationCapacity);
+			station = new LoadStoreQueue(reservationCapacity, storeSets);
 		else station = new ReservationStation(reservationCapacity);
 	}
 
-	ExecutionGroup(GlobalData::EUData data, bool loadStore):
-		ExecutionGroup(data.sizeOfReservations, data.numberOfUnits, data.cyclesNeeded, loadStore)
+	ExecutionGroup(GlobalData::EUData data, bool loadStore, StoreSetPredictor* storeSets = nullptr):
+		ExecutionGroup(data.sizeOfReservations, data.numberOfUnits, data.cyclesNeeded, loadStore, storeSets, data.policy)
 	{}
 
 private:
 	GenericReservationStation* station;
 	std::vector<ExecutionUnit> eus;
+	int cyclesToComplete;
+	SelectPolicy policy;
 
 	void updateReservationStations() {
 		for (auto& eu : eus) {
@@ -67,15 +144,35 @@ private:
 			}
 		}
 	}
-	std::vector<PipelineEntry> updateEUs(BranchPredictor* branchPredictor, std::vector<word>& registers, std::vector<word>& memory) {
+	std::vector<PipelineEntry> updateEUs(const ThreadContext* threads) {
 		std::vector<PipelineEntry> finished;
 		for (auto& eu : eus) {
 			eu.update();
-			if (eu.hasFinishedExecuting()) {
-				finished.emplace_back(eu.getCompletedEntry(branchPredictor, registers, memory));
-			}
+			if (eu.hasFinishedExecuting() && eu.canFinish(threads))
+				eu.getCompletedEntries(threads, finished);
 		}
 
 		return finished;
 	}
-};
\ No newline at end of file
+};
+
+//The groups instructions execute on, in config order, and the store set table the load store queue consults.
+//A CPU builds its own unless it is one thread of an SMT core, whose threads all share one
+struct ExecutionGroups {
+	std::unique_ptr<StoreSetPredictor> storeSets;
+	ExecutionGroup simpleArithmetic;
+	ExecutionGroup complexArithmetic;
+	ExecutionGroup branches;
+	ExecutionGroup loadStore;
+	//Vector arithmetic; vector loads and stores use loadStore
+	ExecutionGroup vector;
+
+	ExecutionGroups() :
+		storeSets(GlobalData::storeSetSize > 0 ? std::make_unique<StoreSetPredictor>(GlobalData::storeSetSize) : nullptr),
+		simpleArithmetic(GlobalData::simpleInteger, false),
+		complexArithmetic(GlobalData::complexInteger, false),
+		branches(GlobalData::branchUnits, false),
+		loadStore(GlobalData::loadStoreUnits, true, storeSets.get()),
+		vector(GlobalData::vectorUnits, false)
+	{}
+};
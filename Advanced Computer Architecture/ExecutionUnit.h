@@ -1,5 +1,23 @@
 #pragma once
 #include "riscv.h"
+#include "Coherence.h"
+#include "RegisterFile.h"
+
+//Where a fused pair's second instruction takes a source from when the pair executes
+enum class OperandSource : uint8_t {
+	Own, FirstResult, FirstSource1, FirstSource2
+};
+
+//The second instruction of a pair decode fused, carried by the first's entry
+struct FusedSecond {
+	Opcode opcode;
+	int instructionAddress;
+	int destination;
+	word outputRobIndex;
+	//Only meaningful for a source that is Own
+	word sourceValue1, sourceValue2;
+	OperandSource from1, from2;
+};
 
 struct PipelineEntry {
 	Opcode opcode;
@@ -13,6 +31,22 @@ struct PipelineEntry {
 	//Set when the instruction executes
 	word result;
 
+	//Only used when replaying a trace; the outcome and address come from the trace instead of values, as does the
+	//value of anything writing ra, which rtl is predicted from
+	bool replayed = false;
+	bool replayTaken = false;
+	bool trainPredictor = true;
+	word replayAddress = 0;
+	word replayValue = 0;
+
+	//The hardware thread it belongs to; always 0 outside SMT
+	uint8_t thread = 0;
+
+	//Set when decode fused the next instruction into this one. It takes one reservation station slot and one
+	//unit, and executes straight after this one; both results come out together
+	bool fused = false;
+	FusedSecond second;
+
 	PipelineEntry() = default;
 	PipelineEntry(int instructionAddress, int destination = -1):
 		instructionAddress(instructionAddress),
@@ -25,6 +59,40 @@ struct PipelineEntry {
 		return inputRobIndex1 == -1 && inputRobIndex2 == -1;
 	}
 
+	//The instruction that decides which group and queue the entry goes to: for a fused pair, whichever of the two
+	//isn't simple arithmetic
+	Opcode unitOpcode() const {
+		return fused && groups::simpleArithmetic.count(opcode) > 0 ? second.opcode : opcode;
+	}
+
+	int unitInstructionAddress() const {
+		return fused && groups::simpleArithmetic.count(opcode) > 0 ? second.instructionAddress : instructionAddress;
+	}
+
+	//The second instruction of a fused pair as an entry of its own, once the first has its result
+	PipelineEntry secondOfPair() const {
+		PipelineEntry entry(second.instructionAddress, second.destination);
+		entry.opcode = second.opcode;
+		entry.thread = thread;
+		entry.outputRobIndex = second.outputRobIndex;
+		entry.sourceValue1 = operand(second.from1, second.sourceValue1);
+		entry.sourceValue2 = operand(second.from2, second.sourceValue2);
+		return entry;
+	}
+
+	word operand(OperandSource from, word own) const {
+		switch (from) {
+		case OperandSource::FirstResult:
+			return result;
+		case OperandSource::FirstSource1:
+			return sourceValue1;
+		case OperandSource::FirstSource2:
+			return sourceValue2;
+		default:
+			return own;
+		}
+	}
+
 	void commonDataBus(word robIndex, word value) {
 		if (inputRobIndex1 == robIndex) {
 			inputRobIndex1 = -1;
@@ -37,9 +105,28 @@ struct PipelineEntry {
 	}
 };
 
+//The word a load reads. Loads run ahead of older branches, so a wrong path one can compute any address
+inline size_t loadAddressOf(const PipelineEntry& e) {
+	return size_t(uint32_t(e.sourceValue1 + e.sourceValue2));
+}
+
 #include "BranchPredictor.h"
 
-word getResultOfOperation(BranchPredictor*, PipelineEntry&, std::vector<word>&, std::vector<word>&);
+inline word getResultOfOperation(BranchPredictor*, PipelineEntry&, std::vector<word>&, MainMemory&);
+inline word getReplayedResultOfOperation(BranchPredictor*, PipelineEntry&);
+
+//What an instruction executes against: the predictor, registers and memory of the hardware thread it belongs to.
+//Units find an entry's as threads[entry.thread]. cache is only there when cores share memory, and vectors when
+//the program uses vector instructions
+struct ThreadContext {
+	BranchPredictor* branchPredictor;
+	std::vector<word>* registers;
+	MainMemory* memory;
+	DataCache* cache = nullptr;
+	VectorRegisterFile* vectors = nullptr;
+};
+
+inline word getVectorResult(PipelineEntry&, const ThreadContext&);
 
 class ExecutionUnit {
 public:
@@ -50,43 +137,111 @@ public:
 		currentTask = task;
 		waiting = false;
 		currentCycles = 0;
+		taskCycles = cyclesToComplete + (isVector(task.opcode) ? vectorCycles : 0);
 	}
 	void update() {
-		if(!waiting && currentCycles < cyclesToComplete)
+		if (!waiting && currentCycles < taskCycles) {
 			currentCycles += 1;
+			busyCycles += 1;
+		}
 	}
 	bool hasFinishedExecuting() {
-		return currentCycles == cyclesToComplete && !waiting;
+		return currentCycles == taskCycles && !waiting;
 	}
 
-	std::optional<word> fetchReturnAddress() {
-		if (waiting == false && currentTask.opcode == Jlr)
+	std::optional<word> fetchReturnAddress(int thread) {
+		if (waiting == false && currentTask.opcode == Jlr && currentTask.thread == thread)
 			return currentTask.instructionAddress;
 		return std::nullopt;
 	}
 
-	PipelineEntry getCompletedEntry(BranchPredictor* branchPredictor, std::vector<word>& registers, std::vector<word>& memory) {
-		currentTask.result = getResultOfOperation(branchPredictor, currentTask, registers, memory);
+	//A load reads memory as it finishes, which with a data cache it can only do once the line is there. Until then
+	//the load holds the unit
+	bool canFinish(const ThreadContext* threads) {
+		const ThreadContext& context = threads[currentTask.thread];
+		if (context.cache == nullptr || currentTask.replayed)
+			return true;
+		if (groups::loads.count(currentTask.opcode) > 0)
+			return context.cache->canRead(loadAddressOf(currentTask));
+		//Every line a vector load touches is asked for at once
+		if (groups::vectorLoads.count(currentTask.opcode) > 0) {
+			bool readable = true;
+			for (int i = 0; i < context.vectors->length(); i++)
+				readable &= context.cache->canRead(loadAddressOf(currentTask) + i);
+			return readable;
+		}
+		if (currentTask.fused && groups::loads.count(currentTask.second.opcode) > 0) {
+			PipelineEntry first = currentTask;
+			first.result = getResultOfOperation(context.branchPredictor, first, *context.registers, *context.memory);
+			return context.cache->canRead(loadAddressOf(first.secondOfPair()));
+		}
+		return true;
+	}
+
+	//Adds what finished to finished: the task, or both halves of a fused pair, first then second
+	void getCompletedEntries(const ThreadContext* threads, std::vector<PipelineEntry>& finished) {
+		BranchPredictor* branchPredictor = threads[currentTask.thread].branchPredictor;
+		std::vector<word>& registers = *threads[currentTask.thread].registers;
+		MainMemory& memory = *threads[currentTask.thread].memory;
+		if (currentTask.replayed)
+			currentTask.result = getReplayedResultOfOperation(branchPredictor, currentTask);
+		else if (isVector(currentTask.opcode))
+			currentTask.result = getVectorResult(currentTask, threads[currentTask.thread]);
+		else
+			currentTask.result = getResultOfOperation(branchPredictor, currentTask, registers, memory);
 		//printf("Finished task %d %d %d %d\n", (int)currentTask.opcode, currentTask.destination, currentTask.sourceValue1, currentTask.sourceValue2);
 		waiting = true;
-		return currentTask;
+		finished.emplace_back(currentTask);
+		if (currentTask.fused) {
+			finished.back().fused = false;
+			PipelineEntry second = currentTask.secondOfPair();
+			second.result = getResultOfOperation(branchPredictor, second, registers, memory);
+			finished.emplace_back(second);
+		}
 	}
 
 	void flushEverything() {
 		waiting = true;
 	}
 
+	void flushThread(int thread) {
+		if (currentTask.thread == thread)
+			waiting = true;
+	}
+
+	//Cycles spent working on something, including work later flushed
+	long long busyCycles = 0;
+
+	//Cycles until the current task finishes, counting the one it finishes in; 0 when idle
+	int cyclesRemaining() {
+		return waiting ? 0 : taskCycles - currentCycles;
+	}
+
+	//Moves the current task on as if cycles cycles had passed without it finishing
+	void skip(int cycles) {
+		if (!waiting) {
+			currentCycles += cycles;
+			busyCycles += cycles;
+		}
+	}
+
 	int currrentCompleteCycles() {
 		return currentCycles;
 	}
 
-	ExecutionUnit(int cyclesToCompleteTask):
+	//A vector instruction takes vectorCycles more than anything else
+	ExecutionUnit(int cyclesToCompleteTask, int vectorCycles = 0):
 		cyclesToComplete(cyclesToCompleteTask),
+		vectorCycles(vectorCycles),
+		taskCycles(cyclesToCompleteTask),
 		currentTask(-1)
 	{}
 
 private:
 	int cyclesToComplete;
+	int vectorCycles;
+	//What the current task takes
+	int taskCycles;
 	PipelineEntry currentTask;
 	int currentCycles = 0;
 	bool waiting = true;
@@ -0,0 +1,70 @@
+#pragma once
+#include "riscv.h"
+#include <fstream>
+
+//A self checking program lists what memory should hold when it finishes as comment lines in its source:
+//#expect label value value ...
+//which says the words starting at label should be those values
+struct Expectation {
+	std::string label;
+	std::vector<word> values;
+};
+
+//Images don't keep comments, so only source files have expectations
+inline std::vector<Expectation> readExpectations(const std::string& filename) {
+	std::vector<Expectation> expectations;
+	std::ifstream file(filename);
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.size() > 0 && line.back() == '\r')
+			line.pop_back();
+		auto splits = assembler::splitLine(line);
+		if (splits.size() < 2 || splits[0] != "#expect")
+			continue;
+		Expectation& expectation = expectations.emplace_back();
+		expectation.label = splits[1];
+		for (size_t i = 2; i < splits.size(); i++)
+			if (splits[i].size() > 0)
+				expectation.values.emplace_back(std::atoi(splits[i].c_str()));
+	}
+	return expectations;
+}
+
+//Describes every word that doesn't match; empty when the program got everything right.
+//Works on anything that reads memory with [], so both the pipelined and functional models can be checked
+template<class Machine>
+std::vector<std::string> checkExpectations(const std::vector<Expectation>& expectations, const std::unordered_map<std::string, int>& labels, Machine& machine) {
+	std::vector<std::string> mismatches;
+	for (auto& expectation : expectations) {
+		auto label = labels.find(expectation.label);
+		if (label == labels.end()) {
+			mismatches.emplace_back("No label named " + expectation.label);
+			continue;
+		}
+		for (size_t i = 0; i < expectation.values.size(); i++) {
+			word actual = machine[label->second + int(i)];
+			if (actual != expectation.values[i])
+				mismatches.emplace_back(expectation.label + "[" + std::to_string(i) + "] is " + std::to_string(actual) + ", expected " + std::to_string(expectation.values[i]));
+		}
+	}
+	return mismatches;
+}
+
+//A kernel written for several cores sharing memory says how many it is meant for with a line #cores n; 1 if not
+inline int readCoreCount(const std::string& filename) {
+	std::ifstream file(filename);
+	std::string line;
+	while (std::getline(file, line)) {
+		auto splits = assembler::splitLine(line);
+		if (splits.size() >= 2 && splits[0] == "#cores")
+			return std::max(1, std::atoi(splits[1].c_str()));
+	}
+	return 1;
+}
+
+inline int expectedWordCount(const std::vector<Expectation>& expectations) {
+	int count = 0;
+	for (auto& expectation : expectations)
+		count += expectation.values.size();
+	return count;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+
+//Tags of a set associative instruction cache with least recently used replacement. Instructions are a word each,
+//so addresses are instruction indices. A line being filled is there at once but can only be read from the cycle
+//its fill completes, so a demand miss and the prefetches ahead of it overlap
+class InstructionCache {
+public:
+	long long misses = 0;
+
+	bool enabled() {
+		return sets > 0;
+	}
+
+	//The cycle the line holding address can be read from, starting its fill at now if it isn't there
+	long long access(int address, long long now) {
+		int line = address / lineLength;
+		Way* set = &ways[(line % sets) * associativity];
+		Way* victim = set;
+		for (int i = 0; i < associativity; i++) {
+			if (set[i].line == line) {
+				set[i].lastUsed = now;
+				return set[i].readyAt;
+			}
+			if (set[i].lastUsed < victim->lastUsed)
+				victim = &set[i];
+		}
+		misses += 1;
+		*victim = Way{ line, now + missCycles, now };
+		return victim->readyAt;
+	}
+
+	void reset() {
+		std::fill(ways.begin(), ways.end(), Way());
+		misses = 0;
+	}
+
+	InstructionCache(int sets, int associativity, int lineLength, int missCycles) :
+		sets(sets),
+		associativity(std::max(1, associativity)),
+		lineLength(std::max(1, lineLength)),
+		missCycles(missCycles),
+		ways(std::max(0, sets) * std::max(1, associativity))
+	{}
+
+private:
+	struct Way {
+		int line = -1;
+		long long readyAt = 0;
+		//Empty ways are the least recently used of all
+		long long lastUsed = -1;
+	};
+	int sets, associativity, lineLength, missCycles;
+	std::vector<Way> ways;
+};
+
+//A run of instructions the branch predictor expects fetch to need next: start up to, but not including, end.
+//Only the last can be a taken branch or a jump, after which fetch goes on at next
+struct FetchTarget {
+	int start;
+	int end;
+	int next;
+	bool taken;
+};
+
+//Return addresses for predicting Rtl ahead of fetch; the oldest is lost once it is full
+class ReturnStack {
+public:
+	void push(int address) {
+		if (addresses.size() == depth)
+			addresses.erase(addresses.begin());
+		addresses.push_back(address);
+	}
+
+	//fallback if it is empty
+	int pop(int fallback) {
+		if (addresses.size() == 0)
+			return fallback;
+		int address = addresses.back();
+		addresses.pop_back();
+		return address;
+	}
+
+	void clear() {
+		addresses.clear();
+	}
+
+private:
+	static const size_t depth = 32;
+	std::vector<int> addresses;
+};
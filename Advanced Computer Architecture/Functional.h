@@ -0,0 +1,170 @@
+#pragma once
+#include "operations.h"
+#include "Trace.h"
+
+//Runs a program one instruction at a time with no timing at all, in program order
+//Uses the same opcode semantics as the execution units, so its results are what the pipeline should commit
+class FunctionalCPU {
+public:
+	long long executed = 0;
+
+	bool finished() {
+		return registers[3] == 1 || halted;
+	}
+
+	//Executes the instruction at pc, describing what happened in record
+	void step(TraceRecord& record) {
+		if (pc < 0 || pc >= (int)instructions.size())
+			throw SimulationError("Functional run left the program (pc " + std::to_string(pc) + ")");
+		Instruction& instruction = instructions[pc];
+		record = TraceRecord();
+		record.pc = pc;
+		executed += 1;
+
+		PipelineEntry e(pc + 1, instruction.destination);
+		e.opcode = instruction.operation;
+		e.sourceValue1 = read(instruction.source1);
+		e.sourceValue2 = read(instruction.source2);
+		pc += 1;
+
+		if (groups::immediates.count(e.opcode) > 0) {
+			e.sourceValue2 = instruction.source2;
+			write(instruction.destination, getSimpleArithmetic(nullptr, e), record);
+		}
+		else if (groups::simpleArithmetic.count(e.opcode) > 0)
+			write(instruction.destination, getSimpleArithmetic(nullptr, e), record);
+		else if (groups::complexArithmetic.count(e.opcode) > 0)
+			write(instruction.destination, getComplexArithmetic(nullptr, e), record);
+		else if (groups::conditionalBranches.count(e.opcode) > 0) {
+			record.taken = checkIfBranchTaken(e);
+			if (record.taken)
+				pc = instruction.destination;
+		}
+		else if (e.opcode == Jlr) {
+			registers[1] = pc;
+			pc = instruction.destination;
+		}
+		else if (e.opcode == Rtl) {
+			pc = registers[1];
+			record.hasReturnTarget = true;
+			record.returnTarget = pc;
+		}
+		else if (e.opcode == Jmp)
+			pc = instruction.destination;
+		else if (e.opcode == Halt) {
+			halted = true;
+			pc -= 1;
+		}
+		else if (groups::loads.count(e.opcode) > 0) {
+			record.hasAddress = true;
+			record.address = checkAccess((long long)e.sourceValue1 + instruction.source2, 1, memory.size(), pc - 1);
+			write(instruction.destination, memory[record.address], record);
+		}
+		else if (groups::stores.count(e.opcode) > 0) {
+			record.hasAddress = true;
+			record.address = checkAccess((long long)instruction.destination + e.sourceValue1, 1, memory.size(), pc - 1);
+			memory[record.address] = e.sourceValue2;
+		}
+		else if (groups::atomics.count(e.opcode) > 0) {
+			record.hasAddress = true;
+			record.address = checkAccess(e.sourceValue1, 1, memory.size(), pc - 1);
+			word old = memory[record.address];
+			memory[record.address] = e.opcode == AmoAdd ? old + e.sourceValue2 : e.sourceValue2;
+			write(instruction.destination, old, record);
+		}
+		else if (isVector(e.opcode))
+			stepVector(instruction, e, record);
+	}
+
+	//Runs until the program sets the global pointer, streaming every instruction to the writer
+	void run(TraceWriter* writer) {
+		TraceRecord record;
+		while (!finished()) {
+			step(record);
+			if (writer != nullptr)
+				writer->write(record);
+		}
+	}
+
+	//Get memory value
+	int operator[](int index) {
+		return memory[index];
+	}
+	//Get register value
+	int operator()(int index) {
+		if (index == 0)return 0;
+		return registers[index];
+	}
+
+	//Vector registers hold vectorLength words
+	FunctionalCPU(assembler::CompileResult program, int vectorLength = GlobalData::vector.length) :
+		instructions(std::move(program.instructions)),
+		memory(std::move(program.memory)),
+		registers(32, 0),
+		vectorLength(vectorLength),
+		vectors(size_t(vectorRegisterCount) * vectorLength, 0),
+		pc(0)
+	{}
+
+private:
+	std::vector<Instruction> instructions;
+	MainMemory memory;
+	std::vector<word> registers;
+	int vectorLength;
+	std::vector<word> vectors;
+	int pc;
+	bool halted = false;
+
+	word read(word reg) {
+		if (reg <= 0 || reg >= 32)return 0;
+		return registers[reg];
+	}
+	void write(word reg, word value) {
+		if (reg < 0 || reg >= 32)return;
+		registers[reg] = value;
+	}
+	//Where rtl goes is predicted from ra, so a replay needs every value anything but jlr puts there
+	void write(word reg, word value, TraceRecord& record) {
+		write(reg, value);
+		if (reg == 1) {
+			record.hasReturnTarget = true;
+			record.returnTarget = value;
+		}
+	}
+
+	word* vector(word reg) {
+		return &vectors[size_t(reg) * vectorLength];
+	}
+
+	//Sources were read as scalar registers; the ones that are vector registers are read again here
+	void stepVector(Instruction& instruction, PipelineEntry& e, TraceRecord& record) {
+		if (e.opcode == VLen)
+			write(instruction.destination, vectorLength, record);
+		else if (e.opcode == VSum) {
+			word sum = 0;
+			for (int i = 0; i < vectorLength; i++)
+				sum += vector(instruction.source1)[i];
+			write(instruction.destination, sum, record);
+		}
+		else if (e.opcode == VSplat)
+			std::fill(vector(instruction.destination), vector(instruction.destination) + vectorLength, e.sourceValue1);
+		else if (e.opcode == VLda) {
+			record.hasAddress = true;
+			record.address = checkAccess((long long)e.sourceValue1 + instruction.source2, vectorLength, memory.size(), pc - 1);
+			for (int i = 0; i < vectorLength; i++)
+				vector(instruction.destination)[i] = memory[record.address + i];
+		}
+		else if (e.opcode == VSta) {
+			record.hasAddress = true;
+			record.address = checkAccess((long long)instruction.destination + e.sourceValue1, vectorLength, memory.size(), pc - 1);
+			for (int i = 0; i < vectorLength; i++)
+				memory[record.address + i] = vector(instruction.source2)[i];
+		}
+		else {
+			Opcode scalar = groups::vectorArithmetic.at(e.opcode);
+			//The destination may also be a source, which each word only reads before writing
+			for (int i = 0; i < vectorLength; i++)
+				vector(instruction.destination)[i] = getVectorLane(scalar, vector(instruction.source1)[i], vector(instruction.source2)[i]);
+		}
+	}
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//64 bit FNV-1a; only used to name things, never for security
+class Hasher {
+public:
+	Hasher& add(const void* data, size_t length) {
+		const uint8_t* bytes = (const uint8_t*)data;
+		for (size_t i = 0; i < length; i++) {
+			hash ^= bytes[i];
+			hash *= 0x100000001b3ull;
+		}
+		return *this;
+	}
+	Hasher& add(const std::string& s) {
+		add(s.data(), s.size());
+		//Terminate strings so "ab"+"c" and "a"+"bc" differ
+		return add(int32_t(s.size()));
+	}
+	template<class T>
+	Hasher& add(const std::vector<T>& values) {
+		add(int64_t(values.size()));
+		return add(values.data(), values.size() * sizeof(T));
+	}
+	Hasher& add(int32_t value) {
+		return add(&value, sizeof(value));
+	}
+	Hasher& add(int64_t value) {
+		return add(&value, sizeof(value));
+	}
+
+	uint64_t value() {
+		return hash;
+	}
+
+	std::string hex() {
+		char text[17];
+		snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+		return text;
+	}
+
+private:
+	uint64_t hash = 0xcbf29ce484222325ull;
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include "CPU.h"
+#include <cstdio>
+
+//Writes a CSV row every interval cycles of a run, so phases (a recursion, a loop reaching its steady state)
+//show up instead of being averaged into the totals. Counts are for the interval alone; occupancies are means
+//over its cycles and utilisation is the fraction of unit cycles spent busy. The last row may be shorter.
+//Everything is kept in fixed counters and written straight to the file, so sampling allocates nothing
+class IntervalRecorder {
+public:
+	IntervalRecorder(const std::string& filename, long long interval) :
+		interval(interval)
+	{
+		file = std::fopen(filename.c_str(), "w");
+		if (file != nullptr)
+			std::fprintf(file, "cycle,cycles,commits,ipc,flushes,branches,mispredictions,accuracy,robStalls,issueStalls,rob"
+				",alu_rs,calu_rs,bu_rs,lsu_rs,vu_rs,alu_util,calu_util,bu_util,lsu_util,vu_util\n");
+	}
+
+	~IntervalRecorder() {
+		if (file != nullptr)
+			std::fclose(file);
+	}
+
+	bool isOpen() {
+		return file != nullptr;
+	}
+
+	//Called after every cycle
+	void sample(CPU& cpu, long long cycle) {
+		CPU::Occupancy now = cpu.occupancy();
+		robSum += now.rob;
+		for (int i = 0; i < CPU::Occupancy::groups; i++)
+			stationSum[i] += now.stations[i];
+		if (cycle - lastCycle >= interval)
+			write(cpu, now, cycle);
+	}
+
+	//Writes whatever is left of the last interval
+	void finish(CPU& cpu, long long cycle) {
+		if (cycle > lastCycle)
+			write(cpu, cpu.occupancy(), cycle);
+	}
+
+private:
+	FILE* file;
+	long long interval;
+	long long lastCycle = 0;
+	//Totals as they were at the end of the last row
+	long long lastCommits = 0, lastFlushes = 0, lastBranches = 0, lastMispredictions = 0, lastRobStalls = 0, lastIssueStalls = 0;
+	long long robSum = 0;
+	long long stationSum[CPU::Occupancy::groups] = {};
+	long long lastBusyCycles[CPU::Occupancy::groups] = {};
+
+	void write(CPU& cpu, const CPU::Occupancy& now, long long cycle) {
+		long long cycles = cycle - lastCycle;
+		long long commits = cpu.commited - lastCommits;
+		long long branches = cpu.branches - lastBranches;
+		long long mispredictions = cpu.mispredictions - lastMispredictions;
+		std::fprintf(file, "%lld,%lld,%lld,%.4f,%lld,%lld,%lld,%.4f,%lld,%lld,%.3f", cycle, cycles, commits, double(commits) / cycles,
+			cpu.flushes - lastFlushes, branches, mispredictions, branches == 0 ? 1.0 : 1.0 - double(mispredictions) / branches,
+			cpu.robStalls - lastRobStalls, cpu.issueStalls - lastIssueStalls, double(robSum) / cycles);
+		for (int i = 0; i < CPU::Occupancy::groups; i++)
+			std::fprintf(file, ",%.3f", double(stationSum[i]) / cycles);
+		for (int i = 0; i < CPU::Occupancy::groups; i++)
+			std::fprintf(file, ",%.4f", now.units[i] == 0 ? 0.0 : double(now.busyCycles[i] - lastBusyCycles[i]) / (double(now.units[i]) * cycles));
+		std::fprintf(file, "\n");
+		//Rows are few, and flushing each one lets a long run be watched as it goes
+		std::fflush(file);
+
+		lastCycle = cycle;
+		lastCommits = cpu.commited;
+		lastFlushes = cpu.flushes;
+		lastBranches = cpu.branches;
+		lastMispredictions = cpu.mispredictions;
+		lastRobStalls = cpu.robStalls;
+		lastIssueStalls = cpu.issueStalls;
+		robSum = 0;
+		for (int i = 0; i < CPU::Occupancy::groups; i++) {
+			stationSum[i] = 0;
+			lastBusyCycles[i] = now.busyCycles[i];
+		}
+	}
+};
@@ -0,0 +1,400 @@
+#pragma once
+#include "RunRequest.h"
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <filesystem>
+
+//A long running simulator that many clients on the same machine can hand runs to over a UNIX domain socket.
+//A client sends one command per line:
+//run program [-config file] [-bp predictor] [-max-cycles n] ...	the same options as the command line
+//shutdown																stops the server once queued runs are done
+//Words are split at spaces, except inside double quotes, so run "my programs/a.txt" names one file.
+//and reads back one JSON line per run as each finishes, tagged with "job", the run's position among the
+//client's lines (starting at 0). Results can arrive in any order. The server closes the connection once the
+//client has closed its side and every one of its runs has been answered.
+//Runs are shared out over a fixed pool of workers. Programs and configs are only read again when their file, or
+//a file a program includes, changes, so a sweep over many predictors and configs assembles each program once per
+//memory size
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cstring>
+
+inline std::vector<std::string> splitCommand(const std::string& line) {
+	std::vector<std::string> splits;
+	std::string current = "";
+	bool quoted = false, started = false;
+	for (char c : line) {
+		if (c == '"') {
+			quoted = !quoted;
+			started = true;
+		}
+		else if (c == ' ' && !quoted) {
+			if (started)
+				splits.emplace_back(current);
+			current = "";
+			started = false;
+		}
+		else {
+			current += c;
+			started = true;
+		}
+	}
+	if (started)
+		splits.emplace_back(current);
+	return splits;
+}
+
+//Holds what was made from a file for as long as the file, and every other file dependencies says the value was
+//made from, stays the same size and age
+template<class Value>
+class FileCache {
+public:
+	template<class Make, class Dependencies>
+	std::shared_ptr<const Value> get(const std::string& filename, const std::string& variant, Make make, Dependencies dependencies) {
+		Stamp stamp;
+		bool stamped = stampOf(filename, stamp);
+		std::string key = filename + "\n" + variant;
+		{
+			std::lock_guard<std::mutex> lock(entriesLock);
+			auto found = entries.find(key);
+			if (found != entries.end() && stamped && current(found->second.stamps))
+				return found->second.value;
+		}
+		//Made outside the lock so workers aren't held up by one slow file; two racing makes give the same thing
+		auto value = std::make_shared<const Value>(make());
+		std::vector<Stamp> stamps = { stamp };
+		for (auto& dependency : dependencies(*value)) {
+			stamps.emplace_back();
+			stamped &= stampOf(dependency, stamps.back());
+		}
+		if (stamped) {
+			std::lock_guard<std::mutex> lock(entriesLock);
+			entries[key] = Entry{ std::move(stamps), value };
+		}
+		return value;
+	}
+	template<class Make>
+	std::shared_ptr<const Value> get(const std::string& filename, const std::string& variant, Make make) {
+		return get(filename, variant, make, [](const Value&) { return std::vector<std::string>(); });
+	}
+
+private:
+	struct Stamp {
+		std::string filename;
+		std::filesystem::file_time_type modified;
+		std::uintmax_t size = 0;
+
+		bool operator==(const Stamp&) const = default;
+	};
+	struct Entry {
+		std::vector<Stamp> stamps;
+		std::shared_ptr<const Value> value;
+	};
+	std::mutex entriesLock;
+	std::map<std::string, Entry> entries;
+
+	static bool stampOf(const std::string& filename, Stamp& stamp) {
+		std::error_code error;
+		stamp.filename = filename;
+		stamp.modified = std::filesystem::last_write_time(filename, error);
+		if (!error)
+			stamp.size = std::filesystem::file_size(filename, error);
+		return !error;
+	}
+
+	static bool current(const std::vector<Stamp>& stamps) {
+		for (auto& stamp : stamps) {
+			Stamp now;
+			if (!stampOf(stamp.filename, now) || !(now == stamp))
+				return false;
+		}
+		return true;
+	}
+};
+
+class JobServer {
+public:
+	JobServer(const std::string& socketPath, int workerCount) :
+		socketPath(socketPath),
+		workerCount(workerCount),
+		defaults(GlobalData::current())
+	{}
+
+	//Serves until a client asks it to shut down. False if the socket couldn't be set up
+	bool serve() {
+		//A client that hangs up early must not take the server with it
+		signal(SIGPIPE, SIG_IGN);
+		sockaddr_un address{};
+		if (socketPath.size() >= sizeof(address.sun_path)) {
+			printf("Socket path %s is too long\n", socketPath.c_str());
+			return false;
+		}
+		address.sun_family = AF_UNIX;
+		std::strcpy(address.sun_path, socketPath.c_str());
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		//A socket file left by a server that didn't shut down cleanly would stop bind
+		unlink(socketPath.c_str());
+		if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+			printf("Could not listen on %s: %s\n", socketPath.c_str(), std::strerror(errno));
+			if (listener >= 0)
+				close(listener);
+			return false;
+		}
+		std::cout << "Serving on " << socketPath << " with " << workerCount << " workers" << std::endl;
+
+		std::vector<std::thread> workers;
+		for (int i = 0; i < workerCount; i++)
+			workers.emplace_back([this]() { work(); });
+
+		std::vector<std::shared_ptr<Client>> reading;
+		while (!stopping) {
+			std::vector<pollfd> polled = { pollfd{ listener, POLLIN, 0 } };
+			for (auto& client : reading)
+				polled.push_back(pollfd{ client->fd, POLLIN, 0 });
+			if (poll(polled.data(), polled.size(), -1) < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			for (size_t i = reading.size(); i-- > 0;)
+				if (polled[i + 1].revents != 0 && !readFrom(reading[i]))
+					reading.erase(reading.begin() + i);
+			if (polled[0].revents & POLLIN) {
+				int fd = accept(listener, nullptr, nullptr);
+				if (fd >= 0)
+					reading.push_back(std::make_shared<Client>(fd));
+			}
+		}
+		close(listener);
+		unlink(socketPath.c_str());
+		//Whatever is already queued still gets run and answered
+		reading.clear();
+		{
+			std::lock_guard<std::mutex> lock(queueLock);
+			closing = true;
+		}
+		queueReady.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+		std::cout << "Server stopped" << std::endl;
+		return true;
+	}
+
+private:
+	//Closed once the server has stopped reading it and no queued run still has to answer it
+	struct Client {
+		int fd;
+		int nextJob = 0;
+		std::string unread = "";
+		std::mutex writeLock;
+
+		void send(const std::string& line) {
+			std::lock_guard<std::mutex> lock(writeLock);
+			std::string text = line + "\n";
+			size_t sent = 0;
+			while (sent < text.size()) {
+				ssize_t wrote = write(fd, text.data() + sent, text.size() - sent);
+				if (wrote <= 0)
+					return;
+				sent += wrote;
+			}
+		}
+
+		Client(int fd) :
+			fd(fd)
+		{}
+
+		~Client() {
+			close(fd);
+		}
+	};
+
+	struct Job {
+		std::shared_ptr<Client> client;
+		int id;
+		RunRequest request;
+	};
+
+	std::string socketPath;
+	int workerCount;
+	int listener = -1;
+	bool stopping = false;
+	//Used by runs that don't name a config
+	GlobalData::Settings defaults;
+
+	std::mutex queueLock;
+	std::condition_variable queueReady;
+	std::deque<Job> queue;
+	bool closing = false;
+
+	FileCache<assembler::CompileResult> programs;
+	FileCache<GlobalData::Settings> configs;
+
+	//False once the client has nothing more to send
+	bool readFrom(const std::shared_ptr<Client>& client) {
+		char buffer[4096];
+		ssize_t got = read(client->fd, buffer, sizeof(buffer));
+		if (got <= 0)
+			return false;
+		client->unread.append(buffer, got);
+		size_t end;
+		while ((end = client->unread.find('\n')) != std::string::npos) {
+			std::string line = client->unread.substr(0, end);
+			client->unread.erase(0, end + 1);
+			if (line.size() > 0 && line.back() == '\r')
+				line.pop_back();
+			if (line.size() > 0)
+				handle(client, line);
+		}
+		return true;
+	}
+
+	//Each queued run holds on to its client, so the connection outlives the server's reading of it
+	void handle(const std::shared_ptr<Client>& client, const std::string& line) {
+		auto splits = splitCommand(line);
+		if (splits.size() == 0)
+			return;
+		if (splits[0] == "shutdown") {
+			stopping = true;
+			return;
+		}
+		int id = client->nextJob++;
+		std::string tag = "\"job\": " + std::to_string(id) + ", ";
+		RunRequest request;
+		std::string problem = splits[0] == "run" ? parseRunArguments(splits, request) : "Unknown command " + splits[0];
+		if (problem != "") {
+			client->send("{" + tag + "\"status\": \"error\", \"error\": \"" + jsonEscape(problem) + "\"}");
+			return;
+		}
+		//Printing from a worker would interleave with every other run
+		request.debugPrint = false;
+		{
+			std::lock_guard<std::mutex> lock(queueLock);
+			queue.push_back(Job{ client, id, request });
+		}
+		queueReady.notify_one();
+	}
+
+	void work() {
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(queueLock);
+				queueReady.wait(lock, [this]() { return closing || queue.size() > 0; });
+				if (queue.size() == 0)
+					return;
+				job = std::move(queue.front());
+				queue.pop_front();
+			}
+			RunResult result = run(job.request);
+			job.client->send(runJson(job.request, result, "\"job\": " + std::to_string(job.id) + ", "));
+		}
+	}
+
+	RunResult run(const RunRequest& request) {
+		RunResult result;
+		try {
+			std::shared_ptr<const GlobalData::Settings> settings = std::make_shared<const GlobalData::Settings>(defaults);
+			if (request.configFile != "") {
+				settings = configs.get(request.configFile, "", [&]() {
+					GlobalData::Settings loaded = defaults;
+					if (!GlobalData::loadInto(request.configFile, loaded))
+						throw assembler::ProgramError("Could not open config " + request.configFile);
+					return loaded;
+				});
+			}
+			auto program = programs.get(request.filename, std::to_string(settings->memorySize), [&]() {
+				return assembler::load(request.filename, settings->memorySize);
+			}, [](const assembler::CompileResult& loaded) { return loaded.sources; });
+			return executeRun(request, *program, *settings);
+		}
+		catch (std::exception& e) {
+			result.error = e.what();
+		}
+		//Whatever a job throws, the server has to stay up for the others
+		catch (...) {
+			result.error = "The simulator stopped on an internal error";
+		}
+		return result;
+	}
+};
+
+//Sends each line to a server and prints every answer as it comes, until the server has answered them all.
+//False if it hangs up before that
+inline bool submitJobs(const std::string& socketPath, const std::vector<std::string>& lines) {
+	sockaddr_un address{};
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		printf("Socket path %s is too long\n", socketPath.c_str());
+		return false;
+	}
+	address.sun_family = AF_UNIX;
+	std::strcpy(address.sun_path, socketPath.c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+		printf("Could not connect to %s: %s\n", socketPath.c_str(), std::strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	std::string text = "";
+	for (auto& line : lines)
+		text += line + "\n";
+	size_t sent = 0;
+	while (sent < text.size()) {
+		ssize_t wrote = write(fd, text.data() + sent, text.size() - sent);
+		if (wrote <= 0)
+			break;
+		sent += wrote;
+	}
+	shutdown(fd, SHUT_WR);
+	int expected = 0;
+	for (auto& line : lines) {
+		auto splits = splitCommand(line);
+		if (splits.size() > 0 && splits[0] != "shutdown")
+			expected += 1;
+	}
+	int answers = 0;
+	char buffer[4096];
+	ssize_t got;
+	while ((got = read(fd, buffer, sizeof(buffer))) > 0) {
+		fwrite(buffer, 1, got, stdout);
+		answers += int(std::count(buffer, buffer + got, '\n'));
+	}
+	fflush(stdout);
+	close(fd);
+	if (sent != text.size()) {
+		printf("Could not send every job to %s\n", socketPath.c_str());
+		return false;
+	}
+	if (answers < expected) {
+		printf("The server hung up after answering %d of %d jobs\n", answers, expected);
+		return false;
+	}
+	return true;
+}
+
+#else
+
+class JobServer {
+public:
+	JobServer(const std::string& socketPath, int workerCount) {}
+
+	bool serve() {
+		printf("The job server needs UNIX domain sockets, which this build doesn't have\n");
+		return false;
+	}
+};
+
+inline bool submitJobs(const std::string& socketPath, const std::vector<std::string>& lines) {
+	printf("The job server needs UNIX domain sockets, which this build doesn't have\n");
+	return false;
+}
+
+#endif
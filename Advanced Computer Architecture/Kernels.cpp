@@ -0,0 +1,313 @@
+#include "Simulation.h"
+#include "Functional.h"
+#include "Expectations.h"
+#include "SMT.h"
+#include "Multicore.h"
+#include "Batch.h"
+
+//Runs self checking kernels (see Expectations.h) on the functional model, then on the pipeline under the
+//default hardware and powerConfig.txt, the latter also with store sets, then once with stations that pick the
+//critical path first, then with a decoupled front end and a small register file, then fused pairs, then predicted
+//load values and then short vectors, with several predictors. The default hardware and the last setup also run the
+//kernel as two SMT threads, a kernel written for several cores on that many sharing memory, and copies of the
+//kernel in lockstep batches. Last, each of those features runs alone on the default hardware made three wide, so
+//a failure there points at one of them. Fails if any run leaves the wrong memory or can't go on.
+//With --functional the programs needn't check themselves, as generated workloads don't: each single thread run
+//must instead end with every register and data word as the functional model leaves them
+
+const std::vector<std::string> predictorNames = { "Always", "Never", "2bit" };
+//Far beyond what any kernel needs, so a model bug that loops forever fails instead of hanging
+const long long cycleLimit = 10000000;
+bool againstFunctional = false;
+
+bool checkRun(const std::string& what, const std::vector<Expectation>& expectations, const std::unordered_map<std::string, int>& labels, auto& machine) {
+	auto mismatches = checkExpectations(expectations, labels, machine);
+	for (auto& mismatch : mismatches)
+		printf("MISMATCH %s: %s\n", what.c_str(), mismatch.c_str());
+	return mismatches.size() == 0;
+}
+
+bool checkState(const std::string& what, const assembler::CompileResult& program, FunctionalCPU& functional, CPU& cpu) {
+	bool matched = true;
+	for (int r = 1; r < 32; r++)
+		if (cpu(r) != functional(r)) {
+			printf("MISMATCH %s: r%d is %d, the functional model's %d\n", what.c_str(), r, cpu(r), functional(r));
+			matched = false;
+		}
+	for (int i = 0; i < program.dataLength; i++)
+		if (cpu[i] != functional[i]) {
+			printf("MISMATCH %s: word %d is %d, the functional model's %d\n", what.c_str(), i, cpu[i], functional[i]);
+			matched = false;
+		}
+	return matched;
+}
+
+bool checkKernel(const std::string& config, const std::string& filename) {
+	auto expectations = readExpectations(filename);
+	if (expectations.size() == 0 && !againstFunctional) {
+		printf("%s has no #expect lines\n", filename.c_str());
+		return false;
+	}
+	auto program = assembler::load(filename, GlobalData::memorySize);
+	bool passed = true;
+
+	FunctionalCPU functional(program);
+	functional.run(nullptr);
+	passed &= checkRun(filename + " functionally", expectations, program.labels, functional);
+
+	for (auto& predictorName : predictorNames) {
+		BranchPredictor* bp = makeBranchPredictor(predictorName);
+		CPU cpu(GlobalData::width, program, bp);
+		long long cycles = 0;
+		while (!cpu.finished() && cycles < cycleLimit) {
+			cpu.update();
+			cycles += 1;
+		}
+		delete bp;
+		std::string what = filename + " under " + config + " with " + predictorName;
+		if (!cpu.finished()) {
+			printf("FAIL %s: still running after %lld cycles\n", what.c_str(), cycles);
+			passed = false;
+			continue;
+		}
+		bool matched = againstFunctional ? checkState(what, program, functional, cpu) : checkRun(what, expectations, program.labels, cpu);
+		printf("%s %s: %lld cycles\n", matched ? "ok  " : "FAIL", what.c_str(), cycles);
+		passed &= matched;
+	}
+	return passed;
+}
+
+//Two copies of the kernel as the threads of one SMT core, each with its own memory, under each fetch policy
+bool checkSMT(const std::string& config, const std::string& filename) {
+	if (againstFunctional)
+		return true;
+	auto expectations = readExpectations(filename);
+	auto program = assembler::load(filename, GlobalData::memorySize);
+	bool passed = true;
+	for (auto& policy : fetchPolicyNames) {
+		std::unique_ptr<BranchPredictor> first(makeBranchPredictor("2bit")), second(makeBranchPredictor("2bit"));
+		SMTCore core({ program, program }, { first.get(), second.get() }, policy.second);
+		while (!core.finished() && core.cycles < cycleLimit)
+			core.update();
+		std::string what = filename + " twice under " + config + " with SMT fetching by " + policy.first;
+		if (!core.finished()) {
+			printf("FAIL %s: still running after %lld cycles\n", what.c_str(), core.cycles);
+			passed = false;
+			continue;
+		}
+		bool matched = true;
+		for (int t = 0; t < core.threadCount(); t++)
+			matched &= checkRun(what + ", thread " + std::to_string(t), expectations, program.labels, core.thread(t));
+		printf("%s %s: %lld cycles\n", matched ? "ok  " : "FAIL", what.c_str(), core.cycles);
+		passed &= matched;
+	}
+	return passed;
+}
+
+//The kernel on as many cores as its #cores line says, sharing memory, on one host thread and then one per core,
+//which must model exactly the same run; then with quanta five times as long, which only has to get it right
+bool checkMulticore(const std::string& config, const std::string& filename) {
+	int cores = readCoreCount(filename);
+	if (cores == 1 || againstFunctional)
+		return true;
+	auto expectations = readExpectations(filename);
+	auto program = assembler::load(filename, GlobalData::memorySize);
+	bool passed = true;
+	std::vector<long long> firstCycles;
+	struct Setup {
+		int hostThreads;
+		int quantum;
+	};
+	for (Setup setup : { Setup{ 1, 0 }, Setup{ cores, 0 }, Setup{ cores, 5 * GlobalData::dataCache.missCycles } }) {
+		std::vector<std::unique_ptr<BranchPredictor>> predictors;
+		std::vector<BranchPredictor*> corePredictors;
+		for (int c = 0; c < cores; c++)
+			corePredictors.push_back(predictors.emplace_back(makeBranchPredictor("2bit")).get());
+		Multicore system(program, corePredictors, setup.hostThreads, setup.quantum);
+		system.run(cycleLimit);
+		std::string what = filename + " on " + std::to_string(cores) + " cores under " + config + " with " + std::to_string(setup.hostThreads)
+			+ " host threads and " + std::to_string(system.quantumLength()) + " cycle quanta";
+		if (!system.finished()) {
+			printf("FAIL %s: still running after %lld cycles\n", what.c_str(), system.cycles);
+			passed = false;
+			continue;
+		}
+		bool matched = checkRun(what, expectations, program.labels, system.core(0));
+		if (setup.quantum == 0) {
+			if (firstCycles.size() == 0)
+				firstCycles = system.finishedAt;
+			else if (system.finishedAt != firstCycles) {
+				printf("MISMATCH %s: cores finished at different cycles than on one host thread\n", what.c_str());
+				matched = false;
+			}
+		}
+		printf("%s %s: %lld cycles\n", matched ? "ok  " : "FAIL", what.c_str(), system.finishCycle());
+		passed &= matched;
+	}
+	return passed;
+}
+
+//A batch lane seen as a machine whose memory can be checked
+struct BatchLane {
+	BatchFunctionalCPU& batch;
+	int lane;
+
+	word operator[](int index) {
+		return batch.memoryWord(lane, size_t(index));
+	}
+};
+
+//Ten copies of the kernel in batches of eight lanes, so the second batch starts over on the first's memory with
+//lanes left empty. Every copy must also execute as many instructions as the functional model does
+bool checkBatch(const std::string& config, const std::string& filename) {
+	if (againstFunctional)
+		return true;
+	auto expectations = readExpectations(filename);
+	auto program = assembler::load(filename, GlobalData::memorySize);
+	FunctionalCPU functional(program);
+	functional.run(nullptr);
+	const int instances = 10, lanes = 8;
+	BatchFunctionalCPU batch(program, lanes);
+	bool passed = true;
+	long long steps = 0;
+	for (int first = 0; first < instances; first += lanes) {
+		batch.start(std::min(lanes, instances - first), first);
+		batch.run(cycleLimit);
+		steps += batch.steps;
+		for (int lane = 0; lane < batch.laneCount(); lane++) {
+			std::string what = filename + " as instance " + std::to_string(first + lane) + " of a batch under " + config;
+			if (!batch.finished(lane)) {
+				printf("FAIL %s: still running after %lld instructions\n", what.c_str(), batch.executed(lane));
+				passed = false;
+				continue;
+			}
+			BatchLane view{ batch, lane };
+			passed &= checkRun(what, expectations, program.labels, view);
+			if (batch.executed(lane) != functional.executed) {
+				printf("MISMATCH %s: %lld instructions, the functional model %lld\n", what.c_str(), batch.executed(lane), functional.executed);
+				passed = false;
+			}
+		}
+	}
+	printf("%s %s %d times in batches of %d under %s: %lld steps\n", passed ? "ok  " : "FAIL", filename.c_str(), instances, lanes, config.c_str(), steps);
+	return passed;
+}
+
+int main(int argc, char** argv) {
+	int first = 1;
+	if (argc > 1 && std::string(argv[1]) == "--functional") {
+		againstFunctional = true;
+		first = 2;
+	}
+	if (argc <= first) {
+		printf("Usage: sim_kernels [--functional] kernel.txt [kernel.txt ...]\n");
+		return 2;
+	}
+	bool passed = true;
+	const GlobalData::Settings defaults = GlobalData::current();
+	try {
+		for (int i = first; i < argc; i++)
+			passed &= checkKernel("default", argv[i]);
+		for (int i = first; i < argc; i++)
+			passed &= checkSMT("default", argv[i]);
+		for (int i = first; i < argc; i++)
+			passed &= checkMulticore("default", argv[i]);
+		for (int i = first; i < argc; i++)
+			passed &= checkBatch("default", argv[i]);
+		GlobalData::loadFrom("powerConfig.txt");
+		for (int i = first; i < argc; i++)
+			passed &= checkKernel("powerConfig.txt", argv[i]);
+		//Loads running ahead of stores have to be caught and run again whenever they read too early
+		GlobalData::storeSetSize = 64;
+		for (int i = first; i < argc; i++)
+			passed &= checkKernel("powerConfig.txt with store sets", argv[i]);
+		//Picking by what waits on an instruction rather than by age must still only pick ready instructions, with
+		//both policies and on every kind of station. With one unit a group the pick decides what runs first
+		for (auto* data : { &GlobalData::simpleInteger, &GlobalData::complexInteger, &GlobalData::branchUnits, &GlobalData::loadStoreUnits, &GlobalData::vectorUnits })
+			data->numberOfUnits = 1;
+		GlobalData::simpleInteger.policy = SelectPolicy::Critical;
+		GlobalData::complexInteger.policy = SelectPolicy::BranchLoad;
+		GlobalData::branchUnits.policy = SelectPolicy::Critical;
+		GlobalData::loadStoreUnits.policy = SelectPolicy::BranchLoad;
+		GlobalData::vectorUnits.policy = SelectPolicy::Critical;
+		for (int i = first; i < argc; i++)
+			passed &= checkKernel("powerConfig.txt with store sets and one critical or branchload unit a group", argv[i]);
+		//Back to powerConfig.txt's units, which leaves the vector unit alone, picking the oldest; store sets stay
+		GlobalData::loadFrom("powerConfig.txt");
+		GlobalData::vectorUnits.policy = SelectPolicy::Oldest;
+		//Branches predicted ahead of fetch, a return stack, I-cache misses and running out of physical registers
+		//must not change any result
+		GlobalData::physicalRegisters = 40;
+		GlobalData::frontEnd.fetchBlock = 4;
+		GlobalData::frontEnd.takenBubble = 1;
+		GlobalData::frontEnd.targetQueue = 4;
+		GlobalData::frontEnd.icacheSets = 4;
+		for (int i = first; i < argc; i++)
+			passed &= checkKernel("powerConfig.txt with store sets, a decoupled front end and 40 physical registers", argv[i]);
+		//A fused pair's second half takes its sources from the first half's
+		GlobalData::fusedPairs = { {IAdd, IAdd}, {IAdd, Bne}, {IAdd, Lda}, {Sta, IAdd}, {IAdd, Sta} };
+		for (int i = first; i < argc; i++)
+			passed &= checkKernel("powerConfig.txt with all of that and fused pairs", argv[i]);
+		//Predicting at the lowest confidence, so plenty of loads read something other than their prediction
+		GlobalData::loadValueSize = 64;
+		GlobalData::loadValueConfidence = 1;
+		for (int i = first; i < argc; i++)
+			passed &= checkKernel("powerConfig.txt with all of that and predicted load values", argv[i]);
+		//Vector loops must work for any vector length, here one that leaves words over and takes two cycles a vector
+		GlobalData::vector = VectorData{ 3, 2 };
+		for (int i = first; i < argc; i++)
+			passed &= checkKernel("powerConfig.txt with all of that and 3 word vectors", argv[i]);
+		for (int i = first; i < argc; i++)
+			passed &= checkBatch("3 word vectors", argv[i]);
+		//Threads share the reservation stations and units, so tags and flushes must stay within a thread
+		for (int i = first; i < argc; i++)
+			passed &= checkSMT("powerConfig.txt with all of that", argv[i]);
+		//Cores only see each other's writes through their caches, so loads that read early must be caught
+		for (int i = first; i < argc; i++)
+			passed &= checkMulticore("powerConfig.txt with all of that", argv[i]);
+
+		std::vector<std::pair<std::string, void(*)()>> features = {
+			{ "store sets", []() { GlobalData::storeSetSize = 64; } },
+			{ "one critical or branchload unit a group", []() {
+				for (auto* data : { &GlobalData::simpleInteger, &GlobalData::complexInteger, &GlobalData::branchUnits, &GlobalData::loadStoreUnits, &GlobalData::vectorUnits })
+					data->numberOfUnits = 1;
+				GlobalData::simpleInteger.policy = SelectPolicy::Critical;
+				GlobalData::complexInteger.policy = SelectPolicy::BranchLoad;
+				GlobalData::branchUnits.policy = SelectPolicy::Critical;
+				GlobalData::loadStoreUnits.policy = SelectPolicy::BranchLoad;
+				GlobalData::vectorUnits.policy = SelectPolicy::Critical;
+			} },
+			{ "a decoupled front end", []() {
+				GlobalData::frontEnd.fetchBlock = 4;
+				GlobalData::frontEnd.takenBubble = 1;
+				GlobalData::frontEnd.targetQueue = 4;
+				GlobalData::frontEnd.icacheSets = 4;
+			} },
+			{ "40 physical registers", []() { GlobalData::physicalRegisters = 40; } },
+			{ "fused pairs", []() { GlobalData::fusedPairs = { {IAdd, IAdd}, {IAdd, Bne}, {IAdd, Lda}, {Sta, IAdd}, {IAdd, Sta} }; } },
+			{ "predicted load values", []() {
+				GlobalData::loadValueSize = 64;
+				GlobalData::loadValueConfidence = 1;
+			} },
+			{ "3 word vectors", []() { GlobalData::vector = VectorData{ 3, 2 }; } },
+		};
+		//One wide, decode rarely holds a pair to fuse and loads rarely get ahead of stores or run out of registers
+		for (auto& feature : features) {
+			GlobalData::apply(defaults);
+			GlobalData::width = 3;
+			feature.second();
+			for (int i = first; i < argc; i++)
+				passed &= checkKernel("the default three wide with only " + feature.first, argv[i]);
+		}
+	}
+	catch (assembler::ProgramError& e) {
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+	//A run that can't go on, such as one that leaves its program, fails the kernel rather than ending the checks
+	catch (std::exception& e) {
+		printf("FAIL %s\n", e.what());
+		return 1;
+	}
+	return passed ? 0 : 1;
+}
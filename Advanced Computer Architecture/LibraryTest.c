@@ -0,0 +1,109 @@
+#include "acasim.h"
+#include <stdio.h>
+#include <string.h>
+
+//Drives the library through its C interface only, the way a binding from another language would
+
+static int failures = 0;
+
+static void expect(int condition, const char* what) {
+	if (!condition) {
+		printf("FAIL %s\n", what);
+		failures += 1;
+	}
+}
+
+static long long runToEnd(acasim_simulator* simulator) {
+	acasim_counters counters;
+	long long total = 0;
+	do {
+		long long run = acasim_step(simulator, 1000);
+		if (run < 0)
+			return -1;
+		total += run;
+		acasim_counters_get(simulator, &counters);
+	} while (!counters.finished);
+	return total;
+}
+
+static void writeWords(const char* filename, int32_t value) {
+	FILE* file = fopen(filename, "wb");
+	for (int i = 0; i < 2048; i++)
+		fwrite(&value, sizeof(value), 1, file);
+	fclose(file);
+}
+
+//Pages of an .incbin file are mapped rather than read, yet a reset must start again on the words as they were
+//loaded: from the same file even once another has taken its name, and not at all once it has been written to
+static void checkIncbin(const char* directory) {
+	char blob[1024], replacement[1024], program[1024];
+	snprintf(blob, sizeof(blob), "%s/blob.bin", directory);
+	snprintf(replacement, sizeof(replacement), "%s/replacement.bin", directory);
+	snprintf(program, sizeof(program), "%s/blob.txt", directory);
+	writeWords(blob, 1);
+	FILE* file = fopen(program, "w");
+	fprintf(file, ".incbin blob %s\nlda a0 zero blob\naddi globalPointer zero 1\n.label forever\njmp forever\n", blob);
+	fclose(file);
+
+	acasim_simulator* simulator = acasim_create(NULL);
+	int32_t value = 0;
+	expect(acasim_load_program(simulator, program) == 0, "load a program with an .incbin file");
+	expect(runToEnd(simulator) > 0, "run the .incbin program");
+	writeWords(replacement, 2);
+	rename(replacement, blob);
+	expect(acasim_reset(simulator) == 0 && runToEnd(simulator) > 0, "reset once the file has been replaced");
+	acasim_read_register(simulator, 10, &value);
+	expect(value == 1, "a reset reads the file that was loaded");
+
+	expect(acasim_load_program(simulator, program) == 0 && runToEnd(simulator) > 0, "load the replaced file");
+	file = fopen(blob, "r+b");
+	fwrite(&value, sizeof(value), 1, file);
+	fclose(file);
+	expect(acasim_reset(simulator) == -1, "no reset once the loaded file has been written to");
+	expect(strstr(acasim_last_error(simulator), "has changed") != NULL, "the refusal says the file changed");
+	acasim_destroy(simulator);
+}
+
+int main(int argc, char** argv) {
+	acasim_simulator* simulator = acasim_create(NULL);
+	expect(simulator != NULL, "create with the default hardware");
+	expect(acasim_load_program(simulator, "Ackermann.txt") == 0, "load Ackermann.txt");
+	long long first = runToEnd(simulator);
+	int32_t result = 0;
+	acasim_read_register(simulator, 10, &result);
+	expect(result == 11, "Ackermann(2, 4) is 11");
+
+	//A reset run has to model exactly what a fresh CPU does
+	expect(acasim_reset(simulator) == 0, "reset");
+	expect(runToEnd(simulator) == first, "the same cycles after a reset");
+	expect(acasim_set_predictor(simulator, "no such predictor") == -1, "unknown predictors are refused");
+	expect(acasim_last_error(simulator)[0] != '\0', "a refusal says why");
+	expect(acasim_set_predictor(simulator, "2bit") == 0 && acasim_reset(simulator) == 0, "switch predictor");
+	expect(runToEnd(simulator) > 0, "run with another predictor");
+	acasim_destroy(simulator);
+
+	simulator = acasim_create("powerConfig.txt");
+	expect(simulator != NULL, "create from powerConfig.txt");
+	expect(acasim_load_program(simulator, "kernels/crc.txt") == 0, "load the crc kernel");
+	for (int run = 0; run < 3; run++) {
+		expect(runToEnd(simulator) > 0, "run the crc kernel");
+		int32_t crc = 0;
+		expect(acasim_read_memory(simulator, acasim_label_address(simulator, "result"), &crc) == 0, "read the result");
+		expect(crc == (int32_t)0xCBF43926u, "crc of 123456789");
+		acasim_reset(simulator);
+	}
+	expect(acasim_read_memory(simulator, -1, &result) == -1, "reads outside memory are refused");
+	expect(acasim_load_program(simulator, "no such file.txt") == -1, "missing programs are refused");
+	expect(acasim_step(simulator, 10) == -1, "stepping needs a program");
+	acasim_destroy(simulator);
+
+	expect(acasim_create("no such config.txt") == NULL, "missing configs are refused");
+
+	//Files it writes go in the directory it is given, if any
+	if (argc > 1)
+		checkIncbin(argv[1]);
+
+	if (failures == 0)
+		printf("All library checks passed\n");
+	return failures == 0 ? 0 : 1;
+}
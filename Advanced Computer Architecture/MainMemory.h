@@ -0,0 +1,263 @@
+#pragma once
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <bit>
+#include <utility>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include "MappedFile.h"
+
+using word = int32_t;
+
+//The simulated memory. It sits in its own anonymous mapping, so words that are never touched cost nothing,
+//and whole pages of a data file can be mapped straight in copy on write instead of being read
+class MainMemory {
+public:
+	word& operator[](size_t index) {
+		return words[index];
+	}
+	size_t size() const {
+		return length;
+	}
+	word* data() {
+		return words;
+	}
+	const word* data() const {
+		return words;
+	}
+
+	//Fills count words starting at index with little endian words from the file, starting offset words in.
+	//Pages are mapped when both sides line up with the host page size; the rest is copied
+	bool loadFile(size_t index, const std::string& filename, size_t offset, size_t count) {
+		if (index + count > length)
+			return false;
+		MappedFile file(filename);
+		if (!file.isOpen() || (offset + count) * sizeof(word) > file.size())
+			return false;
+
+		size_t bytes = count * sizeof(word);
+		size_t mapped = 0;
+#ifndef _WIN32
+		size_t page = size_t(sysconf(_SC_PAGESIZE));
+		FileMapping mapping{ index * sizeof(word), nullptr, offset * sizeof(word), bytes / page * page };
+		if (std::endian::native == std::endian::little && mapping.memoryByte % page == 0 && mapping.fileByte % page == 0 && mapping.bytes > 0
+			&& (mapping.source = MappedSource::hold(file.descriptor(), filename)) != nullptr && map(mapping)) {
+			mapped = mapping.bytes;
+			mappings.push_back(mapping);
+			std::sort(mappings.begin(), mappings.end(), [](const FileMapping& a, const FileMapping& b) { return a.memoryByte < b.memoryByte; });
+		}
+#endif
+		mappedBytes += mapped;
+		memcpy((char*)(words + index) + mapped, file.data() + offset * sizeof(word) + mapped, bytes - mapped);
+		if constexpr (std::endian::native != std::endian::little) {
+			for (size_t i = index; i < index + count; i++) {
+				uint32_t w = uint32_t(words[i]);
+				words[i] = word((w >> 24) | ((w >> 8) & 0xff00) | ((w << 8) & 0xff0000) | (w << 24));
+			}
+		}
+		return true;
+	}
+
+	//Takes other's contents, reusing this allocation when the sizes match
+	void copyFrom(const MainMemory& other) {
+		if (other.length != length) {
+			*this = other;
+			return;
+		}
+		copyWords(other, false);
+	}
+
+	//Placing file data on a multiple of this many words lets loadFile map it rather than copy it
+	static size_t mappingAlignment() {
+#ifdef _WIN32
+		return 1;
+#else
+		return size_t(sysconf(_SC_PAGESIZE)) / sizeof(word);
+#endif
+	}
+
+	//How much of memory is currently shared with files rather than copied
+	size_t bytesMappedFromFiles() const {
+		return mappedBytes;
+	}
+
+	MainMemory(size_t length = 0):
+		length(length)
+	{
+		words = allocate(length);
+	}
+
+	//A copy maps the pages other mapped from files again, from the files other was loaded from even if their names
+	//now lead elsewhere, and copies whichever of those pages other has written. Throws std::runtime_error if one
+	//of the files has been written to since, as other can no longer be read back as it was loaded
+	MainMemory(const MainMemory& other):
+		MainMemory(other.length)
+	{
+		copyWords(other, true);
+	}
+
+	MainMemory(MainMemory&& other) noexcept {
+		swap(other);
+	}
+
+	MainMemory& operator=(MainMemory other) noexcept {
+		swap(other);
+		return *this;
+	}
+
+	~MainMemory() {
+		release(words, length);
+	}
+
+private:
+	//A file pages were mapped from, held open for as long as any memory maps it, and its size and age when it was
+	struct MappedSource {
+		int fd = -1;
+		std::string filename;
+		long long size = 0;
+		long long modified = 0;
+
+		//Null if the file can't be held open
+		static std::shared_ptr<const MappedSource> hold(int fd, const std::string& filename) {
+#ifdef _WIN32
+			return nullptr;
+#else
+			auto source = std::make_shared<MappedSource>();
+			source->fd = dup(fd);
+			source->filename = filename;
+			if (source->fd < 0 || !source->stamp(source->size, source->modified))
+				return nullptr;
+			return source;
+#endif
+		}
+
+		bool unchanged() const {
+			long long nowSize, nowModified;
+			return stamp(nowSize, nowModified) && nowSize == size && nowModified == modified;
+		}
+
+		~MappedSource() {
+#ifndef _WIN32
+			if (fd >= 0)
+				close(fd);
+#endif
+		}
+
+	private:
+		bool stamp(long long& bytes, long long& nanoseconds) const {
+#ifdef _WIN32
+			return false;
+#else
+			struct stat info;
+			if (fstat(fd, &info) != 0)
+				return false;
+			bytes = (long long)info.st_size;
+			nanoseconds = (long long)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+			return true;
+#endif
+		}
+	};
+
+	//Whole pages of a file mapped over memory
+	struct FileMapping {
+		size_t memoryByte;
+		std::shared_ptr<const MappedSource> source;
+		size_t fileByte;
+		size_t bytes;
+	};
+
+	word* words = nullptr;
+	size_t length = 0;
+	size_t mappedBytes = 0;
+	std::vector<FileMapping> mappings;
+
+	void swap(MainMemory& other) noexcept {
+		std::swap(words, other.words);
+		std::swap(length, other.length);
+		std::swap(mappedBytes, other.mappedBytes);
+		std::swap(mappings, other.mappings);
+	}
+
+	//Maps the file's pages over this memory copy on write
+	bool map(const FileMapping& mapping) {
+#ifdef _WIN32
+		return false;
+#else
+		void* view = mmap((char*)words + mapping.memoryByte, mapping.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, mapping.source->fd, off_t(mapping.fileByte));
+		return view != MAP_FAILED;
+#endif
+	}
+
+	//Takes other's words, which are the same length: its file mappings are made again, pages of them other has
+	//written are copied over the top, and what a mapping can't be made for is copied. When fresh is true every
+	//word here is still zero, so pages that are zero in other too are skipped rather than written, and memory
+	//never touched stays free
+	void copyWords(const MainMemory& other, bool fresh) {
+		for (auto& mapping : other.mappings)
+			if (!mapping.source->unchanged())
+				throw std::runtime_error(mapping.source->filename + " has changed since a program was loaded from it");
+		mappings.clear();
+		mappedBytes = 0;
+		if (length == 0)
+			return;
+		size_t page = 4096;
+#ifndef _WIN32
+		page = size_t(sysconf(_SC_PAGESIZE));
+#endif
+		size_t bytes = length * sizeof(word);
+		size_t done = 0;
+		auto copyUpTo = [&](size_t end) {
+			for (size_t start = done; start < end; start += page) {
+				size_t chunk = std::min(page, end - start);
+				const char* from = (const char*)other.words + start;
+				if (fresh && from[0] == 0 && memcmp(from, from + 1, chunk - 1) == 0)
+					continue;
+				memcpy((char*)words + start, from, chunk);
+			}
+			done = end;
+		};
+		for (auto& mapping : other.mappings) {
+			copyUpTo(mapping.memoryByte);
+			if (map(mapping)) {
+				mappings.push_back(mapping);
+				for (size_t start = done; start < done + mapping.bytes; start += page) {
+					if (memcmp((char*)words + start, (const char*)other.words + start, page) != 0)
+						memcpy((char*)words + start, (const char*)other.words + start, page);
+					else mappedBytes += page;
+				}
+			}
+			else memcpy((char*)words + done, (const char*)other.words + done, mapping.bytes);
+			done += mapping.bytes;
+		}
+		copyUpTo(bytes);
+	}
+
+	static word* allocate(size_t length) {
+		if (length == 0)
+			return nullptr;
+#ifdef _WIN32
+		void* region = VirtualAlloc(nullptr, length * sizeof(word), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (region == nullptr)
+			throw std::bad_alloc();
+#else
+		void* region = mmap(nullptr, length * sizeof(word), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED)
+			throw std::bad_alloc();
+#endif
+		return (word*)region;
+	}
+
+	static void release(word* words, size_t length) {
+		if (words == nullptr)
+			return;
+#ifdef _WIN32
+		VirtualFree(words, 0, MEM_RELEASE);
+#else
+		munmap(words, length * sizeof(word));
+#endif
+	}
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//Read only view of a whole file. The mapping lives as long as the object does
+class MappedFile {
+public:
+	bool isOpen() {
+		return opened;
+	}
+	const char* data() {
+		return bytes;
+	}
+	size_t size() {
+		return length;
+	}
+#ifndef _WIN32
+	int descriptor() {
+		return fd;
+	}
+#endif
+
+	MappedFile(const std::string& filename) {
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		length = size_t(fileSize.QuadPart);
+		opened = true;
+		if (length == 0)
+			return;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {
+			opened = false;
+			return;
+		}
+		bytes = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		opened = bytes != nullptr;
+#else
+		fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat info;
+		fstat(fd, &info);
+		length = size_t(info.st_size);
+		opened = true;
+		if (length == 0)
+			return;
+		void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED) {
+			opened = false;
+			return;
+		}
+		//Everything we map is read front to back
+		madvise(view, length, MADV_SEQUENTIAL);
+		bytes = (const char*)view;
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile() {
+#ifdef _WIN32
+		if (bytes != nullptr)UnmapViewOfFile(bytes);
+		if (mapping != nullptr)CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)CloseHandle(file);
+#else
+		if (bytes != nullptr)munmap((void*)bytes, length);
+		if (fd >= 0)close(fd);
+#endif
+	}
+
+private:
+	const char* bytes = nullptr;
+	size_t length = 0;
+	bool opened = false;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
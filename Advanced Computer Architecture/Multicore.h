@@ -0,0 +1,365 @@
+#pragma once
+#include "RunRequest.h"
+#include "Coherence.h"
+#include <thread>
+#include <barrier>
+#include <exception>
+#include <mutex>
+#include <sstream>
+
+//Cores sharing one memory, all running the same program with their core number in tp. Each core is a CPU of its
+//own, with its own pipeline, predictor and a private data cache, kept coherent by MSI through a directory
+//(Coherence.h). Cores are clocked in quanta of cycles spread over host threads: in a quantum each core runs on
+//its own, and at its end, with every host thread waiting, the directory answers all that was asked. Cores only
+//affect each other there, in an order that doesn't depend on the host, so results are the same on any number of
+//host threads. A miss is answered no sooner than the end of its quantum, so a quantum of the miss latency times
+//misses exactly and longer ones trade accuracy for fewer waits. It can't be shorter, or a line could be taken away
+//before the core that asked for it got to use it
+class Multicore {
+public:
+	//The cycle each core's program finished in, or -1 while it runs
+	std::vector<long long> finishedAt;
+	//Cycles clocked so far, a whole number of quanta until the last
+	long long cycles = 0;
+
+	bool finished() {
+		for (long long at : finishedAt)
+			if (at == -1)
+				return false;
+		return true;
+	}
+
+	int coreCount() {
+		return int(cores.size());
+	}
+
+	CPU& core(int index) {
+		return *cores[index];
+	}
+
+	DataCache& cacheOf(int index) {
+		return *caches[index];
+	}
+
+	//Requests answered and messages sent on the bus
+	long long busMessages() {
+		return directory.messages;
+	}
+
+	//The cycle the last core finished in, or the cycles clocked while any still runs
+	long long finishCycle() {
+		if (!finished())
+			return cycles;
+		return *std::max_element(finishedAt.begin(), finishedAt.end());
+	}
+
+	int hostThreadCount() {
+		return std::max(1, std::min(hostThreads, coreCount()));
+	}
+
+	int quantumLength() {
+		return quantum;
+	}
+
+	//Clocks every core until all have finished or maxCycles have passed (0 for no limit). If a core fails, the
+	//others finish their quantum and what it threw is thrown here
+	void run(long long maxCycles) {
+		int hosts = hostThreadCount();
+		bool done = finished() || (maxCycles > 0 && cycles >= maxCycles);
+		long long end = quantumEnd(maxCycles);
+		std::exception_ptr failure;
+		std::mutex failureLock;
+		std::vector<DataCache*> ports;
+		for (auto& cache : caches)
+			ports.push_back(cache.get());
+
+		auto endOfQuantum = [&]() noexcept {
+			cycles = end;
+			directory.serve(ports, cycles);
+			done = failure != nullptr || finished() || (maxCycles > 0 && cycles >= maxCycles);
+			end = quantumEnd(maxCycles);
+		};
+		std::barrier sync(hosts, endOfQuantum);
+		auto work = [&](int host) {
+			while (!done) {
+				for (int c = host; c < coreCount(); c += hosts) {
+					try {
+						runQuantum(c, end);
+					}
+					catch (...) {
+						std::lock_guard<std::mutex> lock(failureLock);
+						if (failure == nullptr)
+							failure = std::current_exception();
+					}
+				}
+				sync.arrive_and_wait();
+			}
+		};
+		std::vector<std::thread> helpers;
+		for (int host = 1; host < hosts; host++)
+			helpers.emplace_back(work, host);
+		work(0);
+		for (auto& helper : helpers)
+			helper.join();
+		if (failure != nullptr)
+			std::rethrow_exception(failure);
+	}
+
+	//One predictor per core, which the system doesn't own. quantum 0 is the data cache's miss latency, and
+	//hostThreads 0 is one per core, up to what the host has
+	Multicore(const assembler::CompileResult& program, const std::vector<BranchPredictor*>& predictors, int hostThreads = 0, int quantum = 0) :
+		finishedAt(predictors.size(), -1),
+		memory(program.memory),
+		directory(GlobalData::dataCache.missCycles),
+		hostThreads(hostThreads > 0 ? hostThreads : int(std::max(1u, std::thread::hardware_concurrency()))),
+		quantum(quantum > 0 ? quantum : GlobalData::dataCache.missCycles)
+	{
+		if (predictors.size() == 0 || predictors.size() > 64)
+			throw assembler::ProgramError("Shared memory needs from 1 to 64 cores, not " + std::to_string(predictors.size()));
+		if (this->quantum < GlobalData::dataCache.missCycles)
+			throw assembler::ProgramError("A quantum of " + std::to_string(this->quantum) + " cycles is shorter than a " + std::to_string(GlobalData::dataCache.missCycles) + " cycle miss");
+		for (size_t c = 0; c < predictors.size(); c++) {
+			caches.emplace_back(std::make_unique<DataCache>(GlobalData::dataCache, memory.size()));
+			cores.emplace_back(std::make_unique<CPU>(GlobalData::width, program, predictors[c]));
+			cores.back()->joinSystem(memory, caches.back().get(), int(c));
+		}
+	}
+
+private:
+	MainMemory memory;
+	std::vector<std::unique_ptr<DataCache>> caches;
+	std::vector<std::unique_ptr<CPU>> cores;
+	Directory directory;
+	int hostThreads;
+	int quantum;
+
+	bool running(int c) {
+		return finishedAt[c] == -1;
+	}
+
+	long long quantumEnd(long long maxCycles) {
+		long long end = cycles + quantum;
+		return maxCycles > 0 ? std::min(end, maxCycles) : end;
+	}
+
+	//Takes in what the directory sent core c, then clocks it up to cycle end. Only ever runs on one host thread at
+	//a time for a given core
+	void runQuantum(int c, long long end) {
+		CPU& cpu = *cores[c];
+		DataCache& cache = *caches[c];
+		CoherenceMessage message;
+		while (cache.fromBus.pop(message))
+			if (cache.receive(message) && running(c))
+				cpu.loseLine(word(message.line) * cache.lineLength(), cache.lineLength());
+		while (running(c) && cpu.cycle < end) {
+			cache.now = cpu.cycle;
+			cpu.update();
+			if (cpu.finished())
+				finishedAt[c] = cpu.cycle;
+		}
+	}
+};
+
+//multicore program [-cores n] [-threads n] [-quantum n] [-config file] [-bp predictor] [-max-cycles n] [-check] [-json]
+struct MulticoreRequest {
+	std::string filename = "";
+	std::string configFile = "";
+	std::string predictorName = "Always";
+	int cores = 4;
+	//Host threads; 0 is one per core, up to what the host has
+	int hostThreads = 0;
+	//0 is the data cache's miss latency
+	int quantum = 0;
+	long long maxCycles = 0;
+	bool check = false;
+	bool json = false;
+};
+
+//arguments are as typed, starting with "multicore" and the program. Returns what was wrong with them, or ""
+inline std::string parseMulticoreArguments(const std::vector<std::string>& arguments, MulticoreRequest& request) {
+	if (arguments.size() < 2)
+		return "multicore needs a program";
+	request.filename = arguments[1];
+	for (size_t i = 2; i < arguments.size(); i++) {
+		std::string option = arguments[i].rfind("--", 0) == 0 ? arguments[i].substr(1) : arguments[i];
+		bool hasValue = i + 1 < arguments.size();
+		if (option == "-cores" && hasValue)
+			request.cores = std::atoi(arguments[++i].c_str());
+		else if (option == "-threads" && hasValue)
+			request.hostThreads = std::atoi(arguments[++i].c_str());
+		else if (option == "-quantum" && hasValue)
+			request.quantum = std::atoi(arguments[++i].c_str());
+		else if (option == "-bp" && hasValue)
+			request.predictorName = arguments[++i];
+		else if (option == "-config" && hasValue)
+			request.configFile = arguments[++i];
+		else if (option == "-max-cycles" && hasValue)
+			request.maxCycles = std::atoll(arguments[++i].c_str());
+		else if (option == "-check")
+			request.check = true;
+		else if (option == "-json")
+			request.json = true;
+		else
+			return "Unknown option " + arguments[i];
+	}
+	if (request.cores < 1)
+		return "multicore needs at least one core";
+	return "";
+}
+
+struct MulticoreCoreResult {
+	//cycles is when the core finished
+	RunStats stats;
+	long long readMisses = 0, writeMisses = 0, invalidations = 0, writebacks = 0;
+	int coherenceStalls = 0, coherenceFlushes = 0;
+};
+
+struct MulticoreResult {
+	std::string error = "";
+	//When the last core finished
+	long long cycles = 0;
+	bool complete = false;
+	//The same program on one core of the same system, for the speedup; 0 when only one core was asked for
+	long long oneCoreCycles = 0;
+	long long busMessages = 0;
+	int hostThreads = 0;
+	int quantum = 0;
+	double hostSeconds = 0;
+	std::vector<MulticoreCoreResult> cores;
+	std::vector<std::string> mismatches;
+
+	long long commits() {
+		long long total = 0;
+		for (auto& core : cores)
+			total += core.stats.commited;
+		return total;
+	}
+
+	float ipc() {
+		return cycles == 0 ? 0 : float(commits()) / float(cycles);
+	}
+
+	//How many times faster the modelled system ran the program than one of its cores alone
+	float speedup() {
+		return oneCoreCycles == 0 || cycles == 0 ? 1 : float(oneCoreCycles) / float(cycles);
+	}
+
+	int status() {
+		if (error != "")
+			return RunError;
+		if (!complete)
+			return RunOutOfBudget;
+		return mismatches.size() == 0 ? RunOk : RunError;
+	}
+};
+
+//Runs the program on the cores GlobalData describes, then on one of them alone for comparison. Only the first run
+//is timed on the host
+inline MulticoreResult executeMulticore(const MulticoreRequest& request) {
+	MulticoreResult result;
+	auto program = assembler::load(request.filename, GlobalData::memorySize);
+	std::vector<std::unique_ptr<BranchPredictor>> predictors;
+	std::vector<BranchPredictor*> corePredictors;
+	for (int c = 0; c < request.cores; c++) {
+		predictors.emplace_back(makeBranchPredictor(request.predictorName));
+		if (predictors.back() == nullptr) {
+			result.error = "Unknown branch predictor " + request.predictorName;
+			return result;
+		}
+		corePredictors.push_back(predictors.back().get());
+	}
+	std::vector<Expectation> expectations;
+	if (request.check) {
+		expectations = readExpectations(request.filename);
+		if (expectations.size() == 0) {
+			result.error = request.filename + " has no #expect lines to check";
+			return result;
+		}
+	}
+
+	Multicore system(program, corePredictors, request.hostThreads, request.quantum);
+	auto start = std::chrono::steady_clock::now();
+	system.run(request.maxCycles);
+	result.hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.cycles = system.finishCycle();
+	result.complete = system.finished();
+	result.busMessages = system.busMessages();
+	result.hostThreads = system.hostThreadCount();
+	result.quantum = system.quantumLength();
+	for (int c = 0; c < system.coreCount(); c++) {
+		MulticoreCoreResult& core = result.cores.emplace_back();
+		CPU& cpu = system.core(c);
+		DataCache& cache = system.cacheOf(c);
+		collectStats(cpu, core.stats);
+		core.stats.cycles = system.finishedAt[c] == -1 ? system.cycles : system.finishedAt[c];
+		if (system.finishedAt[c] == -1)
+			core.stats.limitReached = "cycle limit";
+		core.readMisses = cache.readMisses;
+		core.writeMisses = cache.writeMisses;
+		core.invalidations = cache.invalidations;
+		core.writebacks = cache.writebacks;
+		core.coherenceStalls = cpu.coherenceStalls;
+		core.coherenceFlushes = cpu.coherenceFlushes;
+	}
+	if (result.complete)
+		result.mismatches = checkExpectations(expectations, program.labels, system.core(0));
+
+	if (request.cores > 1) {
+		std::unique_ptr<BranchPredictor> bp(makeBranchPredictor(request.predictorName));
+		Multicore alone(program, { bp.get() }, 1, request.quantum);
+		alone.run(request.maxCycles);
+		result.oneCoreCycles = alone.finishCycle();
+	}
+	return result;
+}
+
+inline std::string multicoreJson(const MulticoreRequest& request, MulticoreResult& result) {
+	std::stringstream s;
+	s << "{\"program\": \"" << jsonEscape(request.filename) << "\", ";
+	if (result.error != "") {
+		s << "\"status\": \"error\", \"error\": \"" << jsonEscape(result.error) << "\"}";
+		return s.str();
+	}
+	s << "\"predictor\": \"" << jsonEscape(request.predictorName) << "\", \"status\": \"" << (result.complete ? "finished" : "cycle limit")
+		<< "\", \"cores\": " << result.cores.size() << ", \"cycles\": " << result.cycles << ", \"commits\": " << result.commits() << ", \"ipc\": " << result.ipc()
+		<< ", \"oneCoreCycles\": " << result.oneCoreCycles << ", \"speedup\": " << result.speedup() << ", \"busMessages\": " << result.busMessages
+		<< ", \"quantum\": " << result.quantum << ", \"hostThreads\": " << result.hostThreads << ", \"hostSeconds\": " << result.hostSeconds;
+	if (request.check && result.complete)
+		s << ", \"mismatches\": " << result.mismatches.size();
+	s << ", \"perCore\": [";
+	for (size_t i = 0; i < result.cores.size(); i++) {
+		MulticoreCoreResult& core = result.cores[i];
+		s << (i > 0 ? ", " : "") << "{\"status\": \"" << core.stats.status() << "\", \"cycles\": " << core.stats.cycles << ", \"commits\": " << core.stats.commited
+			<< ", \"ipc\": " << core.stats.ipc() << ", \"flushes\": " << core.stats.flushes << ", \"readMisses\": " << core.readMisses
+			<< ", \"writeMisses\": " << core.writeMisses << ", \"invalidations\": " << core.invalidations << ", \"writebacks\": " << core.writebacks
+			<< ", \"coherenceStalls\": " << core.coherenceStalls << ", \"coherenceFlushes\": " << core.coherenceFlushes << "}";
+	}
+	s << "]}";
+	return s.str();
+}
+
+inline std::string multicoreText(const MulticoreRequest& request, MulticoreResult& result) {
+	if (result.error != "")
+		return result.error + "\n";
+	std::stringstream s;
+	if (!result.complete)
+		s << "Stopped at the cycle limit: ";
+	s << result.cores.size() << " cores committed " << result.commits() << " instructions in " << result.cycles << " cycles, IPC " << result.ipc() << "\n";
+	if (result.oneCoreCycles > 0)
+		s << "\tOne core alone took " << result.oneCoreCycles << " cycles, a speedup of " << result.speedup() << "\n";
+	s << "\t" << result.busMessages << " bus messages; " << result.hostThreads << " host threads in quanta of " << result.quantum << " cycles took "
+		<< result.hostSeconds << " seconds\n";
+	for (size_t i = 0; i < result.cores.size(); i++) {
+		MulticoreCoreResult& core = result.cores[i];
+		s << "\tCore " << i << ": " << core.stats.commited << " instructions " << (core.stats.complete() ? "finished" : "committed") << " in "
+			<< core.stats.cycles << " cycles; " << core.readMisses << " read and " << core.writeMisses << " write misses, " << core.invalidations
+			<< " invalidations, " << core.coherenceStalls << " cycles waiting to write, " << core.coherenceFlushes << " loads flushed\n";
+	}
+	if (request.check && result.complete) {
+		if (result.mismatches.size() == 0)
+			s << "\tAll " << expectedWordCount(readExpectations(request.filename)) << " expected words matched\n";
+		for (auto& mismatch : result.mismatches)
+			s << "\tMISMATCH " << mismatch << "\n";
+	}
+	return s.str();
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include "riscv.h"
+#include "MappedFile.h"
+#include <cstring>
+#include <map>
+
+//A program image is an assembled program saved as is: a header, then every instruction as four int32s,
+//then the initial data segment starting on a page boundary, then the label table. Loading it maps the data
+//segment in and copies the instructions and labels; nothing is parsed
+namespace image {
+	const char magic[8] = { 'A','C','A','I','M','A','G','E' };
+	const uint32_t version = 4;
+	//The data segment starts on this boundary so it can be mapped into memory instead of copied
+	const size_t dataAlignment = 4096;
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t instructionCount;
+		uint32_t dataLength;
+		uint32_t labelCount;
+	};
+
+	inline size_t dataOffset(const Header& header) {
+		size_t instructionEnd = sizeof(Header) + size_t(header.instructionCount) * 4 * sizeof(int32_t);
+		return (instructionEnd + dataAlignment - 1) / dataAlignment * dataAlignment;
+	}
+
+	inline bool isImage(MappedFile& file) {
+		return file.isOpen() && file.size() >= sizeof(Header) && memcmp(file.data(), magic, sizeof(magic)) == 0;
+	}
+}
+
+namespace assembler {
+	inline void writeImage(const CompileResult& program, const std::string& filename) {
+		std::ofstream file(filename, std::ios::binary);
+		if (!file.is_open())
+			throw ProgramError("Could not open " + filename + " to write an image");
+
+		image::Header header;
+		memcpy(header.magic, image::magic, sizeof(header.magic));
+		header.version = image::version;
+		header.instructionCount = program.instructions.size();
+		header.dataLength = program.dataLength;
+		header.labelCount = program.labels.size();
+		file.write((const char*)&header, sizeof(header));
+
+		std::vector<int32_t> packed;
+		packed.reserve(program.instructions.size() * 4);
+		for (auto& i : program.instructions) {
+			packed.emplace_back(i.operation);
+			packed.emplace_back(i.destination);
+			packed.emplace_back(i.source1);
+			packed.emplace_back(i.source2);
+		}
+		file.write((const char*)packed.data(), packed.size() * sizeof(int32_t));
+		size_t written = sizeof(header) + packed.size() * sizeof(int32_t);
+		std::vector<char> padding(image::dataOffset(header) - written, 0);
+		file.write(padding.data(), padding.size());
+		file.write((const char*)program.memory.data(), program.dataLength * sizeof(word));
+
+		//Sorted so the same program always gives the same bytes
+		std::map<std::string, int> sortedLabels(program.labels.begin(), program.labels.end());
+		for (auto& [name, value] : sortedLabels) {
+			int32_t fields[2] = { value, int32_t(name.size()) };
+			file.write((const char*)fields, sizeof(fields));
+			file.write(name.data(), name.size());
+		}
+	}
+
+	inline CompileResult loadImage(MappedFile& file, const std::string& filename, int memorySize) {
+		image::Header header;
+		memcpy(&header, file.data(), sizeof(header));
+		if (header.version != image::version)
+			throw ProgramError(filename + " is a version " + std::to_string(header.version) + " image, expected version " + std::to_string(image::version));
+
+		size_t dataOffset = image::dataOffset(header);
+		size_t dataBytes = size_t(header.dataLength) * sizeof(word);
+		if (file.size() < dataOffset + dataBytes)
+			throw ProgramError(filename + " is truncated");
+		if (int(header.dataLength) > memorySize)
+			throw ProgramError(filename + " needs " + std::to_string(header.dataLength) + " words of memory but only " + std::to_string(memorySize) + " are configured");
+
+		CompileResult result;
+		const char* cursor = file.data() + sizeof(header);
+		const int32_t* packed = (const int32_t*)cursor;
+		result.instructions.reserve(header.instructionCount);
+		for (uint32_t i = 0; i < header.instructionCount; i++, packed += 4) {
+			Instruction& instruction = result.instructions.emplace_back(Opcode(packed[0]));
+			instruction.destination = packed[1];
+			instruction.source1 = packed[2];
+			instruction.source2 = packed[3];
+		}
+
+		result.memory = MainMemory(memorySize);
+		if (!result.memory.loadFile(0, filename, dataOffset / sizeof(word), header.dataLength))
+			throw ProgramError("Could not read the data segment of " + filename);
+		result.dataLength = header.dataLength;
+		cursor = file.data() + dataOffset + dataBytes;
+
+		const char* end = file.data() + file.size();
+		for (uint32_t i = 0; i < header.labelCount; i++) {
+			int32_t fields[2];
+			if (cursor + sizeof(fields) > end)
+				throw ProgramError(filename + " has a truncated label table");
+			memcpy(fields, cursor, sizeof(fields));
+			cursor += sizeof(fields);
+			if (fields[1] < 0 || cursor + fields[1] > end)
+				throw ProgramError(filename + " has a truncated label table");
+			result.labels.emplace(std::string(cursor, fields[1]), fields[0]);
+			cursor += fields[1];
+		}
+		return result;
+	}
+
+	//Loads either an image or assembly source, whichever the file turns out to be
+	inline CompileResult load(const std::string& filename, int memorySize) {
+		{
+			MappedFile file(filename);
+			if (image::isImage(file))
+				return loadImage(file, filename, memorySize);
+		}
+		return compile(filename, memorySize);
+	}
+}
@@ -0,0 +1,223 @@
+#pragma once
+#include "riscv.h"
+
+//A merged physical register file: committed and in flight values share one pool of registers. Each instruction
+//that writes a register is given a free one at rename, and the register it replaces in the committed map is only
+//freed when the instruction commits. Sources are read through the rename map: a ready register gives its value,
+//otherwise the source waits on the ROB entry that will write it. r0 is never renamed
+class PhysicalRegisterFile {
+public:
+	bool hasFree() {
+		return freeList.size() > 0;
+	}
+
+	//Registers given out to instructions still in flight
+	int inFlight() {
+		return int(values.size()) - 32 - int(freeList.size());
+	}
+
+	//Where the youngest value of reg is
+	int mapOf(word reg) {
+		return map[reg];
+	}
+
+	bool isReady(int physical) {
+		return ready[physical] != 0;
+	}
+
+	word valueOf(int physical) {
+		return values[physical];
+	}
+
+	//The ROB entry that writes physical
+	int writerOf(int physical) {
+		return writers[physical];
+	}
+
+	//Gives reg, written by the ROB entry robIndex, a free register. There must be one
+	void rename(word reg, int robIndex) {
+		int physical = freeList.back();
+		freeList.pop_back();
+		map[reg] = physical;
+		ready[physical] = 0;
+		writers[physical] = robIndex;
+		allocated[robIndex] = Allocation{ reg, physical };
+	}
+
+	//An entry that was given no register (a store, a branch) has to say so, as ROB entries are reused
+	void noRename(int robIndex) {
+		allocated[robIndex] = Allocation{ -1, -1 };
+	}
+
+	//Called as robIndex finishes, whether or not it writes a register
+	void complete(int robIndex, word value) {
+		int physical = allocated[robIndex].physical;
+		if (physical != -1) {
+			values[physical] = value;
+			ready[physical] = 1;
+		}
+	}
+
+	//robIndex is committing; the register its destination had before is no longer needed by anything
+	void retire(int robIndex) {
+		Allocation allocation = allocated[robIndex];
+		if (allocation.physical == -1)
+			return;
+		freeList.push_back(committedMap[allocation.reg]);
+		committedMap[allocation.reg] = allocation.physical;
+	}
+
+	//Everything in flight is gone: the map goes back to the committed one and every other register is free
+	void flushEverything() {
+		std::copy(std::begin(committedMap), std::end(committedMap), std::begin(map));
+		std::fill(committed.begin(), committed.end(), 0);
+		for (int physical : committedMap)
+			committed[physical] = 1;
+		freeList.clear();
+		for (int physical = int(values.size()) - 1; physical >= 0; physical--)
+			if (!committed[physical])
+				freeList.push_back(physical);
+	}
+
+	//Sets the committed value of reg, with nothing in flight
+	void setCommitted(word reg, word value) {
+		values[committedMap[reg]] = value;
+	}
+
+	//Every register holds 0, with r0 to r31 in the first 32
+	void reset() {
+		for (int i = 0; i < 32; i++)
+			map[i] = committedMap[i] = i;
+		std::fill(values.begin(), values.end(), 0);
+		std::fill(ready.begin(), ready.end(), 1);
+		flushEverything();
+	}
+
+	//size includes the 32 that hold the committed registers
+	PhysicalRegisterFile(int size, int robSize) :
+		values(size, 0),
+		ready(size, 1),
+		writers(size, -1),
+		committed(size, 0),
+		allocated(robSize, Allocation{ -1, -1 })
+	{
+		reset();
+	}
+
+private:
+	struct Allocation {
+		word reg;
+		int physical;
+	};
+	int map[32];
+	int committedMap[32];
+	std::vector<word> values;
+	std::vector<uint8_t> ready;
+	std::vector<int> writers;
+	std::vector<int> freeList;
+	//Scratch space for a flush
+	std::vector<uint8_t> committed;
+	//What each ROB entry was given at rename
+	std::vector<Allocation> allocated;
+};
+
+//The vector registers, always renamed the same way as a PhysicalRegisterFile renames scalar ones: each instruction
+//that writes a vector register is given a free physical one as it is fetched, and the one it replaces is freed as it
+//commits. What flows between instructions is the number of the physical register rather than its words, so a
+//vector source waits on its writer's ROB entry like any other and is read from the register as it executes. With
+//one physical register for every ROB entry on top of the committed ones, fetch never has to wait for one
+class VectorRegisterFile {
+public:
+	int length() {
+		return words;
+	}
+
+	int mapOf(word reg) {
+		return map[reg];
+	}
+
+	bool isReady(int physical) {
+		return ready[physical] != 0;
+	}
+
+	//The ROB entry that writes physical
+	int writerOf(int physical) {
+		return writers[physical];
+	}
+
+	//The words of a physical register
+	word* lanes(int physical) {
+		return &values[size_t(physical) * words];
+	}
+
+	//Gives reg, written by the ROB entry robIndex, a free register, returning it
+	int rename(word reg, int robIndex) {
+		int physical = freeList.back();
+		freeList.pop_back();
+		map[reg] = physical;
+		ready[physical] = 0;
+		writers[physical] = robIndex;
+		allocated[robIndex] = Allocation{ reg, physical };
+		return physical;
+	}
+
+	//Called as robIndex finishes; only for an entry that writes a vector register
+	void complete(int robIndex) {
+		ready[allocated[robIndex].physical] = 1;
+	}
+
+	//robIndex, which writes a vector register, is committing
+	void retire(int robIndex) {
+		Allocation allocation = allocated[robIndex];
+		freeList.push_back(committedMap[allocation.reg]);
+		committedMap[allocation.reg] = allocation.physical;
+	}
+
+	void flushEverything() {
+		std::copy(std::begin(committedMap), std::end(committedMap), std::begin(map));
+		std::fill(committed.begin(), committed.end(), 0);
+		for (int physical : committedMap)
+			committed[physical] = 1;
+		freeList.clear();
+		for (int physical = int(ready.size()) - 1; physical >= 0; physical--)
+			if (!committed[physical])
+				freeList.push_back(physical);
+	}
+
+	//Every register holds zeros, with v0 to v7 in the first ones
+	void reset() {
+		for (int i = 0; i < vectorRegisterCount; i++)
+			map[i] = committedMap[i] = i;
+		std::fill(values.begin(), values.end(), 0);
+		std::fill(ready.begin(), ready.end(), 1);
+		flushEverything();
+	}
+
+	//robSize is the whole ROB's, as SMT threads number their entries apart
+	VectorRegisterFile(int length, int robSize) :
+		words(length),
+		values(size_t(vectorRegisterCount + robSize) * length, 0),
+		ready(vectorRegisterCount + robSize, 1),
+		writers(vectorRegisterCount + robSize, -1),
+		committed(vectorRegisterCount + robSize, 0),
+		allocated(robSize, Allocation{ -1, -1 })
+	{
+		reset();
+	}
+
+private:
+	struct Allocation {
+		word reg;
+		int physical;
+	};
+	int words;
+	int map[vectorRegisterCount];
+	int committedMap[vectorRegisterCount];
+	std::vector<word> values;
+	std::vector<uint8_t> ready;
+	std::vector<int> writers;
+	std::vector<int> freeList;
+	//Scratch space for a flush
+	std::vector<uint8_t> committed;
+	std::vector<Allocation> allocated;
+};
@@ -1,7 +1,8 @@
 #pragma once
 
 #include "ExecutionUnit.h"
-#include "MattQueue.h"
+#include "StationSlots.h"
+#include "StoreSets.h"
 
 class GenericReservationStation {
 public:
@@ -17,74 +18,92 @@ public:
 
 	virtual void flushEverything() = 0;
 
-	virtual std::optional<word> getReturnAddress() = 0;
+	//Only the instructions of one hardware thread go, when threads share the station
+	virtual void flushThread(int thread) = 0;
+
+	virtual std::optional<word> getReturnAddress(int thread) = 0;
+
+	//Lets the instruction that writes robIndex, if it waits here, go ahead of ready instructions of lower priority
+	virtual void raisePriority(word robIndex, int priority) = 0;
+
+	//Instructions waiting here, ready or not
+	virtual int occupancy() = 0;
+
+	virtual int occupancyOf(int thread) = 0;
 };
 
 class ReservationStation final : public GenericReservationStation{
 public:
 	void commonDataBus(word robIndex, word value)final override {
-		for (auto& currentEntry : entries) {
-			currentEntry.commonDataBus(robIndex, value);
-		}
+		slots.commonDataBus(robIndex, value);
 	}
 
 	bool hasRoom(Opcode)final override {
-		return entries.size() != capacity;
+		return slots.size() != capacity;
 	}
 
 	bool readyToExecute()final override {
-		for (auto& currentEntry : entries)
-			if (currentEntry.readyToExecute())
-				return true;
-		return false;
+		return slots.firstReady() != -1;
 	}
 
 	void executeOn(ExecutionUnit* eu)final override {
-		for (auto currentEntry = entries.begin(); currentEntry != entries.end(); ++currentEntry) {
-			if (currentEntry->readyToExecute()) {
-				eu->place(*currentEntry);
-				entries.erase(currentEntry);
-				return;
-			}
-		}
+		int ready = slots.bestReady();
+		if (ready != -1)
+			eu->place(slots.take(ready));
 	}
 
 	void push(PipelineEntry entry)final override {
-		entries.emplace_back(entry);
+		slots.push(entry);
 	}
 
 	void flushEverything()final override {
-		entries.clear();
+		slots.clear();
 	}
 
-	std::optional<word> getReturnAddress()final override {
-		for (auto& e : entries)
-			if (e.opcode == Jlr)
-				return e.instructionAddress;
+	void flushThread(int thread)final override {
+		slots.removeThread(thread);
+	}
+
+	std::optional<word> getReturnAddress(int thread)final override {
+		for (int i = 0; i < slots.size(); i++)
+			if (slots[i].opcode == Jlr && slots[i].thread == thread)
+				return slots[i].instructionAddress;
 		return std::nullopt;
 	}
 
+	void raisePriority(word robIndex, int priority)final override {
+		slots.raisePriority(robIndex, priority);
+	}
+
+	int occupancy()final override {
+		return slots.size();
+	}
+
+	int occupancyOf(int thread)final override {
+		return slots.countOf(thread);
+	}
+
 	ReservationStation(int capacity) :
+		slots(capacity),
 		capacity(capacity)
 	{}
 private:
-	std::vector<PipelineEntry> entries;
+	StationSlots slots;
 	const int capacity;
 };
 
 class LoadStoreQueue : public GenericReservationStation{
 public:
 	void commonDataBus(word robIndex, word value)final override {
-		for (auto& s : stores)
-			s.first.commonDataBus(robIndex, value);
-		for (auto& l : loads)
-			l.first.commonDataBus(robIndex, value);
+		stores.commonDataBus(robIndex, value);
+		loads.commonDataBus(robIndex, value);
 	}
 
 	bool hasRoom(Opcode op)final override {
-		if (groups::stores.count(op) > 0 && stores.size() < capacity)
+		//Atomics queue with the stores, which loads behind them wait for, and vector loads and stores with their kind
+		if (isStore(op) && stores.size() < capacity)
 			return true;
-		else if (groups::loads.count(op) > 0 && loads.size() < capacity)
+		else if (!isStore(op) && loads.size() < capacity)
 			return true;
 		return false;
 	}
@@ -96,37 +115,24 @@ public:
 
 	void executeOn(ExecutionUnit* eu)final override {
 		auto executable = getExecutableInstruction();
-		eu->place((*executable.first)[executable.second].first);
-		executable.first->erase(executable.first->begin() + executable.second);
+		eu->place(executable.first->take(executable.second));
 	}
 
 	void push(PipelineEntry entry)final override {
-		if (groups::loads.count(entry.opcode) > 0)
-			loads.push(std::pair(entry, nextIndex));
+		if (isStore(entry.unitOpcode()))
+			stores.push(entry, nextIndex);
 		else
-			stores.push(std::pair(entry, nextIndex));
+			loads.push(entry, nextIndex);
 
 		nextIndex += 1;
 		//This probably won't happen often
 		if (nextIndex == INT_MAX) {
 			int min = INT_MAX;
-			for (auto& s : stores)if (s.second < min) min = s.second;
-			for (auto& l : loads)if (l.second < min) min = l.second;
-			int newMax = 0;
-
-
-			for (auto& s : stores) {
-				s.second -= min;
-				if (s.second > newMax)
-					newMax = s.second;
-			}
-			for (auto& l : loads) {
-				l.second -= min;
-				if (l.second > newMax)
-					newMax = l.second;
-			}
-
-			nextIndex = newMax + 1;
+			for (int i = 0; i < stores.size(); i++)if (stores.age(i) < min) min = stores.age(i);
+			for (int i = 0; i < loads.size(); i++)if (loads.age(i) < min) min = loads.age(i);
+			stores.subtractFromAges(min);
+			loads.subtractFromAges(min);
+			nextIndex -= min;
 		}
 	}
 
@@ -135,44 +141,84 @@ public:
 		stores.clear();
 	}
 
-	std::optional<word> getReturnAddress() {
+	void flushThread(int thread)final override {
+		loads.removeThread(thread);
+		stores.removeThread(thread);
+	}
+
+	std::optional<word> getReturnAddress(int)final override {
 		return std::nullopt;
 	}
 
-	LoadStoreQueue(int capacity):
+	void raisePriority(word robIndex, int priority)final override {
+		loads.raisePriority(robIndex, priority);
+		stores.raisePriority(robIndex, priority);
+	}
+
+	int occupancy()final override {
+		return loads.size() + stores.size();
+	}
+
+	int occupancyOf(int thread)final override {
+		return loads.countOf(thread) + stores.countOf(thread);
+	}
+
+	//With storeSets, loads may go ahead of older stores the predictor doesn't tie them to
+	LoadStoreQueue(int capacity, StoreSetPredictor* storeSets = nullptr):
+		loads(capacity),
+		stores(capacity),
 		nextIndex(0),
-		capacity(capacity)
+		capacity(capacity),
+		storeSets(storeSets)
 	{}
 private:
-	using lsQueue = MattQueue<std::pair<PipelineEntry, int>>;
-	lsQueue loads;
-	lsQueue stores;
+	StationSlots loads;
+	StationSlots stores;
 	int nextIndex;
 	const int capacity;
+	StoreSetPredictor* storeSets;
+
+	static bool isStore(Opcode op) {
+		return groups::stores.count(op) > 0 || groups::atomics.count(op) > 0 || groups::vectorStores.count(op) > 0;
+	}
 
-	std::pair<lsQueue*, int> getExecutableInstruction() {
-		std::pair<lsQueue*, int> response(nullptr, -1);
-		int index = 0;
-		for (auto& s : stores) {
-			if (s.first.readyToExecute()) {
-				response = std::pair(&stores, index);
-				break;
-			}
-			index += 1;
+	//The oldest ready load that no older store in its set is still waiting for, or -1
+	int firstSpeculativeLoad() {
+		for (int i = 0; i < loads.size(); i++) {
+			if (!loads.isReady(i))
+				continue;
+			int set = storeSets->setOf(loads[i].unitInstructionAddress() - 1);
+			bool waiting = false;
+			for (int j = 0; set != -1 && j < stores.size() && stores.age(j) < loads.age(i); j++)
+				waiting |= storeSets->setOf(stores[j].unitInstructionAddress() - 1) == set;
+			if (!waiting)
+				return i;
+		}
+		return -1;
+	}
+
+	//The first ready store, unless a ready load older than every waiting store can go first; each is picked by
+	//priority, then age. With store sets a load only has to wait for older stores in its set, and the older of the
+	//oldest such load and the store goes
+	std::pair<StationSlots*, int> getExecutableInstruction() {
+		std::pair<StationSlots*, int> response(nullptr, -1);
+		int store = stores.bestReady();
+		if (store != -1)
+			response = std::pair(&stores, store);
+
+		if (storeSets != nullptr) {
+			int load = firstSpeculativeLoad();
+			if (load != -1 && (store == -1 || loads.age(load) < stores.age(store)))
+				response = std::pair(&loads, load);
+			return response;
 		}
 
 		int earlisetStore = INT_MAX;
 		if (stores.size() > 0)
-			earlisetStore = stores.front().second;
-		index = 0;
-		for (auto& l : loads) {
-			if (l.second > earlisetStore)break;
-			if (l.first.readyToExecute()) {
-				response = std::pair(&loads, index);
-				break;
-			}
-			index += 1;
-		}
+			earlisetStore = stores.age(0);
+		int load = loads.bestReady(earlisetStore);
+		if (load != -1)
+			response = std::pair(&loads, load);
 
 		return response;
 	}
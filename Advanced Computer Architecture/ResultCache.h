@@ -0,0 +1,146 @@
+#pragma once
+#include "riscv.h"
+#include "globalValues.h"
+#include "Hash.h"
+#include <filesystem>
+#include <sstream>
+#include <thread>
+
+//Everything a finished run reports
+struct RunStats {
+	long long cycles = 0;
+	long long commited = 0;
+	long long flushes = 0;
+	//Of those flushes, how many were for a load that ran ahead of a store to the same address
+	long long orderingFlushes = 0;
+	long long robStalls = 0;
+	long long issueStalls = 0;
+	//Cycles fetch waited on the I-cache, a taken branch bubble or the branch predictor, and the I-cache's fills
+	long long frontEndStalls = 0;
+	long long icacheMisses = 0;
+	//Cycles fetch waited for a free physical register
+	long long renameStalls = 0;
+	//Instructions decoded, and how many pairs of them decode fused
+	long long decoded = 0;
+	long long fusedPairs = 0;
+	//Loads fetched with a predicted value, and flushes for the ones that read something else
+	long long valuePredictions = 0;
+	long long valueFlushes = 0;
+	//Ended on a halt instruction rather than by setting the global pointer
+	bool halted = false;
+	//Which budget ran out first, if one did; the counts then only go up to that point and are never cached
+	std::string limitReached = "";
+
+	float ipc() {
+		return cycles == 0 ? 0 : float(commited) / float(cycles);
+	}
+
+	bool complete() {
+		return limitReached == "";
+	}
+
+	//The fraction of decoded instructions that went on as half of a fused pair
+	float fusionRate() {
+		return decoded == 0 ? 0 : float(2 * fusedPairs) / float(decoded);
+	}
+
+	std::string status() {
+		if (!complete())
+			return limitReached;
+		return halted ? "halted" : "finished";
+	}
+
+	std::string serialize() {
+		std::stringstream s;
+		s << "cycles " << cycles << "\ncommits " << commited << "\nflushes " << flushes
+			<< "\nrobStalls " << robStalls << "\nissueStalls " << issueStalls << "\nhalted " << halted
+			<< "\norderingFlushes " << orderingFlushes << "\nfrontEndStalls " << frontEndStalls << "\nicacheMisses " << icacheMisses
+			<< "\nrenameStalls " << renameStalls << "\ndecoded " << decoded << "\nfusedPairs " << fusedPairs
+			<< "\nvaluePredictions " << valuePredictions << "\nvalueFlushes " << valueFlushes << "\n";
+		return s.str();
+	}
+
+	bool deserialize(std::istream& in) {
+		std::string name;
+		long long value;
+		int found = 0;
+		while (in >> name >> value) {
+			found += 1;
+			if (name == "cycles")cycles = value;
+			else if (name == "commits")commited = value;
+			else if (name == "flushes")flushes = value;
+			else if (name == "robStalls")robStalls = value;
+			else if (name == "issueStalls")issueStalls = value;
+			else if (name == "halted")halted = value != 0;
+			else if (name == "orderingFlushes")orderingFlushes = value;
+			else if (name == "frontEndStalls")frontEndStalls = value;
+			else if (name == "icacheMisses")icacheMisses = value;
+			else if (name == "renameStalls")renameStalls = value;
+			else if (name == "decoded")decoded = value;
+			else if (name == "fusedPairs")fusedPairs = value;
+			else if (name == "valuePredictions")valuePredictions = value;
+			else if (name == "valueFlushes")valueFlushes = value;
+			else found -= 1;
+		}
+		return found == 14;
+	}
+};
+
+//Changes every time the simulator is rebuilt, so results from an older model are never reused
+inline const char* const simulatorBuild = __DATE__ " " __TIME__;
+
+//On disk results, one small file per (program, hardware, predictor, mode) key
+class ResultCache {
+public:
+	//mode separates runs that model the same thing differently, such as trace replay
+	static std::string key(const assembler::CompileResult& program, const std::string& predictor, const std::string& mode) {
+		Hasher h;
+		h.add(std::string(simulatorBuild));
+		h.add(int64_t(program.instructions.size()));
+		for (auto& i : program.instructions) {
+			h.add(int32_t(i.operation));
+			h.add(i.destination);
+			h.add(i.source1);
+			h.add(i.source2);
+		}
+		h.add(program.memory.data(), program.dataLength * sizeof(word));
+		h.add(GlobalData::describe());
+		h.add(predictor);
+		h.add(mode);
+		return h.hex();
+	}
+
+	std::optional<RunStats> find(const std::string& key) {
+		std::ifstream file(pathOf(key));
+		if (!file.is_open())
+			return std::nullopt;
+		RunStats stats;
+		if (!stats.deserialize(file))
+			return std::nullopt;
+		return stats;
+	}
+
+	void store(const std::string& key, RunStats& stats) {
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		//Write then rename, so a reader never sees half a file. Threads storing the same key each write their own
+		std::string finalPath = pathOf(key);
+		std::string temporary = finalPath + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+		{
+			std::ofstream file(temporary);
+			file << stats.serialize();
+		}
+		std::filesystem::rename(temporary, finalPath, error);
+	}
+
+	ResultCache(const std::string& directory):
+		directory(directory)
+	{}
+
+private:
+	std::string directory;
+
+	std::string pathOf(const std::string& key) {
+		return (std::filesystem::path(directory) / (key + ".txt")).string();
+	}
+};
@@ -0,0 +1,254 @@
+#pragma once
+#include "Simulation.h"
+#include "Expectations.h"
+#include <memory>
+#include <chrono>
+#include <sstream>
+
+//One simulation as the REPL, the command line or the job server asks for it:
+//run program [-config file] [-bp predictor] [-max-cycles n] [-max-seconds s] [-replay trace] [-interval n file] [-noskip] [-check] [-cache] [-json] ...
+//Options may be written with one dash or two
+struct RunRequest {
+	std::string filename = "";
+	std::string configFile = "";
+	std::string predictorName = "Always";
+	std::string replayFile = "";
+	//Writes interval statistics (IntervalStats.h) every intervalCycles cycles to intervalFile
+	long long intervalCycles = 0;
+	std::string intervalFile = "";
+	SimulationLimits limits;
+	bool check = false;
+	bool useCache = false;
+	bool debugPrint = false;
+	//Clock every cycle even when nothing but execution units can move
+	bool noSkip = false;
+
+	//Only change what gets printed
+	bool printIPC = false;
+	bool instrumentFlushes = false;
+	bool insrumentClogs = false;
+	bool json = false;
+};
+
+//What runProgram hands back to a script
+enum RunStatus {
+	RunOk = 0, RunError = 1, RunUsage = 2, RunOutOfBudget = 3
+};
+
+//arguments are as typed, starting with "run" and the program. Returns what was wrong with them, or ""
+inline std::string parseRunArguments(const std::vector<std::string>& arguments, RunRequest& request) {
+	if (arguments.size() < 2)
+		return "run needs a program";
+	request.filename = arguments[1];
+	for (size_t i = 2; i < arguments.size(); i++) {
+		std::string option = arguments[i].rfind("--", 0) == 0 ? arguments[i].substr(1) : arguments[i];
+		bool hasValue = i + 1 < arguments.size();
+		if (option == "-bp" && hasValue)
+			request.predictorName = arguments[++i];
+		else if (option == "-ipc")
+			request.printIPC = true;
+		else if (option == "-flushes")
+			request.instrumentFlushes = true;
+		else if (option == "-clogs")
+			request.insrumentClogs = true;
+		else if (option == "-d")
+			request.debugPrint = true;
+		else if (option == "-replay" && hasValue)
+			request.replayFile = arguments[++i];
+		else if (option == "-noskip")
+			request.noSkip = true;
+		else if (option == "-cache")
+			request.useCache = true;
+		else if (option == "-check")
+			request.check = true;
+		else if (option == "-json")
+			request.json = true;
+		else if (option == "-max-cycles" && hasValue)
+			request.limits.maxCycles = std::atoll(arguments[++i].c_str());
+		else if (option == "-max-seconds" && hasValue)
+			request.limits.maxSeconds = std::atof(arguments[++i].c_str());
+		else if (option == "-interval" && i + 2 < arguments.size()) {
+			request.intervalCycles = std::atoll(arguments[++i].c_str());
+			request.intervalFile = arguments[++i];
+			if (request.intervalCycles <= 0)
+				return "-interval needs a positive number of cycles";
+		}
+		else if (option == "-config" && hasValue)
+			request.configFile = arguments[++i];
+		else
+			return "Unknown option " + arguments[i];
+	}
+	return "";
+}
+
+struct RunResult {
+	//Set when the run couldn't happen at all; nothing else is then meaningful
+	std::string error = "";
+	RunStats stats;
+	bool cached = false;
+	double hostSeconds = 0;
+	int expectedWords = 0;
+	std::vector<std::string> mismatches;
+
+	int status() {
+		if (error != "")
+			return RunError;
+		if (!stats.complete())
+			return RunOutOfBudget;
+		return mismatches.size() == 0 ? RunOk : RunError;
+	}
+};
+
+//Runs an already loaded program on the hardware described by settings. GlobalData only holds those settings
+//while the CPU is being built, so any number of threads can run requests at once
+inline RunResult executeRun(const RunRequest& request, const assembler::CompileResult& program, const GlobalData::Settings& settings) {
+	RunResult result;
+	std::unique_ptr<BranchPredictor> bp(makeBranchPredictor(request.predictorName));
+	if (bp == nullptr) {
+		result.error = "Unknown branch predictor " + request.predictorName;
+		return result;
+	}
+
+	std::vector<Expectation> expectations;
+	if (request.check) {
+		expectations = readExpectations(request.filename);
+		if (expectations.size() == 0) {
+			result.error = request.filename + " has no #expect lines to check";
+			return result;
+		}
+		if (request.replayFile != "") {
+			result.error = "Replays don't compute values, so there is nothing to check";
+			return result;
+		}
+		result.expectedWords = expectedWordCount(expectations);
+	}
+	//Checking needs the final memory and intervals need every cycle, which only a real run has
+	bool useCache = request.useCache && !request.check && request.intervalFile == "";
+
+	std::string mode = "execute";
+	if (request.replayFile != "") {
+		MappedFile traceBytes(request.replayFile);
+		mode = "replay " + Hasher().add(traceBytes.data(), traceBytes.size()).hex();
+	}
+
+	std::unique_ptr<CPU> cpu;
+	std::string cacheKey;
+	GlobalData::with(settings, [&]() {
+		//The key hashes all of the program's data, which would read in every page of a large .incbin
+		if (useCache)
+			cacheKey = ResultCache::key(program, request.predictorName, mode);
+		else cpu = std::make_unique<CPU>(settings.width, program, bp.get());
+	});
+
+	ResultCache cache("simcache");
+	std::optional<RunStats> cached = useCache ? cache.find(cacheKey) : std::nullopt;
+	//A cached run that went past the cycle budget has to stop at the budget instead
+	if (cached.has_value() && request.limits.maxCycles > 0 && cached->cycles > request.limits.maxCycles)
+		cached = std::nullopt;
+	if (cached.has_value()) {
+		result.stats = *cached;
+		result.cached = true;
+		return result;
+	}
+	if (cpu == nullptr)
+		GlobalData::with(settings, [&]() { cpu = std::make_unique<CPU>(settings.width, program, bp.get()); });
+
+	std::unique_ptr<TraceReader> trace;
+	if (request.replayFile != "") {
+		trace = std::make_unique<TraceReader>(request.replayFile);
+		std::string problem = cpu->replay(trace.get());
+		if (problem != "") {
+			result.error = "Could not replay " + request.replayFile + ": " + problem;
+			return result;
+		}
+	}
+	std::unique_ptr<IntervalRecorder> intervals;
+	if (request.intervalFile != "") {
+		intervals = std::make_unique<IntervalRecorder>(request.intervalFile, request.intervalCycles);
+		if (!intervals->isOpen()) {
+			result.error = "Could not open " + request.intervalFile;
+			return result;
+		}
+	}
+	auto start = std::chrono::steady_clock::now();
+	result.stats = simulate(*cpu, request.debugPrint, request.limits, intervals.get(), !request.noSkip);
+	result.hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (useCache && result.stats.complete())
+		cache.store(cacheKey, result.stats);
+	if (result.stats.complete())
+		result.mismatches = checkExpectations(expectations, program.labels, *cpu);
+	return result;
+}
+
+inline std::string jsonEscape(const std::string& text) {
+	std::string escaped = "";
+	for (char c : text) {
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		if (c == '\n')
+			escaped += "\\n";
+		else
+			escaped += c;
+	}
+	return escaped;
+}
+
+//One line, so results can be streamed and read back a line at a time. extraFields go first, e.g. "\"job\": 3, "
+inline std::string runJson(const RunRequest& request, RunResult& result, const std::string& extraFields = "") {
+	std::stringstream s;
+	s << "{" << extraFields << "\"program\": \"" << jsonEscape(request.filename) << "\", ";
+	if (result.error != "") {
+		s << "\"status\": \"error\", \"error\": \"" << jsonEscape(result.error) << "\"}";
+		return s.str();
+	}
+	RunStats& stats = result.stats;
+	s << "\"predictor\": \"" << jsonEscape(request.predictorName) << "\", \"status\": \"" << stats.status()
+		<< "\", \"cached\": " << (result.cached ? "true" : "false") << ", \"cycles\": " << stats.cycles << ", \"commits\": " << stats.commited
+		<< ", \"ipc\": " << stats.ipc() << ", \"flushes\": " << stats.flushes << ", \"orderingFlushes\": " << stats.orderingFlushes << ", \"robStalls\": " << stats.robStalls
+		<< ", \"issueStalls\": " << stats.issueStalls << ", \"frontEndStalls\": " << stats.frontEndStalls << ", \"icacheMisses\": " << stats.icacheMisses
+		<< ", \"renameStalls\": " << stats.renameStalls << ", \"fusedPairs\": " << stats.fusedPairs << ", \"fusionRate\": " << stats.fusionRate()
+		<< ", \"valuePredictions\": " << stats.valuePredictions << ", \"valueFlushes\": " << stats.valueFlushes
+		<< ", \"hostSeconds\": " << result.hostSeconds;
+	if (request.check && stats.complete())
+		s << ", \"mismatches\": " << result.mismatches.size();
+	s << "}";
+	return s.str();
+}
+
+//The REPL's report
+inline std::string runText(const RunRequest& request, RunResult& result) {
+	if (result.error != "")
+		return result.error + "\n";
+	std::stringstream s;
+	RunStats& stats = result.stats;
+	if (!stats.complete())
+		s << "Stopped at the " << stats.status() << ": ";
+	s << stats.commited << " instructions " << (stats.complete() ? "finished" : "committed") << " in " << stats.cycles << " cycles"
+		<< (result.cached ? " (cached)" : "") << (stats.halted ? " (halted)" : "") << "\n";
+	if (request.printIPC)
+		s << "\tIPC was " << stats.ipc() << "\n";
+	if (request.instrumentFlushes)
+		s << "\tPipeline was flushed " << stats.flushes << " times\n";
+	if (request.instrumentFlushes && stats.orderingFlushes > 0)
+		s << "\t" << stats.orderingFlushes << " of those were for loads that ran ahead of a store to the same address\n";
+	if (request.instrumentFlushes && stats.valuePredictions > 0)
+		s << "\t" << stats.valueFlushes << " of those were for loads that read something other than the " << stats.valuePredictions << " values predicted\n";
+	if (request.insrumentClogs) {
+		s << "\tFetch waited on a full ROB for " << stats.robStalls << " cycles\n";
+		s << "\tIssue waited on a full reservation station for " << stats.issueStalls << " cycles\n";
+		s << "\tFetch waited on the front end for " << stats.frontEndStalls << " cycles\n";
+		if (stats.icacheMisses > 0)
+			s << "\tThe I-cache filled " << stats.icacheMisses << " lines\n";
+		if (stats.renameStalls > 0)
+			s << "\tFetch waited on a free physical register for " << stats.renameStalls << " cycles\n";
+		if (stats.fusedPairs > 0)
+			s << "\tDecode fused " << stats.fusedPairs << " pairs, " << 100 * stats.fusionRate() << "% of decoded instructions\n";
+	}
+	if (request.check && stats.complete()) {
+		if (result.mismatches.size() == 0)
+			s << "\tAll " << result.expectedWords << " expected words matched\n";
+		for (auto& mismatch : result.mismatches)
+			s << "\tMISMATCH " << mismatch << "\n";
+	}
+	return s.str();
+}
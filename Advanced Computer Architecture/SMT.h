@@ -0,0 +1,341 @@
+#pragma once
+#include "RunRequest.h"
+#include <memory>
+#include <sstream>
+
+//Which thread fetch goes to: each in turn, or the one with the fewest instructions waiting to execute (Tullsen
+//et al.'s ICOUNT), which keeps one stalled thread from filling the reservation stations
+enum class FetchPolicy {
+	RoundRobin, ICount
+};
+
+inline const std::unordered_map<std::string, FetchPolicy> fetchPolicyNames = {
+	{ "roundrobin", FetchPolicy::RoundRobin }, { "icount", FetchPolicy::ICount }
+};
+
+//Simultaneous multithreading: programs run as the hardware threads of one core. Each thread is a CPU of its own,
+//with its own pc, registers, memory, branch predictor, front end and an equal share of the ROB, but they all
+//issue to one set of reservation stations and execution units. Fetch goes to one thread a cycle, picked by the
+//fetch policy, and decode and issue bandwidth is shared, starting from a different thread each cycle. Each
+//thread commits on its own. A thread whose program has finished stops, and its instructions leave the groups
+class SMTCore {
+public:
+	//The cycle each thread's program finished in, or -1 while it runs
+	std::vector<long long> finishedAt;
+	long long cycles = 0;
+
+	bool finished() {
+		for (long long at : finishedAt)
+			if (at == -1)
+				return false;
+		return true;
+	}
+
+	int threadCount() {
+		return int(threads.size());
+	}
+
+	CPU& thread(int index) {
+		return *threads[index];
+	}
+
+	void update() {
+		for (int t = 0; t < threadCount(); t++)
+			if (running(t))
+				threads[t]->commit();
+		execute();
+		size_t issueSlots = threads[0]->issueWidth;
+		size_t decodeSlots = threads[0]->decodeWidth;
+		for (int t : inTurn())
+			issueSlots -= threads[t]->issue(issueSlots);
+		for (int t : inTurn())
+			decodeSlots -= threads[t]->decode(decodeSlots);
+		for (int t : inTurn())
+			threads[t]->predict();
+		for (int t : fetchOrder()) {
+			int before = threads[t]->rob.length();
+			threads[t]->fetch();
+			if (threads[t]->rob.length() > before)
+				break;
+		}
+		for (auto& cpu : threads)
+			cpu->cycle += 1;
+		cycles += 1;
+		firstInTurn = (firstInTurn + 1) % threadCount();
+		for (int t = 0; t < threadCount(); t++) {
+			if (running(t) && threads[t]->finished()) {
+				finishedAt[t] = cycles;
+				for (ExecutionGroup* group : { &units.simpleArithmetic, &units.complexArithmetic, &units.branches, &units.loadStore, &units.vector })
+					group->flushThread(t);
+			}
+		}
+	}
+
+	//One predictor per program, which the core doesn't own. The ROB is split evenly between the threads
+	SMTCore(const std::vector<assembler::CompileResult>& programs, const std::vector<BranchPredictor*>& predictors, FetchPolicy policy) :
+		finishedAt(programs.size(), -1),
+		policy(policy)
+	{
+		if (programs.size() == 0 || programs.size() > 255)
+			throw assembler::ProgramError("SMT needs from 1 to 255 threads, not " + std::to_string(programs.size()));
+		if (GlobalData::reorderBufferSize / int(programs.size()) == 0)
+			throw assembler::ProgramError("A " + std::to_string(GlobalData::reorderBufferSize) + " entry ROB can't be shared between " + std::to_string(programs.size()) + " threads");
+		for (size_t t = 0; t < programs.size(); t++)
+			threads.emplace_back(std::make_unique<CPU>(GlobalData::width, programs[t], predictors[t], &units, int(t), int(programs.size())));
+		for (auto& cpu : threads)
+			contexts.emplace_back(cpu->context);
+	}
+
+private:
+	ExecutionGroups units;
+	std::vector<std::unique_ptr<CPU>> threads;
+	//Indexed by thread, for the units to execute each instruction against its own thread
+	std::vector<ThreadContext> contexts;
+	FetchPolicy policy;
+	int firstInTurn = 0;
+
+	bool running(int t) {
+		return finishedAt[t] == -1;
+	}
+
+	//The running threads, starting with this cycle's first
+	std::vector<int> inTurn() {
+		std::vector<int> order;
+		for (int i = 0; i < threadCount(); i++) {
+			int t = (firstInTurn + i) % threadCount();
+			if (running(t))
+				order.push_back(t);
+		}
+		return order;
+	}
+
+	//Instructions fetched but not yet sent to a unit
+	int waitingInstructions(int t) {
+		CPU& cpu = *threads[t];
+		int count = int(cpu.fetchedInstructions.size() + cpu.decodedInstructions.size());
+		for (ExecutionGroup* group : { &units.simpleArithmetic, &units.complexArithmetic, &units.branches, &units.loadStore, &units.vector })
+			count += group->stationOccupancyOf(t);
+		return count;
+	}
+
+	//Threads in the order fetch offers them the cycle; the first to fetch anything has it
+	std::vector<int> fetchOrder() {
+		std::vector<int> order = inTurn();
+		if (policy == FetchPolicy::ICount) {
+			std::vector<int> counts(threadCount());
+			for (int t : order)
+				counts[t] = waitingInstructions(t);
+			std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return counts[a] < counts[b]; });
+		}
+		return order;
+	}
+
+	//Each group's finished instructions go back to the thread they belong to
+	void execute() {
+		auto s1 = units.simpleArithmetic.update(contexts.data());
+		auto s2 = units.complexArithmetic.update(contexts.data());
+		auto s3 = units.branches.update(contexts.data());
+		auto s4 = units.loadStore.update(contexts.data());
+		auto s5 = units.vector.update(contexts.data());
+		auto finishedValues = s1 + s2 + s3 + s4 + s5;
+		if (finishedValues.size() == 0)
+			return;
+		std::vector<std::vector<PipelineEntry>> byThread(threadCount());
+		for (auto& fVal : finishedValues)
+			byThread[fVal.thread].emplace_back(fVal);
+		for (int t = 0; t < threadCount(); t++)
+			if (byThread[t].size() > 0)
+				threads[t]->complete(byThread[t]);
+	}
+};
+
+//smt program program ... [-config file] [-bp predictor] [-fetch roundrobin|icount] [-max-cycles n] [-check] [-json]
+struct SMTRequest {
+	std::vector<std::string> filenames;
+	std::string configFile = "";
+	std::string predictorName = "Always";
+	FetchPolicy policy = FetchPolicy::ICount;
+	long long maxCycles = 0;
+	bool check = false;
+	bool json = false;
+};
+
+//arguments are as typed, starting with "smt". Returns what was wrong with them, or ""
+inline std::string parseSMTArguments(const std::vector<std::string>& arguments, SMTRequest& request) {
+	for (size_t i = 1; i < arguments.size(); i++) {
+		std::string option = arguments[i].rfind("--", 0) == 0 ? arguments[i].substr(1) : arguments[i];
+		bool hasValue = i + 1 < arguments.size();
+		if (option == "-bp" && hasValue)
+			request.predictorName = arguments[++i];
+		else if (option == "-config" && hasValue)
+			request.configFile = arguments[++i];
+		else if (option == "-fetch" && hasValue) {
+			auto policy = fetchPolicyNames.find(arguments[++i]);
+			if (policy == fetchPolicyNames.end())
+				return "Unknown fetch policy " + arguments[i];
+			request.policy = policy->second;
+		}
+		else if (option == "-max-cycles" && hasValue)
+			request.maxCycles = std::atoll(arguments[++i].c_str());
+		else if (option == "-check")
+			request.check = true;
+		else if (option == "-json")
+			request.json = true;
+		else if (option.size() > 0 && option[0] == '-')
+			return "Unknown option " + arguments[i];
+		else
+			request.filenames.push_back(arguments[i]);
+	}
+	if (request.filenames.size() == 0)
+		return "smt needs at least one program";
+	return "";
+}
+
+struct SMTThreadResult {
+	std::string filename;
+	//cycles is when the thread finished
+	RunStats stats;
+	//The same program with the core to itself
+	long long aloneCycles = 0;
+	long long aloneCommits = 0;
+	std::vector<std::string> mismatches;
+
+	float aloneIPC() {
+		return aloneCycles == 0 ? 0 : float(aloneCommits) / float(aloneCycles);
+	}
+};
+
+struct SMTResult {
+	std::string error = "";
+	long long cycles = 0;
+	bool complete = false;
+	std::vector<SMTThreadResult> threads;
+
+	long long commits() {
+		long long total = 0;
+		for (auto& thread : threads)
+			total += thread.stats.commited;
+		return total;
+	}
+
+	float ipc() {
+		return cycles == 0 ? 0 : float(commits()) / float(cycles);
+	}
+
+	//Each thread's IPC as a fraction of what it gets alone, added up: above 1 when sharing the core beats
+	//running the programs one after another
+	float weightedSpeedup() {
+		float speedup = 0;
+		for (auto& thread : threads)
+			if (thread.aloneIPC() > 0)
+				speedup += thread.stats.ipc() / thread.aloneIPC();
+		return speedup;
+	}
+
+	int status() {
+		if (error != "")
+			return RunError;
+		if (!complete)
+			return RunOutOfBudget;
+		for (auto& thread : threads)
+			if (thread.mismatches.size() > 0)
+				return RunError;
+		return RunOk;
+	}
+};
+
+//Runs the programs together on the hardware GlobalData describes, then each alone for comparison
+inline SMTResult executeSMT(const SMTRequest& request) {
+	SMTResult result;
+	std::vector<assembler::CompileResult> programs;
+	std::vector<std::unique_ptr<BranchPredictor>> predictors;
+	std::vector<BranchPredictor*> threadPredictors;
+	for (auto& filename : request.filenames) {
+		programs.emplace_back(assembler::load(filename, GlobalData::memorySize));
+		predictors.emplace_back(makeBranchPredictor(request.predictorName));
+		if (predictors.back() == nullptr) {
+			result.error = "Unknown branch predictor " + request.predictorName;
+			return result;
+		}
+		threadPredictors.push_back(predictors.back().get());
+	}
+
+	SMTCore core(programs, threadPredictors, request.policy);
+	while (!core.finished() && (request.maxCycles <= 0 || core.cycles < request.maxCycles))
+		core.update();
+	result.cycles = core.cycles;
+	result.complete = core.finished();
+
+	for (int t = 0; t < core.threadCount(); t++) {
+		SMTThreadResult& thread = result.threads.emplace_back();
+		thread.filename = request.filenames[t];
+		collectStats(core.thread(t), thread.stats);
+		thread.stats.cycles = core.finishedAt[t] == -1 ? core.cycles : core.finishedAt[t];
+		if (core.finishedAt[t] == -1)
+			thread.stats.limitReached = "cycle limit";
+		if (request.check && core.finishedAt[t] != -1) {
+			auto expectations = readExpectations(thread.filename);
+			if (expectations.size() == 0)
+				thread.mismatches.push_back(thread.filename + " has no #expect lines to check");
+			else
+				thread.mismatches = checkExpectations(expectations, programs[t].labels, core.thread(t));
+		}
+
+		std::unique_ptr<BranchPredictor> bp(makeBranchPredictor(request.predictorName));
+		CPU alone(GlobalData::width, programs[t], bp.get());
+		SimulationLimits limits;
+		limits.maxCycles = request.maxCycles;
+		RunStats aloneStats = simulate(alone, false, limits);
+		thread.aloneCycles = aloneStats.cycles;
+		thread.aloneCommits = aloneStats.commited;
+	}
+	return result;
+}
+
+inline std::string smtJson(const SMTRequest& request, SMTResult& result) {
+	std::stringstream s;
+	s << "{\"programs\": [";
+	for (size_t i = 0; i < request.filenames.size(); i++)
+		s << (i > 0 ? ", " : "") << "\"" << jsonEscape(request.filenames[i]) << "\"";
+	s << "], ";
+	if (result.error != "") {
+		s << "\"status\": \"error\", \"error\": \"" << jsonEscape(result.error) << "\"}";
+		return s.str();
+	}
+	s << "\"predictor\": \"" << jsonEscape(request.predictorName) << "\", \"status\": \"" << (result.complete ? "finished" : "cycle limit")
+		<< "\", \"cycles\": " << result.cycles << ", \"commits\": " << result.commits() << ", \"ipc\": " << result.ipc()
+		<< ", \"weightedSpeedup\": " << result.weightedSpeedup() << ", \"threads\": [";
+	for (size_t i = 0; i < result.threads.size(); i++) {
+		SMTThreadResult& thread = result.threads[i];
+		s << (i > 0 ? ", " : "") << "{\"program\": \"" << jsonEscape(thread.filename) << "\", \"status\": \"" << thread.stats.status()
+			<< "\", \"cycles\": " << thread.stats.cycles << ", \"commits\": " << thread.stats.commited << ", \"ipc\": " << thread.stats.ipc()
+			<< ", \"flushes\": " << thread.stats.flushes << ", \"robStalls\": " << thread.stats.robStalls << ", \"issueStalls\": " << thread.stats.issueStalls
+			<< ", \"aloneCycles\": " << thread.aloneCycles << ", \"aloneIpc\": " << thread.aloneIPC();
+		if (request.check && thread.stats.complete())
+			s << ", \"mismatches\": " << thread.mismatches.size();
+		s << "}";
+	}
+	s << "]}";
+	return s.str();
+}
+
+inline std::string smtText(const SMTRequest& request, SMTResult& result) {
+	if (result.error != "")
+		return result.error + "\n";
+	std::stringstream s;
+	if (!result.complete)
+		s << "Stopped at the cycle limit: ";
+	s << result.threads.size() << " threads committed " << result.commits() << " instructions in " << result.cycles << " cycles, IPC "
+		<< result.ipc() << "\n";
+	for (auto& thread : result.threads) {
+		s << "\t" << thread.filename << ": " << thread.stats.commited << " instructions " << (thread.stats.complete() ? "finished" : "committed")
+			<< " in " << thread.stats.cycles << " cycles, IPC " << thread.stats.ipc() << "; alone " << thread.aloneCycles << " cycles, IPC "
+			<< thread.aloneIPC() << "\n";
+		if (request.check && thread.stats.complete() && thread.mismatches.size() == 0)
+			s << "\t\tAll expected words matched\n";
+		for (auto& mismatch : thread.mismatches)
+			s << "\t\tMISMATCH " << mismatch << "\n";
+	}
+	s << "\tWeighted speedup " << result.weightedSpeedup() << "\n";
+	return s.str();
+}
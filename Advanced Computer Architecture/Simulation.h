@@ -0,0 +1,72 @@
+#pragma once
+#include "CPU.h"
+#include "ResultCache.h"
+#include "IntervalStats.h"
+#include <chrono>
+
+//Budgets for one run; 0 means unlimited
+struct SimulationLimits {
+	long long maxCycles = 0;
+	double maxSeconds = 0;
+};
+
+//Everything but the cycles and the budget, which whoever clocked the CPU knows
+inline void collectStats(CPU& cpu, RunStats& stats) {
+	stats.commited = cpu.commited;
+	stats.flushes = cpu.flushes;
+	stats.orderingFlushes = cpu.orderingFlushes;
+	stats.robStalls = cpu.robStalls;
+	stats.issueStalls = cpu.issueStalls;
+	stats.frontEndStalls = cpu.frontEndStalls;
+	stats.icacheMisses = cpu.icacheMisses();
+	stats.renameStalls = cpu.renameStalls;
+	stats.decoded = cpu.decoded;
+	stats.fusedPairs = cpu.fusedPairs;
+	stats.valuePredictions = cpu.valuePredictions;
+	stats.valueFlushes = cpu.valueFlushes;
+	stats.halted = cpu.hasHalted();
+}
+
+//Clocks the CPU until its program finishes, or a budget runs out, and gathers what it counted.
+//intervals, if given, is sampled after every cycle. Unless skipIdle is false, stretches of cycles where the
+//machine only waits on execution units are jumped over in one step; the counts come out the same either way.
+//Sampling and debug printing need every cycle, so they turn skipping off
+inline RunStats simulate(CPU& cpu, bool debugPrint = false, SimulationLimits limits = SimulationLimits(), IntervalRecorder* intervals = nullptr, bool skipIdle = true) {
+	RunStats stats;
+	skipIdle = skipIdle && !debugPrint && intervals == nullptr;
+	long long steps = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (!cpu.finished()) {
+		if (limits.maxCycles > 0 && stats.cycles >= limits.maxCycles) {
+			stats.limitReached = "cycle limit";
+			break;
+		}
+		//Reading the clock every cycle would cost more than the cycle
+		if (limits.maxSeconds > 0 && (steps & 0xfff) == 0
+			&& std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= limits.maxSeconds) {
+			stats.limitReached = "time limit";
+			break;
+		}
+		steps += 1;
+		if (skipIdle) {
+			long long quiet = cpu.quietCycles();
+			if (limits.maxCycles > 0)
+				quiet = std::min(quiet, limits.maxCycles - stats.cycles);
+			if (quiet > 0) {
+				cpu.skipQuietCycles(quiet);
+				stats.cycles += quiet;
+				continue;
+			}
+		}
+		stats.cycles += 1;
+		cpu.update();
+		if (intervals != nullptr)
+			intervals->sample(cpu, stats.cycles);
+		if (debugPrint)
+			std::cout << "Cycle " << stats.cycles << std::endl;
+	}
+	if (intervals != nullptr)
+		intervals->finish(cpu, stats.cycles);
+	collectStats(cpu, stats);
+	return stats;
+}
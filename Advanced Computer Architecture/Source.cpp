@@ -1,4 +1,11 @@
-#include "CPU.h"
+#include "Simulation.h"
+#include "Functional.h"
+#include "WorkloadGenerator.h"
+#include "RunRequest.h"
+#include "JobServer.h"
+#include "SMT.h"
+#include "Multicore.h"
+#include "Batch.h"
 
 const char* tab = "\t";
 const char* nothing = "";
@@ -26,51 +33,276 @@ void genericAckermann() {
 	//myCpu.regPrint(nothing);
 }
 
-void runProgram(const std::string& filename, const std::vector<std::string>& arguments) {
-	BranchPredictor* bp = new SimpleBranchPredictor(SimpleBranchPredictor::Mode::Always);
-	std::unordered_map<std::string, BranchPredictor*> bpMap = assembler::MapBuilder<std::string, BranchPredictor*>()
-		("Always", bp)("Never", new SimpleBranchPredictor(SimpleBranchPredictor::Mode::Never))("Forwards", new SimpleBranchPredictor(SimpleBranchPredictor::Mode::AlwaysForwards))
-		("Backwards", new SimpleBranchPredictor(SimpleBranchPredictor::Mode::AlwaysBackwards))
-		("1bit", new OneBitBranchPredictor(8))
-		("2bit", new TwoBitBranchPredictor(8))
-		;
-
-	bool printIPC = false;
-	bool instrumentFlushes = false;
-	bool insrumentClogs = false;
-	bool debugPrint = false;
-
-	for (size_t i = 2; i < arguments.size(); i++) {
-		if (arguments[i] == "-bp") {
-			i++;
-			bp = bpMap.at(arguments[i]);
+//Options may be written -bp or --bp. Returns a RunStatus, which the command line uses as its exit code
+int runProgram(const std::vector<std::string>& arguments) {
+	RunRequest request;
+	std::string problem = parseRunArguments(arguments, request);
+	if (problem != "") {
+		std::cout << problem << std::endl;
+		return RunUsage;
+	}
+	RunResult result;
+	try {
+		//A config given here stays in use, just like the config command
+		if (request.configFile != "" && !GlobalData::loadFrom(request.configFile))
+			result.error = "Could not open config " + request.configFile;
+		else {
+			auto program = assembler::load(request.filename, GlobalData::memorySize);
+			result = executeRun(request, program, GlobalData::current());
+		}
+	}
+	catch (assembler::ProgramError& e) {
+		result.error = e.what();
+	}
+	catch (SimulationError& e) {
+		result.error = e.what();
+	}
+	//Anything else a bad input gets to, so it ends this run rather than the process
+	catch (std::exception& e) {
+		result.error = e.what();
+	}
+	if (request.json)
+		std::cout << runJson(request, result) << "\n";
+	else
+		std::cout << runText(request, result);
+	return result.status();
+}
+
+//smt program program ... [-config file] [-bp predictor] [-fetch roundrobin|icount] [-max-cycles n] [-check] [-json]
+int runSMT(const std::vector<std::string>& arguments) {
+	SMTRequest request;
+	std::string problem = parseSMTArguments(arguments, request);
+	if (problem != "") {
+		std::cout << problem << std::endl;
+		return RunUsage;
+	}
+	SMTResult result;
+	try {
+		if (request.configFile != "" && !GlobalData::loadFrom(request.configFile))
+			result.error = "Could not open config " + request.configFile;
+		else
+			result = executeSMT(request);
+	}
+	catch (assembler::ProgramError& e) {
+		result.error = e.what();
+	}
+	catch (SimulationError& e) {
+		result.error = e.what();
+	}
+	//Anything else a bad input gets to, so it ends this run rather than the process
+	catch (std::exception& e) {
+		result.error = e.what();
+	}
+	if (request.json)
+		std::cout << smtJson(request, result) << "\n";
+	else
+		std::cout << smtText(request, result);
+	return result.status();
+}
+
+//multicore program [-cores n] [-threads n] [-quantum n] [-config file] [-bp predictor] [-max-cycles n] [-check] [-json]
+int runMulticore(const std::vector<std::string>& arguments) {
+	MulticoreRequest request;
+	std::string problem = parseMulticoreArguments(arguments, request);
+	if (problem != "") {
+		std::cout << problem << std::endl;
+		return RunUsage;
+	}
+	MulticoreResult result;
+	try {
+		if (request.configFile != "" && !GlobalData::loadFrom(request.configFile))
+			result.error = "Could not open config " + request.configFile;
+		else
+			result = executeMulticore(request);
+	}
+	catch (assembler::ProgramError& e) {
+		result.error = e.what();
+	}
+	catch (SimulationError& e) {
+		result.error = e.what();
+	}
+	//Anything else a bad input gets to, so it ends this run rather than the process
+	catch (std::exception& e) {
+		result.error = e.what();
+	}
+	if (request.json)
+		std::cout << multicoreJson(request, result) << "\n";
+	else
+		std::cout << multicoreText(request, result);
+	return result.status();
+}
+
+//batch program [inputs] [-instances n] [-lanes n] [-fallback n] [-max-instructions n] [-words label n] [-config file] [-check] [-json]
+int runBatch(const std::vector<std::string>& arguments) {
+	BatchRequest request;
+	std::string problem = parseBatchArguments(arguments, request);
+	if (problem != "") {
+		std::cout << problem << std::endl;
+		return RunUsage;
+	}
+	BatchResult result;
+	try {
+		if (request.configFile != "" && !GlobalData::loadFrom(request.configFile))
+			result.error = "Could not open config " + request.configFile;
+		else
+			result = executeBatch(request);
+	}
+	catch (assembler::ProgramError& e) {
+		result.error = e.what();
+	}
+	catch (SimulationError& e) {
+		result.error = e.what();
+	}
+	//Anything else a bad input gets to, so it ends this run rather than the process
+	catch (std::exception& e) {
+		result.error = e.what();
+	}
+	if (request.json)
+		std::cout << batchJson(request, result) << "\n";
+	else
+		std::cout << batchText(request, result);
+	return result.status();
+}
+
+//Records a trace from a functional run, for replaying under any number of configurations
+bool recordTrace(const std::string& filename, const std::string& traceFile) {
+	assembler::CompileResult program;
+	try {
+		program = assembler::load(filename, GlobalData::memorySize);
+	}
+	catch (assembler::ProgramError& e) {
+		std::cout << e.what() << std::endl;
+		return false;
+	}
+	TraceWriter writer(traceFile, program.instructions.size());
+	FunctionalCPU functional(std::move(program));
+	if (!writer.isOpen()) {
+		printf("Could not open %s\n", traceFile.c_str());
+		return false;
+	}
+	try {
+		functional.run(&writer);
+	}
+	catch (SimulationError& e) {
+		std::cout << e.what() << std::endl;
+		return false;
+	}
+	writer.close();
+	std::cout << "Recorded " << writer.recordCount() << " instructions to " << traceFile << std::endl;
+	return true;
+}
+
+//Assembles once and saves the result, so later runs skip the assembler entirely
+bool assembleProgram(const std::string& filename, const std::string& imageFile) {
+	try {
+		auto program = assembler::compile(filename, GlobalData::memorySize);
+		assembler::writeImage(program, imageFile);
+		std::cout << "Wrote " << program.instructions.size() << " instructions and " << program.dataLength << " words of data to " << imageFile << std::endl;
+		return true;
+	}
+	catch (assembler::ProgramError& e) {
+		std::cout << e.what() << std::endl;
+		return false;
+	}
+}
+
+//generate out.txt [-seed n] [-iterations n] [-chains n] [-chain n] [-complex f] [-branches n] [-taken f]
+//[-predictability f] [-memops n] [-loadratio f] [-stride n] [-workingset n] [-calls n]
+//Returns a RunStatus, RunUsage for an option it doesn't know or one missing its value
+int generateWorkload(const std::vector<std::string>& arguments) {
+	WorkloadParameters p;
+	for (size_t i = 2; i < arguments.size(); i += 2) {
+		const std::string& name = arguments[i];
+		if (i + 1 == arguments.size()) {
+			printf("%s needs a value\n", name.c_str());
+			return RunUsage;
+		}
+		const char* value = arguments[i + 1].c_str();
+		if (name == "-seed")p.seed = std::strtoull(value, nullptr, 10);
+		else if (name == "-iterations")p.iterations = std::atoi(value);
+		else if (name == "-chains")p.chains = std::atoi(value);
+		else if (name == "-chain")p.chainLength = std::atoi(value);
+		else if (name == "-complex")p.complexRatio = std::atof(value);
+		else if (name == "-branches")p.branches = std::atoi(value);
+		else if (name == "-taken")p.takenRate = std::atof(value);
+		else if (name == "-predictability")p.predictability = std::atof(value);
+		else if (name == "-memops")p.memoryOps = std::atoi(value);
+		else if (name == "-loadratio")p.loadRatio = std::atof(value);
+		else if (name == "-stride")p.stride = std::atoi(value);
+		else if (name == "-workingset")p.workingSet = std::atoi(value);
+		else if (name == "-calls")p.callDepth = std::atoi(value);
+		else {
+			printf("Unknown option %s\n", name.c_str());
+			return RunUsage;
 		}
-		else if (arguments[i] == "-ipc")
-			printIPC = true;
-		else if (arguments[i] == "-flushes")
-			instrumentFlushes = true;
-		else if (arguments[i] == "-clogs")
-			insrumentClogs = true;
-		else if (arguments[i] == "-d")
-			debugPrint = true;
-	}
-	CPU myCPU(GlobalData::width, filename, bp);
-	int cycle = 0;
-	while (myCPU(3) != 1) {
-		cycle += 1;
-		myCPU.update();
-		if (debugPrint)
-			std::cout << "Cycle " << cycle << std::endl;
 	}
+	try {
+		WorkloadGenerator(p).write(arguments[1], GlobalData::memorySize);
+		std::cout << "Wrote a workload to " << arguments[1] << std::endl;
+		return RunOk;
+	}
+	catch (assembler::ProgramError& e) {
+		std::cout << e.what() << std::endl;
+		return RunError;
+	}
+}
+
+//serve socket [--workers n] [--config file]
+bool serveJobs(const std::vector<std::string>& arguments) {
+	int workers = std::max(1, int(std::thread::hardware_concurrency()));
+	for (size_t i = 2; i + 1 < arguments.size(); i += 2) {
+		std::string option = arguments[i].rfind("--", 0) == 0 ? arguments[i].substr(1) : arguments[i];
+		if (option == "-workers")
+			workers = std::max(1, std::atoi(arguments[i + 1].c_str()));
+		else if (option == "-config") {
+			if (!GlobalData::loadFrom(arguments[i + 1])) {
+				printf("Could not open config %s\n", arguments[i + 1].c_str());
+				return false;
+			}
+		}
+		else
+			printf("Ignoring unknown option %s\n", arguments[i].c_str());
+	}
+	return JobServer(arguments[1], workers).serve();
+}
 
-	std::cout << myCPU.commited << " instructions finished in " << cycle << " cycles\n";
-	if (printIPC)
-		std::cout << "\tIPC was " << float(myCPU.commited) / float(cycle) << std::endl;
-	if (instrumentFlushes)
-		std::cout << "\tPipeline was flushed " << myCPU.flushes << " times\n";
+//The commands a script can give on the command line, e.g.
+//sim run prog.txt --config powerConfig.txt --bp 2bit --max-cycles 100000 --json
+int commandLine(const std::vector<std::string>& arguments) {
+	const char* usage = "Usage: sim run program [--config file] [--bp predictor] [--max-cycles n] [--max-seconds s] [--json] [--check] [--replay trace]\n"
+		"                   [--interval n stats.csv] [--noskip] [--cache]\n"
+		"       sim smt program program ... [--config file] [--bp predictor] [--fetch roundrobin|icount] [--max-cycles n] [--check] [--json]\n"
+		"       sim multicore program [--cores n] [--threads n] [--quantum n] [--config file] [--bp predictor] [--max-cycles n] [--check] [--json]\n"
+		"       sim batch program [inputs] [--instances n] [--lanes n] [--fallback n] [--max-instructions n] [--words label n] [--config file] [--check] [--json]\n"
+		"       sim trace program trace\n       sim assemble source image\n       sim generate out.txt [-option value ...]\n"
+		"       sim serve socket [--workers n] [--config file]\n       sim submit socket \"run program ...\" [\"run ...\" ...] [shutdown]\n"
+		"With no arguments the simulator reads commands from stdin\n";
+	if (arguments[0] == "run" && arguments.size() >= 2)
+		return runProgram(arguments);
+	if (arguments[0] == "smt" && arguments.size() >= 2)
+		return runSMT(arguments);
+	if (arguments[0] == "multicore" && arguments.size() >= 2)
+		return runMulticore(arguments);
+	if (arguments[0] == "batch" && arguments.size() >= 2)
+		return runBatch(arguments);
+	if (arguments[0] == "trace" && arguments.size() == 3)
+		return recordTrace(arguments[1], arguments[2]) ? RunOk : RunError;
+	if (arguments[0] == "assemble" && arguments.size() == 3)
+		return assembleProgram(arguments[1], arguments[2]) ? RunOk : RunError;
+	if (arguments[0] == "generate" && arguments.size() >= 2)
+		return generateWorkload(arguments);
+	if (arguments[0] == "serve" && arguments.size() >= 2)
+		return serveJobs(arguments) ? RunOk : RunError;
+	if (arguments[0] == "submit" && arguments.size() >= 3)
+		return submitJobs(arguments[1], std::vector<std::string>(arguments.begin() + 2, arguments.end())) ? RunOk : RunError;
+	printf("%s", usage);
+	return RunUsage;
 }
 
-int main() {
+int main(int argc, char** argv) {
+	if (argc > 1)
+		return commandLine(std::vector<std::string>(argv + 1, argv + argc));
+
 	bool running = true;
 	while (running) {
 		std::string userInput;
@@ -81,11 +313,34 @@ int main() {
 		else {
 			auto splits = assembler::splitLine(userInput);
 			if (splits[0] == "config") {
-				GlobalData::loadFrom(splits[1]);
+				try {
+					GlobalData::loadFrom(splits[1]);
+				}
+				catch (assembler::ProgramError& e) {
+					std::cout << e.what() << std::endl;
+				}
 				GlobalData::print();
 			}
 			else if (splits[0] == "run") {
-				runProgram(splits[1], splits);
+				runProgram(splits);
+			}
+			else if (splits[0] == "smt") {
+				runSMT(splits);
+			}
+			else if (splits[0] == "multicore") {
+				runMulticore(splits);
+			}
+			else if (splits[0] == "batch") {
+				runBatch(splits);
+			}
+			else if (splits[0] == "assemble") {
+				assembleProgram(splits[1], splits[2]);
+			}
+			else if (splits[0] == "generate") {
+				generateWorkload(splits);
+			}
+			else if (splits[0] == "trace") {
+				recordTrace(splits[1], splits[2]);
 			}
 			else if (splits[0] == "hardware")
 				GlobalData::print();
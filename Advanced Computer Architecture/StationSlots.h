@@ -0,0 +1,234 @@
+#pragma once
+#include "ExecutionUnit.h"
+#include <cstdint>
+#include <climits>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+//Tags are compared 8 at a time: with AVX2 in one instruction, with SSE2 in two, and otherwise one by one.
+//Arrays are padded to a whole number of blocks with tags no robIndex can match
+namespace tagMatch {
+	const int block = 8;
+	const int32_t emptyTag = INT_MIN;
+
+	inline int paddedLength(int count) {
+		return (count + block - 1) / block * block;
+	}
+
+	//Bit i is set when values[i] == value
+	inline uint32_t equal(const int32_t* values, int32_t value) {
+#if defined(__AVX2__)
+		__m256i compared = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)values), _mm256_set1_epi32(value));
+		return _mm256_movemask_ps(_mm256_castsi256_ps(compared));
+#elif defined(__SSE2__) || defined(_M_X64)
+		__m128i wanted = _mm_set1_epi32(value);
+		__m128i low = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)values), wanted);
+		__m128i high = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(values + 4)), wanted);
+		return _mm_movemask_ps(_mm_castsi128_ps(low)) | (_mm_movemask_ps(_mm_castsi128_ps(high)) << 4);
+#else
+		uint32_t mask = 0;
+		for (int i = 0; i < block; i++)
+			mask |= uint32_t(values[i] == value) << i;
+		return mask;
+#endif
+	}
+
+	//Bit i is set when values[i] < limit
+	inline uint32_t less(const int32_t* values, int32_t limit) {
+#if defined(__AVX2__)
+		__m256i compared = _mm256_cmpgt_epi32(_mm256_set1_epi32(limit), _mm256_loadu_si256((const __m256i*)values));
+		return _mm256_movemask_ps(_mm256_castsi256_ps(compared));
+#elif defined(__SSE2__) || defined(_M_X64)
+		__m128i limits = _mm_set1_epi32(limit);
+		__m128i low = _mm_cmpgt_epi32(limits, _mm_loadu_si128((const __m128i*)values));
+		__m128i high = _mm_cmpgt_epi32(limits, _mm_loadu_si128((const __m128i*)(values + 4)));
+		return _mm_movemask_ps(_mm_castsi128_ps(low)) | (_mm_movemask_ps(_mm_castsi128_ps(high)) << 4);
+#else
+		uint32_t mask = 0;
+		for (int i = 0; i < block; i++)
+			mask |= uint32_t(values[i] < limit) << i;
+		return mask;
+#endif
+	}
+
+	inline int lowestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+}
+
+//The instructions waiting in one reservation station queue, oldest first. What wakeup and select look at
+//(the two source tags, the age, the entry's own ROB index and its select priority) is kept in arrays of its own,
+//so a broadcast or a search for the oldest ready entry compares a block of entries at a time instead of walking
+//whole PipelineEntry objects. A source is ready once its tag is -1, as in PipelineEntry
+class StationSlots {
+public:
+	int size() {
+		return count;
+	}
+
+	void push(const PipelineEntry& entry, int age = 0) {
+		tag1[count] = entry.inputRobIndex1;
+		tag2[count] = entry.inputRobIndex2;
+		value1[count] = entry.sourceValue1;
+		value2[count] = entry.sourceValue2;
+		ages[count] = age;
+		outputs[count] = entry.outputRobIndex;
+		priorities[count] = 0;
+		entries[count] = entry;
+		count += 1;
+	}
+
+	void commonDataBus(word robIndex, word value) {
+		for (int start = 0; start < count; start += tagMatch::block) {
+			for (uint32_t mask = tagMatch::equal(&tag1[start], robIndex); mask != 0; mask &= mask - 1) {
+				int i = start + tagMatch::lowestBit(mask);
+				tag1[i] = -1;
+				value1[i] = value;
+			}
+			for (uint32_t mask = tagMatch::equal(&tag2[start], robIndex); mask != 0; mask &= mask - 1) {
+				int i = start + tagMatch::lowestBit(mask);
+				tag2[i] = -1;
+				value2[i] = value;
+			}
+		}
+	}
+
+	//The oldest entry with both sources ready and an age below ageLimit, or -1
+	int firstReady(int ageLimit = INT_MAX) {
+		for (int start = 0; start < count; start += tagMatch::block) {
+			uint32_t mask = tagMatch::equal(&tag1[start], -1) & tagMatch::equal(&tag2[start], -1);
+			if (ageLimit != INT_MAX)
+				mask &= tagMatch::less(&ages[start], ageLimit);
+			if (mask != 0)
+				return start + tagMatch::lowestBit(mask);
+		}
+		return -1;
+	}
+
+	//The ready entry with the highest priority and an age below ageLimit, the oldest of them on a tie, or -1.
+	//Only entries that have been given a priority cost more than firstReady
+	int bestReady(int ageLimit = INT_MAX) {
+		if (prioritized == 0)
+			return firstReady(ageLimit);
+		int best = -1;
+		for (int start = 0; start < count; start += tagMatch::block) {
+			uint32_t mask = tagMatch::equal(&tag1[start], -1) & tagMatch::equal(&tag2[start], -1);
+			if (ageLimit != INT_MAX)
+				mask &= tagMatch::less(&ages[start], ageLimit);
+			for (; mask != 0; mask &= mask - 1) {
+				int i = start + tagMatch::lowestBit(mask);
+				if (best == -1 || priorities[i] > priorities[best])
+					best = i;
+			}
+		}
+		return best;
+	}
+
+	//Raises the priority of the entry that will write robIndex, if it is waiting here
+	void raisePriority(word robIndex, int priority) {
+		for (int start = 0; start < count; start += tagMatch::block) {
+			uint32_t mask = tagMatch::equal(&outputs[start], robIndex);
+			if (mask != 0) {
+				int i = start + tagMatch::lowestBit(mask);
+				if (priorities[i] == 0 && priority > 0)
+					prioritized += 1;
+				priorities[i] = std::max(priorities[i], priority);
+				return;
+			}
+		}
+	}
+
+	bool isReady(int index) {
+		return tag1[index] == -1 && tag2[index] == -1;
+	}
+
+	//Removes an entry, keeping the rest in age order
+	PipelineEntry take(int index) {
+		PipelineEntry entry = entries[index];
+		entry.inputRobIndex1 = tag1[index];
+		entry.inputRobIndex2 = tag2[index];
+		entry.sourceValue1 = value1[index];
+		entry.sourceValue2 = value2[index];
+		if (priorities[index] > 0)
+			prioritized -= 1;
+		int after = count - index - 1;
+		std::move(&tag1[index + 1], &tag1[index + 1] + after, &tag1[index]);
+		std::move(&tag2[index + 1], &tag2[index + 1] + after, &tag2[index]);
+		std::move(&value1[index + 1], &value1[index + 1] + after, &value1[index]);
+		std::move(&value2[index + 1], &value2[index + 1] + after, &value2[index]);
+		std::move(&ages[index + 1], &ages[index + 1] + after, &ages[index]);
+		std::move(&outputs[index + 1], &outputs[index + 1] + after, &outputs[index]);
+		std::move(&priorities[index + 1], &priorities[index + 1] + after, &priorities[index]);
+		std::move(&entries[index + 1], &entries[index + 1] + after, &entries[index]);
+		count -= 1;
+		tag1[count] = tag2[count] = outputs[count] = tagMatch::emptyTag;
+		return entry;
+	}
+
+	//Removes every entry of one hardware thread
+	void removeThread(int thread) {
+		for (int i = count - 1; i >= 0; i--)
+			if (entries[i].thread == thread)
+				take(i);
+	}
+
+	int countOf(int thread) {
+		int found = 0;
+		for (int i = 0; i < count; i++)
+			found += entries[i].thread == thread;
+		return found;
+	}
+
+	void clear() {
+		std::fill(tag1.begin(), tag1.begin() + count, tagMatch::emptyTag);
+		std::fill(tag2.begin(), tag2.begin() + count, tagMatch::emptyTag);
+		std::fill(outputs.begin(), outputs.begin() + count, tagMatch::emptyTag);
+		count = 0;
+		prioritized = 0;
+	}
+
+	//Everything but the sources is only read here
+	const PipelineEntry& operator[](int index) {
+		return entries[index];
+	}
+
+	int age(int index) {
+		return ages[index];
+	}
+
+	void subtractFromAges(int amount) {
+		for (int i = 0; i < count; i++)
+			ages[i] -= amount;
+	}
+
+	StationSlots(int capacity) :
+		tag1(tagMatch::paddedLength(capacity), tagMatch::emptyTag),
+		tag2(tagMatch::paddedLength(capacity), tagMatch::emptyTag),
+		value1(capacity),
+		value2(capacity),
+		ages(tagMatch::paddedLength(capacity), INT_MAX),
+		outputs(tagMatch::paddedLength(capacity), tagMatch::emptyTag),
+		priorities(capacity),
+		entries(capacity)
+	{}
+
+private:
+	std::vector<int32_t> tag1, tag2;
+	std::vector<word> value1, value2;
+	std::vector<int32_t> ages;
+	std::vector<int32_t> outputs;
+	std::vector<int> priorities;
+	std::vector<PipelineEntry> entries;
+	int count = 0;
+	//Entries with a priority above 0; while there are none, select is just firstReady
+	int prioritized = 0;
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+
+//Store sets (Chrysos and Emer): loads and stores that have been caught out of order are put in the same set,
+//and a load only waits for older stores in its own set. Anything never caught runs as soon as it is ready.
+//Instructions are looked up by address, modulo the size of the table
+class StoreSetPredictor {
+public:
+	//-1 when the instruction at address has never been caught out of order
+	int setOf(int address) {
+		return table[index(address)];
+	}
+
+	//A load read memory before an older store to the same address had written it
+	void violation(int loadAddress, int storeAddress) {
+		int& load = table[index(loadAddress)];
+		int& store = table[index(storeAddress)];
+		if (load == -1 && store == -1)
+			load = store = nextSet++;
+		else if (load == -1)
+			load = store;
+		else if (store == -1)
+			store = load;
+		else
+			load = store = std::min(load, store);
+	}
+
+	void reset() {
+		std::fill(table.begin(), table.end(), -1);
+		nextSet = 0;
+	}
+
+	StoreSetPredictor(int size):
+		table(size, -1)
+	{}
+
+private:
+	std::vector<int> table;
+	int nextSet = 0;
+
+	int index(int address) {
+		return (unsigned)address % table.size();
+	}
+};
@@ -0,0 +1,210 @@
+#pragma once
+#include "riscv.h"
+#include "MappedFile.h"
+#include <cstring>
+
+//One retired instruction of a functional run; everything the timing model can't work out without values
+struct TraceRecord {
+	int pc = 0;
+	bool taken = false;
+	bool hasAddress = false;
+	word address = 0;
+	//Where an rtl returned to, or the value any other instruction but jlr wrote to ra
+	bool hasReturnTarget = false;
+	int returnTarget = 0;
+};
+
+//A trace file is a fixed header followed by one tag byte per record. Anything the tag can't say is
+//appended as a zig-zag varint, delta encoded against the previous record, so straight line code
+//costs a single byte per instruction
+namespace trace {
+	const char magic[8] = { 'A','C','A','T','R','A','C','E' };
+	//Version 2 added what instructions other than jlr write to ra
+	const uint32_t version = 2;
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t instructionCount;
+		uint64_t recordCount;
+	};
+
+	enum Tag : uint8_t {
+		SequentialPC = 1,
+		Taken = 2,
+		Address = 4,
+		ReturnTarget = 8
+	};
+}
+
+class TraceWriter {
+public:
+	void write(const TraceRecord& record) {
+		uint8_t tag = 0;
+		if (record.pc == lastPC + 1)tag |= trace::SequentialPC;
+		if (record.taken)tag |= trace::Taken;
+		if (record.hasAddress)tag |= trace::Address;
+		if (record.hasReturnTarget)tag |= trace::ReturnTarget;
+		buffer.push_back(tag);
+
+		if ((tag & trace::SequentialPC) == 0)
+			writeVarint(record.pc - lastPC);
+		if (record.hasAddress) {
+			writeVarint(record.address - lastAddress);
+			lastAddress = record.address;
+		}
+		if (record.hasReturnTarget)
+			writeVarint(record.returnTarget - record.pc);
+		lastPC = record.pc;
+		records += 1;
+
+		if (buffer.size() >= flushSize)
+			flush();
+	}
+
+	uint64_t recordCount() {
+		return records;
+	}
+
+	//Flushes what is left and fills in the record count
+	void close() {
+		flush();
+		trace::Header header = makeHeader();
+		file.seekp(0);
+		file.write((const char*)&header, sizeof(header));
+		file.close();
+	}
+
+	bool isOpen() {
+		return file.is_open();
+	}
+
+	TraceWriter(const std::string& filename, uint32_t instructionCount):
+		file(filename, std::ios::binary),
+		instructionCount(instructionCount)
+	{
+		buffer.reserve(flushSize + 32);
+		trace::Header header = makeHeader();
+		file.write((const char*)&header, sizeof(header));
+	}
+
+	~TraceWriter() {
+		if (file.is_open())
+			close();
+	}
+
+private:
+	static const size_t flushSize = 1 << 16;
+	std::ofstream file;
+	std::vector<uint8_t> buffer;
+	uint32_t instructionCount;
+	uint64_t records = 0;
+	int lastPC = -1;
+	word lastAddress = 0;
+
+	trace::Header makeHeader() {
+		trace::Header header;
+		memcpy(header.magic, trace::magic, sizeof(header.magic));
+		header.version = trace::version;
+		header.instructionCount = instructionCount;
+		header.recordCount = records;
+		return header;
+	}
+
+	void writeVarint(int64_t value) {
+		uint64_t zigzag = (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+		while (zigzag >= 0x80) {
+			buffer.push_back(uint8_t(zigzag) | 0x80);
+			zigzag >>= 7;
+		}
+		buffer.push_back(uint8_t(zigzag));
+	}
+
+	void flush() {
+		file.write((const char*)buffer.data(), buffer.size());
+		buffer.clear();
+	}
+};
+
+//Streams records straight out of a mapped trace file
+class TraceReader {
+public:
+	bool isValid() {
+		return valid;
+	}
+	uint64_t recordCount() {
+		return header.recordCount;
+	}
+	uint32_t instructionCount() {
+		return header.instructionCount;
+	}
+	bool finished() {
+		return readRecords == header.recordCount;
+	}
+
+	bool next(TraceRecord& record) {
+		if (finished() || cursor >= end)
+			return false;
+		uint8_t tag = uint8_t(*cursor++);
+		record.pc = (tag & trace::SequentialPC) ? lastPC + 1 : lastPC + int(readVarint());
+		record.taken = (tag & trace::Taken) != 0;
+		record.hasAddress = (tag & trace::Address) != 0;
+		if (record.hasAddress) {
+			lastAddress += word(readVarint());
+			record.address = lastAddress;
+		}
+		record.hasReturnTarget = (tag & trace::ReturnTarget) != 0;
+		if (record.hasReturnTarget)
+			record.returnTarget = record.pc + int(readVarint());
+		lastPC = record.pc;
+		readRecords += 1;
+		return true;
+	}
+
+	void rewind() {
+		cursor = file.data() + sizeof(trace::Header);
+		readRecords = 0;
+		lastPC = -1;
+		lastAddress = 0;
+	}
+
+	TraceReader(const std::string& filename):
+		file(filename)
+	{
+		if (!file.isOpen() || file.size() < sizeof(trace::Header)) {
+			printf("Trace %s is bad\n", filename.c_str());
+			return;
+		}
+		memcpy(&header, file.data(), sizeof(header));
+		if (memcmp(header.magic, trace::magic, sizeof(header.magic)) != 0 || header.version != trace::version) {
+			printf("Trace %s is not a version %u trace\n", filename.c_str(), trace::version);
+			return;
+		}
+		end = file.data() + file.size();
+		rewind();
+		valid = true;
+	}
+
+private:
+	MappedFile file;
+	trace::Header header{};
+	const char* cursor = nullptr;
+	const char* end = nullptr;
+	bool valid = false;
+	uint64_t readRecords = 0;
+	int lastPC = -1;
+	word lastAddress = 0;
+
+	int64_t readVarint() {
+		uint64_t zigzag = 0;
+		int shift = 0;
+		while (cursor < end) {
+			uint8_t byte = uint8_t(*cursor++);
+			zigzag |= uint64_t(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+				break;
+			shift += 7;
+		}
+		return int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+	}
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include "riscv.h"
+#include <vector>
+#include <algorithm>
+#include <optional>
+
+//Predicts what a load will read from the values it read before: the last one plus the difference between the
+//last two, which covers loads that always read the same value (a stride of 0) and loads walking an array of
+//evenly spaced values. Loads are looked up by address, modulo the size of the table. Each entry only predicts
+//once its confidence counter has reached threshold; a right value counts up, a wrong one starts it again.
+//Training happens at commit, in program order, so instances of a load still in flight are counted to predict
+//the value each one will read
+class LoadValuePredictor {
+public:
+	static const int maxConfidence = 7;
+	//The value the load at address is expected to read, if its entry is confident enough. Every load fetched
+	//asks, whether or not it is given a prediction, and is counted as in flight until it commits or is flushed
+	std::optional<word> predict(int address) {
+		Entry& entry = table[index(address)];
+		entry.inFlight += 1;
+		if (entry.confidence < threshold)
+			return std::nullopt;
+		return entry.last + entry.stride * entry.inFlight;
+	}
+
+	//The load at address committed, having read value
+	void train(int address, word value) {
+		Entry& entry = table[index(address)];
+		entry.inFlight = std::max(0, entry.inFlight - 1);
+		if (value == entry.last + entry.stride)
+			entry.confidence = std::min(maxConfidence, entry.confidence + 1);
+		else {
+			entry.confidence = 0;
+			entry.stride = value - entry.last;
+		}
+		entry.last = value;
+	}
+
+	//Nothing is in flight any more
+	void flushEverything() {
+		for (Entry& entry : table)
+			entry.inFlight = 0;
+	}
+
+	void reset() {
+		std::fill(table.begin(), table.end(), Entry());
+	}
+
+	LoadValuePredictor(int size, int threshold) :
+		table(size),
+		threshold(threshold)
+	{}
+
+private:
+	struct Entry {
+		word last = 0;
+		word stride = 0;
+		int confidence = 0;
+		int inFlight = 0;
+	};
+	std::vector<Entry> table;
+	int threshold;
+
+	int index(int address) {
+		return (unsigned)address % table.size();
+	}
+};
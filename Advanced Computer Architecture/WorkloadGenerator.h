@@ -0,0 +1,227 @@
+#pragma once
+#include "riscv.h"
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+
+namespace generator {
+	//Each branch cycles through this many recorded outcomes
+	const int outcomeTableLength = 64;
+	//a0-a7, s4-s11 and t3-t6; the rest hold loop state and temporaries
+	inline const std::vector<std::string> chainRegisters = {
+		"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+	};
+
+	//splitmix64, so a seed gives the same program on every host
+	class Random {
+	public:
+		uint64_t next() {
+			uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			return z ^ (z >> 31);
+		}
+		//Uniform in [0, 1)
+		double real() {
+			return double(next() >> 11) * (1.0 / 9007199254740992.0);
+		}
+		int below(int bound) {
+			return int(next() % uint64_t(bound));
+		}
+		bool chance(double probability) {
+			return real() < probability;
+		}
+
+		Random(uint64_t seed):
+			state(seed)
+		{}
+
+	private:
+		uint64_t state;
+	};
+
+	inline int roundDownToPowerOfTwo(int value) {
+		int power = 1;
+		while (power * 2 <= value)
+			power *= 2;
+		return power;
+	}
+}
+
+//Knobs for a generated program. Every iteration of its loop runs `chains` independent dependency chains of
+//`chainLength` operations each, `memoryOps` loads and stores walking a working set, `branches` conditional
+//branches reading their outcomes from a table, and one call `callDepth` functions deep
+struct WorkloadParameters {
+	uint64_t seed = 1;
+	int iterations = 100;
+	//Independent chains are what the out of order core can overlap, so this is the available ILP
+	int chains = 4;
+	int chainLength = 4;
+	//Fraction of chain operations that go to the complex units (mul and div)
+	float complexRatio = 0.1f;
+	int branches = 2;
+	float takenRate = 0.5f;
+	//Chance a branch repeats its last outcome instead of drawing a fresh one, so 1 never changes and 0 is coin flips
+	float predictability = 0.9f;
+	int memoryOps = 4;
+	float loadRatio = 0.75f;
+	int stride = 1;
+	//In words; rounded down to a power of two so the index can wrap with an and
+	int workingSet = 256;
+	int callDepth = 0;
+
+	//Words of data the program needs, which has to fit in the configured memory
+	int dataWords() const {
+		return generator::roundDownToPowerOfTwo(workingSet) + branches * generator::outcomeTableLength + callDepth + 1;
+	}
+};
+
+//Writes a program in the assembler's own dialect. The same parameters always give the same file
+class WorkloadGenerator {
+public:
+	void write(const std::string& filename, int memorySize) {
+		check(memorySize);
+		std::ofstream file(filename);
+		if (!file.is_open())
+			throw assembler::ProgramError("Could not open " + filename + " to write a workload");
+		file << text();
+	}
+
+	std::string text() {
+		std::stringstream s;
+		s << "#Generated workload: seed " << p.seed << " iterations " << p.iterations << " chains " << p.chains << " chain " << p.chainLength
+			<< " complex " << p.complexRatio << " branches " << p.branches << " taken " << p.takenRate << " predictability " << p.predictability
+			<< " memops " << p.memoryOps << " loadratio " << p.loadRatio << " stride " << p.stride << " workingset " << workingSet
+			<< " calls " << p.callDepth << "\n";
+		writeData(s);
+		writeSetup(s);
+		writeLoop(s);
+		writeFunctions(s);
+		return s.str();
+	}
+
+	WorkloadGenerator(WorkloadParameters parameters):
+		p(parameters), random(parameters.seed)
+	{
+		workingSet = generator::roundDownToPowerOfTwo(std::max(p.workingSet, 1));
+	}
+
+private:
+	WorkloadParameters p;
+	generator::Random random;
+	int workingSet;
+	int nextSkip = 0;
+
+	void check(int memorySize) {
+		if (p.iterations < 1 || p.chains < 1 || p.chainLength < 0 || p.branches < 0 || p.memoryOps < 0 || p.callDepth < 0)
+			throw assembler::ProgramError("Workload counts can't be negative, and it needs at least one iteration and chain");
+		if (p.chains > (int)generator::chainRegisters.size())
+			throw assembler::ProgramError("At most " + std::to_string(generator::chainRegisters.size()) + " chains fit in the registers");
+		if (p.dataWords() > memorySize)
+			throw assembler::ProgramError("The workload needs " + std::to_string(p.dataWords()) + " words of data but only " + std::to_string(memorySize) + " are configured");
+	}
+
+	void writeData(std::stringstream& s) {
+		s << ".data ws";
+		for (int i = 0; i < workingSet; i++)
+			s << " " << random.below(100);
+		s << "\n";
+
+		//Outcomes follow a two state chain: repeat the last one with probability predictability, otherwise
+		//draw taken with probability takenRate. Either way a branch is taken takenRate of the time overall
+		for (int b = 0; b < p.branches; b++) {
+			s << ".data outcomes" << b;
+			bool taken = random.chance(p.takenRate);
+			for (int i = 0; i < generator::outcomeTableLength; i++) {
+				if (!random.chance(p.predictability))
+					taken = random.chance(p.takenRate);
+				s << (taken ? " 1" : " 0");
+			}
+			s << "\n";
+		}
+
+		s << ".data stack";
+		for (int i = 0; i < p.callDepth; i++)
+			s << " 0";
+		s << "\n.data stackTop 0\n\n";
+	}
+
+	void writeSetup(std::stringstream& s) {
+		s << "addi stackPointer zero stackTop\n";
+		s << "#s0 counts iterations up to s1, s2 walks the working set, s3 walks the outcome tables\n";
+		s << "addi s0 zero 0\naddi s1 zero " << p.iterations << "\naddi s2 zero 0\naddi s3 zero 0\n";
+		s << "#t2 stays 1 so mul and div keep chain values bounded\naddi t2 zero 1\n";
+		for (int c = 0; c < p.chains; c++)
+			s << "addi " << generator::chainRegisters[c] << " zero " << c + 1 << "\n";
+		s << "\n";
+	}
+
+	std::string chainOperation(const std::string& r) {
+		if (random.chance(p.complexRatio))
+			return (random.below(2) == 0 ? "mul " : "div ") + r + " " + r + " t2";
+		switch (random.below(4)) {
+		case 0:
+			return "addi " + r + " " + r + " " + std::to_string(random.below(16) + 1);
+		case 1:
+			return "xori " + r + " " + r + " " + std::to_string(random.below(256));
+		case 2:
+			return "add " + r + " " + r + " t2";
+		default:
+			return "sub " + r + " " + r + " t2";
+		}
+	}
+
+	//A load feeds one chain, a store saves one; either way the index moves on by the stride
+	std::string memoryOperation() {
+		const std::string& r = generator::chainRegisters[random.below(p.chains)];
+		std::string s;
+		if (random.chance(p.loadRatio))
+			s = "lda t0 s2 ws\nadd " + r + " " + r + " t0\n";
+		else
+			s = "sta ws s2 " + r + "\n";
+		return s + "addi s2 s2 " + std::to_string(p.stride) + "\nandi s2 s2 " + std::to_string(workingSet - 1) + "\n";
+	}
+
+	//Taken skips the filler instruction after the branch
+	std::string branch(int index) {
+		std::string label = "skip" + std::to_string(nextSkip++);
+		return "lda t1 s3 outcomes" + std::to_string(index) + "\nbne " + label + " t1 zero\naddi tp tp 1\n.label " + label + "\n";
+	}
+
+	void writeLoop(std::stringstream& s) {
+		//Chains are interleaved round robin, then memory operations and branches are dropped in at random places
+		std::vector<std::string> body;
+		for (int step = 0; step < p.chainLength; step++)
+			for (int c = 0; c < p.chains; c++)
+				body.emplace_back(chainOperation(generator::chainRegisters[c]) + "\n");
+		for (int m = 0; m < p.memoryOps; m++)
+			body.insert(body.begin() + random.below(int(body.size()) + 1), memoryOperation());
+		for (int b = 0; b < p.branches; b++)
+			body.insert(body.begin() + random.below(int(body.size()) + 1), branch(b));
+
+		s << ".label loop\n";
+		for (auto& line : body)
+			s << line;
+		if (p.branches > 0)
+			s << "addi s3 s3 1\nandi s3 s3 " << generator::outcomeTableLength - 1 << "\n";
+		if (p.callDepth > 0)
+			s << "jlr call1\n";
+		s << "addi s0 s0 1\nbne loop s0 s1\n\n";
+		s << "addi globalPointer zero 1\n.label forever\njmp forever\n\n";
+	}
+
+	//Every level but the last saves ra on the stack around the next call
+	void writeFunctions(std::stringstream& s) {
+		for (int depth = 1; depth <= p.callDepth; depth++) {
+			s << ".label call" << depth << "\n";
+			if (depth < p.callDepth) {
+				s << "addi stackPointer stackPointer -1\nsta 0 stackPointer returnAddress\n";
+				s << "jlr call" << depth + 1 << "\n";
+				s << "lda returnAddress stackPointer 0\naddi stackPointer stackPointer 1\n";
+			}
+			else
+				s << "addi tp tp 1\n";
+			s << "rtl\n";
+		}
+	}
+};
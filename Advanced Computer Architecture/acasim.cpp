@@ -0,0 +1,172 @@
+#define ACASIM_BUILDING
+#include "acasim.h"
+#include "Simulation.h"
+#include <memory>
+
+//GlobalData is shared by the whole process, so each simulator keeps its own settings and only puts them in
+//place (GlobalData::with) while it builds a CPU. A built CPU never looks at GlobalData again
+struct acasim_simulator {
+	GlobalData::Settings settings = GlobalData::current();
+	std::string predictorName = "Always";
+	std::string builtPredictorName = "";
+	std::unique_ptr<BranchPredictor> predictor;
+	//Kept so reset can start the program again
+	assembler::CompileResult program;
+	bool loaded = false;
+	std::unique_ptr<CPU> cpu;
+	long long cycles = 0;
+	std::string error = "";
+
+	int fail(const std::string& message) {
+		error = message;
+		return -1;
+	}
+
+	void build() {
+		GlobalData::with(settings, [&]() {
+			predictor.reset(makeBranchPredictor(predictorName));
+			cpu = std::make_unique<CPU>(settings.width, program, predictor.get());
+			builtPredictorName = predictorName;
+		});
+	}
+};
+
+//Model errors are thrown as ProgramError or SimulationError; nothing at all may cross the C boundary
+template<class Action>
+static int guarded(acasim_simulator* simulator, Action action) {
+	try {
+		simulator->error = "";
+		return action();
+	}
+	catch (std::exception& e) {
+		return simulator->fail(e.what());
+	}
+	catch (...) {
+		return simulator->fail("The simulator stopped on an internal error");
+	}
+}
+
+acasim_simulator* acasim_create(const char* configFile) {
+	auto simulator = std::make_unique<acasim_simulator>();
+	bool loaded = true;
+	try {
+		if (configFile != nullptr)
+			loaded = GlobalData::loadInto(configFile, simulator->settings);
+	}
+	catch (...) {
+		loaded = false;
+	}
+	return loaded ? simulator.release() : nullptr;
+}
+
+void acasim_destroy(acasim_simulator* simulator) {
+	delete simulator;
+}
+
+int acasim_set_predictor(acasim_simulator* simulator, const char* name) {
+	std::unique_ptr<BranchPredictor> check(makeBranchPredictor(name));
+	if (check == nullptr)
+		return simulator->fail("Unknown branch predictor " + std::string(name));
+	simulator->predictorName = name;
+	simulator->error = "";
+	return 0;
+}
+
+int acasim_load_program(acasim_simulator* simulator, const char* filename) {
+	return guarded(simulator, [&]() {
+		simulator->cpu.reset();
+		simulator->loaded = false;
+		simulator->program = assembler::load(filename, simulator->settings.memorySize);
+		simulator->loaded = true;
+		simulator->build();
+		simulator->cycles = 0;
+		return 0;
+	});
+}
+
+int acasim_reset(acasim_simulator* simulator) {
+	if (!simulator->loaded)
+		return simulator->fail("No program is loaded");
+	return guarded(simulator, [&]() {
+		//A different predictor means a different object, so only then is the CPU built again
+		if (simulator->cpu == nullptr || simulator->builtPredictorName != simulator->predictorName)
+			simulator->build();
+		else
+			simulator->cpu->reset(simulator->program);
+		simulator->cycles = 0;
+		return 0;
+	});
+}
+
+long long acasim_step(acasim_simulator* simulator, long long cycles) {
+	if (simulator->cpu == nullptr) {
+		simulator->fail("No program is loaded");
+		return -1;
+	}
+	long long run = 0;
+	int status = guarded(simulator, [&]() {
+		CPU& cpu = *simulator->cpu;
+		while (run < cycles && !cpu.finished()) {
+			//Cycles where only execution units progress are done in one go
+			long long quiet = std::min(cpu.quietCycles(), cycles - run);
+			if (quiet > 0) {
+				cpu.skipQuietCycles(quiet);
+				run += quiet;
+				continue;
+			}
+			cpu.update();
+			run += 1;
+		}
+		return 0;
+	});
+	simulator->cycles += run;
+	if (status != 0) {
+		//Whatever went wrong left the pipeline in no state to carry on from
+		simulator->cpu.reset();
+		return -1;
+	}
+	return run;
+}
+
+int acasim_counters_get(acasim_simulator* simulator, acasim_counters* counters) {
+	if (simulator->cpu == nullptr)
+		return simulator->fail("No program is loaded");
+	CPU& cpu = *simulator->cpu;
+	counters->cycles = simulator->cycles;
+	counters->commits = cpu.commited;
+	counters->flushes = cpu.flushes;
+	counters->robStalls = cpu.robStalls;
+	counters->issueStalls = cpu.issueStalls;
+	counters->finished = cpu.finished() ? 1 : 0;
+	counters->halted = cpu.hasHalted() ? 1 : 0;
+	return 0;
+}
+
+int acasim_read_register(acasim_simulator* simulator, int index, int32_t* value) {
+	if (simulator->cpu == nullptr)
+		return simulator->fail("No program is loaded");
+	if (index < 0 || index >= 32)
+		return simulator->fail("There is no register " + std::to_string(index));
+	*value = (*simulator->cpu)(index);
+	return 0;
+}
+
+int acasim_read_memory(acasim_simulator* simulator, int address, int32_t* value) {
+	if (simulator->cpu == nullptr)
+		return simulator->fail("No program is loaded");
+	if (address < 0 || address >= (int)simulator->program.memory.size())
+		return simulator->fail("Address " + std::to_string(address) + " is outside memory");
+	*value = (*simulator->cpu)[address];
+	return 0;
+}
+
+int acasim_label_address(acasim_simulator* simulator, const char* label) {
+	auto found = simulator->program.labels.find(label);
+	if (found == simulator->program.labels.end())
+		return simulator->fail("No label named " + std::string(label));
+	return found->second;
+}
+
+const char* acasim_last_error(acasim_simulator* simulator) {
+	return simulator->error.c_str();
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+
+//The simulator as a library, callable from C or anything with a C FFI.
+//A simulator is built from a config file, loads a program (source or image) and is clocked a number of cycles
+//at a time. Reset puts the loaded program back to its start on the same allocation, so many short runs don't
+//pay for building a new CPU. Functions returning int give 0 on success and -1 on failure, with the reason in
+//acasim_last_error. A simulator must only be used by one thread at a time; different simulators are independent
+
+#if defined(_WIN32)
+#if defined(ACASIM_BUILDING)
+#define ACASIM_API __declspec(dllexport)
+#else
+#define ACASIM_API __declspec(dllimport)
+#endif
+#else
+#define ACASIM_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct acasim_simulator acasim_simulator;
+
+typedef struct acasim_counters {
+	long long cycles;
+	long long commits;
+	long long flushes;
+	long long robStalls;
+	long long issueStalls;
+	//1 once the program has set the global pointer or executed halt
+	int finished;
+	int halted;
+} acasim_counters;
+
+//configFile is in the same format as the REPL's config command; NULL keeps the default hardware.
+//Returns NULL if the file can't be read
+ACASIM_API acasim_simulator* acasim_create(const char* configFile);
+ACASIM_API void acasim_destroy(acasim_simulator* simulator);
+
+//Always, Never, Forwards, Backwards, 1bit or 2bit. Takes effect at the next load or reset
+ACASIM_API int acasim_set_predictor(acasim_simulator* simulator, const char* name);
+ACASIM_API int acasim_load_program(acasim_simulator* simulator, const char* filename);
+ACASIM_API int acasim_reset(acasim_simulator* simulator);
+
+//Clocks up to cycles cycles, stopping early if the program finishes. Returns the cycles run, or -1 with no program
+ACASIM_API long long acasim_step(acasim_simulator* simulator, long long cycles);
+
+ACASIM_API int acasim_counters_get(acasim_simulator* simulator, acasim_counters* counters);
+ACASIM_API int acasim_read_register(acasim_simulator* simulator, int index, int32_t* value);
+ACASIM_API int acasim_read_memory(acasim_simulator* simulator, int address, int32_t* value);
+//-1 if the program has no such label
+ACASIM_API int acasim_label_address(acasim_simulator* simulator, const char* label);
+
+//Never NULL; empty when nothing has gone wrong. Valid until the next call on the simulator
+ACASIM_API const char* acasim_last_error(acasim_simulator* simulator);
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,16 +2,77 @@
 
 #include "riscv.h"
 #include <iostream>
+#include <mutex>
+
+//How a reservation station picks among its ready instructions, set by an optional fifth word on a unit's config line.
+//oldest takes the first ready entry, which is the oldest as instructions issue in order. The others put first an
+//instruction that something already issued is waiting on: critical by the latency of the slowest such consumer,
+//branchload if a branch or a load is among them. Ties still go to the oldest
+enum class SelectPolicy {
+	Oldest, Critical, BranchLoad
+};
+
+//Widths and latch depths of 0 follow width. Every other part left at 0 is not modelled, which gives the
+//original front end: any instruction can be fetched the cycle it is wanted, straight on past taken branches
+struct FrontEndData {
+	int fetchWidth = 0, decodeWidth = 0, issueWidth = 0, commitWidth = 0;
+	//Instructions the fetch to decode and decode to issue latches hold
+	int fetchLatch = 0, decodeLatch = 0;
+	//Instructions in an aligned fetch block. Fetch stops at the end of a block and after a taken branch
+	int fetchBlock = 0;
+	//Cycles fetch loses after a taken branch or jump
+	int takenBubble = 0;
+	//Fetch targets the branch predictor may run ahead of fetch by; 0 predicts branches as they are fetched
+	int targetQueue = 0;
+	//I-cache sets, ways, instructions a line and cycles to fill a line; 0 sets is a perfect cache
+	int icacheSets = 0, icacheWays = 2, icacheLine = 8, icacheMiss = 10;
+
+	bool operator==(const FrontEndData&) const = default;
+};
+
+//Each core's data cache when several share memory (Multicore.h): sets, ways, words a line, and the cycles a miss
+//takes to be served over the bus. A single CPU has memory to itself and doesn't model one
+struct DataCacheData {
+	int sets = 64, ways = 4, line = 8, missCycles = 20;
+
+	bool operator==(const DataCacheData&) const = default;
+};
+
+//The vector extension: words in each vector register, and words a unit works through a cycle. A vector
+//instruction takes a cycle more than its unit's latency for every further lanes words
+struct VectorData {
+	int length = 8, lanes = 4;
+
+	int extraCycles() const {
+		return (length + lanes - 1) / lanes - 1;
+	}
+
+	bool operator==(const VectorData&) const = default;
+};
 
 class GlobalData {
 public:
+	inline static const std::unordered_map<std::string, SelectPolicy> selectPolicyNames = assembler::MapBuilder<std::string, SelectPolicy>()
+		("oldest", SelectPolicy::Oldest)("critical", SelectPolicy::Critical)("branchload", SelectPolicy::BranchLoad)
+		;
+
+	static std::string nameOf(SelectPolicy policy) {
+		for (auto& named : selectPolicyNames)
+			if (named.second == policy)
+				return named.first;
+		return "";
+	}
+
 	struct EUData {
 		int numberOfUnits;
 		int sizeOfReservations;
 		int cyclesNeeded;
+		SelectPolicy policy = SelectPolicy::Oldest;
 
 		void print() {
 			std::cout << "\t\t" << numberOfUnits << " units\n\t\t" << sizeOfReservations << " reservation spaces\n\t\t" << cyclesNeeded << " cycles to execute\n";
+			if (policy != SelectPolicy::Oldest)
+				std::cout << "\t\t" << nameOf(policy) << " select policy\n";
 		}
 
 		EUData(int numberOfUnits, int sizeOfReservations, int cyclesNeeded):
@@ -20,41 +81,279 @@ public:
 			cyclesNeeded(cyclesNeeded)
 		{}
 	};
-	static EUData simpleInteger;
-	static EUData complexInteger;
-	static EUData branchUnits;
-	static EUData loadStoreUnits;
-	static int memorySize;
-	static int reorderBufferSize;
-	static int width;
+	inline static EUData simpleInteger = EUData(1, 2, 1);
+	inline static EUData complexInteger = EUData(1, 2, 4);
+	inline static EUData branchUnits = EUData(1, 2, 2);
+	inline static EUData loadStoreUnits = EUData(1, 2, 3);
+	inline static EUData vectorUnits = EUData(1, 2, 1);
+	inline static int memorySize = 2048;
+	inline static int reorderBufferSize = 32;
+	inline static int width = 1;
+	//Entries in the store set table that lets loads run ahead of older stores; 0 keeps loads behind them
+	inline static int storeSetSize = 0;
+	//Physical registers, the 32 committed ones included, that results are renamed to; 0 leaves in flight results
+	//in the ROB, bounded only by its size
+	inline static int physicalRegisters = 0;
+	//Adjacent instruction pairs decode fuses into one reservation station entry, from `fuse first second` lines
+	inline static std::vector<std::pair<Opcode, Opcode>> fusedPairs;
+	//Entries in the table predicting what loads read, and the confidence (1 to 7) an entry needs before its
+	//predictions are used; 0 entries predicts nothing
+	inline static int loadValueSize = 0;
+	inline static int loadValueConfidence = 4;
+
+	inline static FrontEndData frontEnd;
+	inline static DataCacheData dataCache;
+	inline static VectorData vector;
+
+	//The front end settings that take one number, in the order describe writes them
+	inline static const std::vector<std::pair<std::string, int FrontEndData::*>> frontEndNames = {
+		{ "fetchWidth", &FrontEndData::fetchWidth }, { "decodeWidth", &FrontEndData::decodeWidth }, { "issueWidth", &FrontEndData::issueWidth },
+		{ "commitWidth", &FrontEndData::commitWidth }, { "fetchLatch", &FrontEndData::fetchLatch }, { "decodeLatch", &FrontEndData::decodeLatch },
+		{ "fetchBlock", &FrontEndData::fetchBlock }, { "takenBubble", &FrontEndData::takenBubble }, { "targetQueue", &FrontEndData::targetQueue }
+	};
+	inline static const std::unordered_map<std::string, int FrontEndData::*> frontEndNameMap = { frontEndNames.begin(), frontEndNames.end() };
+
+	inline static const std::unordered_map<std::string, EUData*> euNameMap = assembler::MapBuilder<std::string, EUData*>()
+		("alu", &simpleInteger)("calu", &complexInteger)("bu", &branchUnits)("lsu", &loadStoreUnits)("vu", &vectorUnits)
+		;
+
+	//Every setting at once, so one configuration can be put aside while another is in use
+	struct Settings {
+		EUData simpleInteger, complexInteger, branchUnits, loadStoreUnits, vectorUnits;
+		int memorySize, reorderBufferSize, width, storeSetSize;
+		FrontEndData frontEnd;
+		int physicalRegisters;
+		std::vector<std::pair<Opcode, Opcode>> fusedPairs;
+		int loadValueSize, loadValueConfidence;
+		DataCacheData dataCache;
+		VectorData vector;
+	};
 
-	static const std::unordered_map<std::string, EUData*> euNameMap;
+	static Settings current() {
+		return Settings{ simpleInteger, complexInteger, branchUnits, loadStoreUnits, vectorUnits, memorySize, reorderBufferSize, width, storeSetSize, frontEnd,
+			physicalRegisters, fusedPairs, loadValueSize, loadValueConfidence, dataCache, vector };
+	}
 
-	static void loadFrom(const std::string& filename) {
+	static void apply(const Settings& settings) {
+		simpleInteger = settings.simpleInteger;
+		complexInteger = settings.complexInteger;
+		branchUnits = settings.branchUnits;
+		loadStoreUnits = settings.loadStoreUnits;
+		vectorUnits = settings.vectorUnits;
+		memorySize = settings.memorySize;
+		reorderBufferSize = settings.reorderBufferSize;
+		width = settings.width;
+		storeSetSize = settings.storeSetSize;
+		frontEnd = settings.frontEnd;
+		physicalRegisters = settings.physicalRegisters;
+		fusedPairs = settings.fusedPairs;
+		loadValueSize = settings.loadValueSize;
+		loadValueConfidence = settings.loadValueConfidence;
+		dataCache = settings.dataCache;
+		vector = settings.vector;
+	}
+
+	//Runs action with settings in place, then puts back whatever was there before. Anything built inside
+	//(a CPU, a cache key) sees settings, and other threads doing the same never see each other's
+	template<class Action>
+	static void with(const Settings& settings, Action action) {
+		std::lock_guard<std::mutex> lock(settingsLock);
+		Settings saved = current();
+		apply(settings);
+		try {
+			action();
+		}
+		catch (...) {
+			apply(saved);
+			throw;
+		}
+		apply(saved);
+	}
+
+	//Reads a config file on top of settings instead of on top of what is in use
+	static bool loadInto(const std::string& filename, Settings& settings) {
+		bool loaded = false;
+		with(settings, [&]() {
+			loaded = loadFrom(filename);
+			settings = current();
+		});
+		return loaded;
+	}
+
+	//The pair has to run on one unit, so one half must be simple arithmetic. Jumps are resolved as they are fetched
+	//and a load's value can still change by store forwarding after it executes, so neither can come first. Atomics
+	//and fences hold up fetch on their own, and vector instructions carry vector registers rather than values
+	static std::pair<Opcode, Opcode> fusedPair(const std::string& first, const std::string& second, const std::string& filename) {
+		auto firstOp = assembler::opMappings.find(first);
+		auto secondOp = assembler::opMappings.find(second);
+		if (firstOp == assembler::opMappings.end() || secondOp == assembler::opMappings.end())
+			throw assembler::ProgramError("fuse " + first + " " + second + " in " + filename + " names an unknown instruction");
+		for (Opcode op : { firstOp->second, secondOp->second })
+			if (groups::jump.count(op) > 0 || groups::atomics.count(op) > 0 || op == Fence || op == Halt || isVector(op))
+				throw assembler::ProgramError("fuse " + first + " " + second + " in " + filename + ": jumps, atomics, fences, halt and vector instructions can't be fused");
+		if (groups::conditionalBranches.count(firstOp->second) > 0 || groups::loads.count(firstOp->second) > 0)
+			throw assembler::ProgramError("fuse " + first + " " + second + " in " + filename + ": a branch or a load can only come second");
+		if (groups::simpleArithmetic.count(firstOp->second) == 0 && groups::simpleArithmetic.count(secondOp->second) == 0)
+			throw assembler::ProgramError("fuse " + first + " " + second + " in " + filename + ": one of the pair must be simple arithmetic");
+		return { firstOp->second, secondOp->second };
+	}
+
+	static std::string nameOf(Opcode op) {
+		for (auto& named : assembler::opMappings)
+			if (named.second == op)
+				return named.first;
+		return "";
+	}
+
+	//False if the file couldn't be opened, in which case nothing changes. A line it can't make sense of is a ProgramError
+	static bool loadFrom(const std::string& filename) {
 		std::string line = "";
 		std::ifstream file(filename);
+		if (!file.is_open())
+			return false;
 		while (std::getline(file, line)) {
 			if (line.size() == 0)continue;
 			if (line[0] == '#')continue;
 			auto splits = assembler::splitLine(line);
+			if (splits.size() < 2)
+				throw assembler::ProgramError(splits[0] + " in " + filename + " needs a value");
 			if (splits[0] == "memory")
 				memorySize = std::atoi(splits[1].c_str());
 			else if (splits[0] == "robSize")
 				reorderBufferSize = std::atoi(splits[1].c_str());
 			else if (splits[0] == "width")
 				width = std::atoi(splits[1].c_str());
+			else if (splits[0] == "storeSets")
+				storeSetSize = std::atoi(splits[1].c_str());
+			else if (splits[0] == "fuse") {
+				if (splits.size() < 3)
+					throw assembler::ProgramError("fuse needs two instructions, in " + filename);
+				auto pair = fusedPair(splits[1], splits[2], filename);
+				if (std::find(fusedPairs.begin(), fusedPairs.end(), pair) == fusedPairs.end())
+					fusedPairs.push_back(pair);
+			}
+			else if (splits[0] == "prf") {
+				int registers = std::atoi(splits[1].c_str());
+				if (registers != 0 && registers <= 32)
+					throw assembler::ProgramError("prf " + splits[1] + " in " + filename + " leaves no registers to rename to; it needs more than 32");
+				physicalRegisters = registers;
+			}
+			else if (splits[0] == "loadValues") {
+				loadValueSize = std::atoi(splits[1].c_str());
+				loadValueConfidence = splits.size() > 2 ? std::atoi(splits[2].c_str()) : 4;
+				if (loadValueConfidence < 1 || loadValueConfidence > 7)
+					throw assembler::ProgramError("loadValues in " + filename + " needs a confidence from 1 to 7, not " + splits[2]);
+			}
+			else if (frontEndNameMap.count(splits[0]) > 0)
+				frontEnd.*frontEndNameMap.at(splits[0]) = std::atoi(splits[1].c_str());
+			else if (splits[0] == "icache") {
+				if (splits.size() < 5)
+					throw assembler::ProgramError("icache in " + filename + " needs sets, ways, instructions a line and cycles a miss");
+				frontEnd.icacheSets = std::atoi(splits[1].c_str());
+				frontEnd.icacheWays = std::atoi(splits[2].c_str());
+				frontEnd.icacheLine = std::atoi(splits[3].c_str());
+				frontEnd.icacheMiss = std::atoi(splits[4].c_str());
+				//0 sets is the perfect cache, as when there is no icache line at all
+				if (frontEnd.icacheSets < 0 || frontEnd.icacheWays < 1 || frontEnd.icacheLine < 1 || frontEnd.icacheMiss < 1)
+					throw assembler::ProgramError("icache in " + filename + " needs at least one way, instruction and cycle");
+			}
+			else if (splits[0] == "dcache" && splits.size() >= 5) {
+				dataCache.sets = std::atoi(splits[1].c_str());
+				dataCache.ways = std::atoi(splits[2].c_str());
+				dataCache.line = std::atoi(splits[3].c_str());
+				dataCache.missCycles = std::atoi(splits[4].c_str());
+				if (dataCache.sets < 1 || dataCache.ways < 1 || dataCache.line < 1 || dataCache.missCycles < 1)
+					throw assembler::ProgramError("dcache in " + filename + " needs at least one set, way, word and cycle");
+			}
+			else if (splits[0] == "vector" && splits.size() >= 3) {
+				vector.length = std::atoi(splits[1].c_str());
+				vector.lanes = std::atoi(splits[2].c_str());
+				if (vector.length < 1 || vector.length > 64 || vector.lanes < 1)
+					throw assembler::ProgramError("vector in " + filename + " needs a length from 1 to 64 words and at least one lane");
+			}
 			else {
-				EUData* target = euNameMap.at(splits[0]);
+				auto found = euNameMap.find(splits[0]);
+				if (found == euNameMap.end())
+					throw assembler::ProgramError("Unknown setting " + splits[0] + " in " + filename);
+				if (splits.size() < 4)
+					throw assembler::ProgramError(splits[0] + " in " + filename + " needs units, stations and cycles");
+				EUData* target = found->second;
 				target->numberOfUnits = std::atoi(splits[1].c_str());
 				target->sizeOfReservations = std::atoi(splits[2].c_str());
 				target->cyclesNeeded = std::atoi(splits[3].c_str());
+				target->policy = SelectPolicy::Oldest;
+				if (splits.size() > 4) {
+					auto policy = selectPolicyNames.find(splits[4]);
+					if (policy == selectPolicyNames.end())
+						throw assembler::ProgramError("Unknown select policy " + splits[4] + " in " + filename);
+					target->policy = policy->second;
+				}
 			}
 		}
+		return true;
+	}
+
+	//Every setting in config file form; two runs with the same description model the same hardware
+	static std::string describe() {
+		std::string s = "";
+		s += "memory " + std::to_string(memorySize) + "\n";
+		s += "robSize " + std::to_string(reorderBufferSize) + "\n";
+		s += "width " + std::to_string(width) + "\n";
+		s += "storeSets " + std::to_string(storeSetSize) + "\n";
+		if (physicalRegisters > 0)
+			s += "prf " + std::to_string(physicalRegisters) + "\n";
+		for (auto& pair : fusedPairs)
+			s += "fuse " + nameOf(pair.first) + " " + nameOf(pair.second) + "\n";
+		if (loadValueSize > 0)
+			s += "loadValues " + std::to_string(loadValueSize) + " " + std::to_string(loadValueConfidence) + "\n";
+		//Only what differs from the original front end
+		for (auto& named : frontEndNames)
+			if (frontEnd.*named.second != 0)
+				s += named.first + " " + std::to_string(frontEnd.*named.second) + "\n";
+		if (frontEnd.icacheSets > 0)
+			s += "icache " + std::to_string(frontEnd.icacheSets) + " " + std::to_string(frontEnd.icacheWays) + " " + std::to_string(frontEnd.icacheLine) + " " + std::to_string(frontEnd.icacheMiss) + "\n";
+		if (!(dataCache == DataCacheData()))
+			s += "dcache " + std::to_string(dataCache.sets) + " " + std::to_string(dataCache.ways) + " " + std::to_string(dataCache.line) + " " + std::to_string(dataCache.missCycles) + "\n";
+		if (!(vector == VectorData()))
+			s += "vector " + std::to_string(vector.length) + " " + std::to_string(vector.lanes) + "\n";
+		//vu likewise only once it isn't the default
+		bool defaultVectorUnits = vectorUnits.numberOfUnits == 1 && vectorUnits.sizeOfReservations == 2 && vectorUnits.cyclesNeeded == 1 && vectorUnits.policy == SelectPolicy::Oldest;
+		for (const char* name : { "alu", "calu", "bu", "lsu", "vu" }) {
+			if (std::string(name) == "vu" && defaultVectorUnits)
+				continue;
+			EUData* data = euNameMap.at(name);
+			s += std::string(name) + " " + std::to_string(data->numberOfUnits) + " " + std::to_string(data->sizeOfReservations) + " " + std::to_string(data->cyclesNeeded);
+			//Left off when it is the default
+			if (data->policy != SelectPolicy::Oldest)
+				s += " " + nameOf(data->policy);
+			s += "\n";
+		}
+		return s;
 	}
 
 	static void print() {
 		std::cout << "Hardware is\n\tWidth " << width << " pipeline\n";
 		std::cout << "\tMemory " << memorySize << " Bytes\n\tROB size " << reorderBufferSize << "\n";
+		if (storeSetSize > 0)
+			std::cout << "\tLoads run ahead of stores, with " << storeSetSize << " store set entries\n";
+		if (physicalRegisters > 0)
+			std::cout << "\t" << physicalRegisters << " physical registers\n";
+		for (auto& pair : fusedPairs)
+			std::cout << "\tDecode fuses " << nameOf(pair.first) << " followed by " << nameOf(pair.second) << "\n";
+		if (loadValueSize > 0)
+			std::cout << "\tLoad values are predicted, with " << loadValueSize << " entries used from a confidence of " << loadValueConfidence << "\n";
+		if (!(frontEnd == FrontEndData())) {
+			std::cout << "\tFront end:\n";
+			for (auto& named : frontEndNames)
+				if (frontEnd.*named.second != 0)
+					std::cout << "\t\t" << named.first << " " << frontEnd.*named.second << "\n";
+			if (frontEnd.icacheSets > 0)
+				std::cout << "\t\tI-cache of " << frontEnd.icacheSets << " sets, " << frontEnd.icacheWays << " ways and " << frontEnd.icacheLine
+					<< " instruction lines, " << frontEnd.icacheMiss << " cycles a miss\n";
+		}
+		if (!(dataCache == DataCacheData()))
+			std::cout << "\tData caches of " << dataCache.sets << " sets, " << dataCache.ways << " ways and " << dataCache.line << " word lines, "
+				<< dataCache.missCycles << " cycles a miss when cores share memory\n";
 		std::cout << "\tALU properties:\n";
 		simpleInteger.print();
 		std::cout << "\tCALU properties:\n";
@@ -63,16 +362,10 @@ public:
 		branchUnits.print();
 		std::cout << "\tLSU properties:\n";
 		loadStoreUnits.print();
+		std::cout << "\tVU properties, for vectors of " << vector.length << " words at " << vector.lanes << " words a cycle:\n";
+		vectorUnits.print();
 	}
-};
 
-GlobalData::EUData GlobalData::simpleInteger = GlobalData::EUData(1, 2, 1);
-GlobalData::EUData GlobalData::complexInteger = GlobalData::EUData(1, 2, 4);
-GlobalData::EUData GlobalData::branchUnits = GlobalData::EUData(1, 2, 2);
-GlobalData::EUData GlobalData::loadStoreUnits = GlobalData::EUData(1, 2, 3);
-int GlobalData::memorySize = 2048;
-int GlobalData::reorderBufferSize = 32;
-int GlobalData::width = 1;
-const std::unordered_map<std::string, GlobalData::EUData*> GlobalData::euNameMap = assembler::MapBuilder<std::string, EUData*>()
-("alu", &simpleInteger)("calu", &complexInteger)("bu", &branchUnits)("lsu", &loadStoreUnits)
-;
\ No newline at end of file
+private:
+	inline static std::mutex settingsLock;
+};
@@ -2,7 +2,7 @@
 #include "BranchPredictor.h"
 #include "ExecutionUnit.h"
 
-word getSimpleArithmetic(BranchPredictor*, PipelineEntry& e) {
+inline word getSimpleArithmetic(BranchPredictor*, PipelineEntry& e) {
 	switch (e.opcode) {
 	case IAdd:
 	case Add:
@@ -17,7 +17,7 @@ word getSimpleArithmetic(BranchPredictor*, PipelineEntry& e) {
 		return e.sourceValue1 | e.sourceValue2;
 	case IXor:
 	case Xor:
-		return e.sourceValue1 | e.sourceValue2;
+		return e.sourceValue1 ^ e.sourceValue2;
 	case ISlt:
 	case Slt:
 		return e.sourceValue1 < e.sourceValue2 ? 1 : 0;
@@ -26,27 +26,38 @@ word getSimpleArithmetic(BranchPredictor*, PipelineEntry& e) {
 		return e.sourceValue1 << e.sourceValue2;
 	case ILsr:
 	case Lsr:
-		return e.sourceValue1 >> e.sourceValue2;
+		//Logical, so the sign bit isn't copied in
+		return word(uint32_t(e.sourceValue1) >> e.sourceValue2);
 	default:
-		//This isn't possible
-		throw(0);
+		throw SimulationError("Not simple arithmetic: opcode " + std::to_string(e.opcode));
 	}
 }
 
-word getComplexArithmetic(BranchPredictor*, PipelineEntry& e) {
+inline word getComplexArithmetic(BranchPredictor*, PipelineEntry& e) {
 	switch (e.opcode) {
 	case Mul:
-		return e.sourceValue1 * e.sourceValue2;
+		//Wraps like the hardware would instead of overflowing
+		return word(uint32_t(e.sourceValue1) * uint32_t(e.sourceValue2));
+	//As RISC-V defines them, so no divide traps the host, not even one on a wrong path: by zero gives -1 and
+	//leaves the dividend as the remainder, and the one quotient that overflows wraps
 	case Div:
+		if (e.sourceValue2 == 0)
+			return -1;
+		if (e.sourceValue2 == -1)
+			return word(0u - uint32_t(e.sourceValue1));
 		return e.sourceValue1 / e.sourceValue2;
 	case Rem:
+		if (e.sourceValue2 == 0)
+			return e.sourceValue1;
+		if (e.sourceValue2 == -1)
+			return 0;
 		return e.sourceValue1 % e.sourceValue2;
 	default:
-		throw(0);
+		throw SimulationError("Not complex arithmetic: opcode " + std::to_string(e.opcode));
 	}
 }
 
-bool checkIfBranchTaken(PipelineEntry& e) {
+inline bool checkIfBranchTaken(PipelineEntry& e) {
 	switch (e.opcode) {
 	case Beq:
 		return e.sourceValue1 == e.sourceValue2;
@@ -57,18 +68,18 @@ bool checkIfBranchTaken(PipelineEntry& e) {
 	case Bge:
 		return e.sourceValue1 >= e.sourceValue2;
 	default:
-		throw(0);
+		throw SimulationError("Not a conditional branch: opcode " + std::to_string(e.opcode));
 	}
 }
 
-word getConditionalBranch(BranchPredictor* b, PipelineEntry& e) {
+inline word getConditionalBranch(BranchPredictor* b, PipelineEntry& e) {
 	bool taken = checkIfBranchTaken(e);
 	bool prediction = b->predictJump(e.instructionAddress, e.destination);
 	b->reportResult(prediction == taken, e.instructionAddress);
 	return taken ? 1 : 0;
 }
 
-word getResultOfOperation(BranchPredictor* b, PipelineEntry& e, std::vector<word>& registers, std::vector<word>& memory) {
+inline word getResultOfOperation(BranchPredictor* b, PipelineEntry& e, std::vector<word>& registers, MainMemory& memory) {
 	if (groups::simpleArithmetic.count(e.opcode) > 0)
 		return getSimpleArithmetic(b, e);
 	if (groups::conditionalBranches.count(e.opcode) > 0)
@@ -78,11 +89,78 @@ word getResultOfOperation(BranchPredictor* b, PipelineEntry& e, std::vector<word
 	if (groups::stores.count(e.opcode) > 0) {
 		return e.sourceValue2;
 	}
+	//Only the operand; the memory side happens at commit
+	if (groups::atomics.count(e.opcode) > 0)
+		return e.sourceValue2;
 	if (groups::jump.count(e.opcode) > 0)
 		return e.opcode == Jlr ? e.instructionAddress : 1;//Always succeeded in jumping
-	if (groups::loads.count(e.opcode) > 0)
-		return memory[e.sourceValue1 + e.sourceValue2];
+	if (groups::loads.count(e.opcode) > 0) {
+		//A wrong path load out of memory gets flushed anyway
+		size_t address = loadAddressOf(e);
+		return address < memory.size() ? memory[address] : 0;
+	}
 	if (groups::sourceAdders.count(e.opcode) > 0)
 		return e.sourceValue1 + e.sourceValue2;
-	throw(0);
+	throw SimulationError("No result for opcode " + std::to_string(e.opcode));
+}
+
+//One word of a vector arithmetic instruction, done by the scalar instruction groups::vectorArithmetic gives for it
+inline word getVectorLane(Opcode scalar, word a, word b) {
+	PipelineEntry lane;
+	lane.opcode = scalar;
+	lane.sourceValue1 = a;
+	lane.sourceValue2 = b;
+	return lane.opcode == Mul ? getComplexArithmetic(nullptr, lane) : getSimpleArithmetic(nullptr, lane);
+}
+
+//Vector sources and destinations are physical vector registers, whose words are read and written here. What comes
+//back is what goes over the common data bus: the destination register, a store's data register, or vsum's and
+//vlen's value
+inline word getVectorResult(PipelineEntry& e, const ThreadContext& context) {
+	VectorRegisterFile& vectors = *context.vectors;
+	int length = vectors.length();
+	if (e.opcode == VSum) {
+		word sum = 0;
+		word* source = vectors.lanes(e.sourceValue1);
+		for (int i = 0; i < length; i++)
+			sum += source[i];
+		return sum;
+	}
+	if (e.opcode == VLen)
+		return length;
+	if (e.opcode == VSta)
+		return e.sourceValue2;
+	word* destination = vectors.lanes(e.destination);
+	if (e.opcode == VSplat)
+		std::fill(destination, destination + length, e.sourceValue1);
+	else if (e.opcode == VLda) {
+		//As for a scalar load, the words of a wrong path one out of memory read as 0
+		MainMemory& memory = *context.memory;
+		size_t address = loadAddressOf(e);
+		for (int i = 0; i < length; i++)
+			destination[i] = address + i < memory.size() ? memory[address + i] : 0;
+	}
+	else {
+		Opcode scalar = groups::vectorArithmetic.at(e.opcode);
+		word* a = vectors.lanes(e.sourceValue1);
+		word* b = vectors.lanes(e.sourceValue2);
+		for (int i = 0; i < length; i++)
+			destination[i] = getVectorLane(scalar, a[i], b[i]);
+	}
+	return e.destination;
+}
+
+//Replayed instructions never compute values; only the things that steer timing are produced, including what
+//ends up in ra
+inline word getReplayedResultOfOperation(BranchPredictor* b, PipelineEntry& e) {
+	if (groups::conditionalBranches.count(e.opcode) > 0) {
+		if (e.trainPredictor) {
+			bool prediction = b->predictJump(e.instructionAddress, e.destination);
+			b->reportResult(prediction == e.replayTaken, e.instructionAddress);
+		}
+		return e.replayTaken ? 1 : 0;
+	}
+	if (groups::jump.count(e.opcode) > 0)
+		return e.opcode == Jlr ? e.instructionAddress : 1;
+	return e.replayValue;
 }
\ No newline at end of file
@@ -7,6 +7,15 @@
 #include <cstdio>
 #include<stdint.h>
 #include <optional>
+#include <vector>
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+#include <string_view>
+#include <charconv>
+#include <filesystem>
+#include <memory>
+#include "MappedFile.h"
 
 enum Opcode {
 	IAdd, IAnd, IOr, IXor, ISlt,
@@ -16,7 +25,20 @@ enum Opcode {
 	Jmp, Jlr, Rtl,
 	Beq, Bne, Blt, Bge,
 	Lda, Sta,
-	Mul, Div, Rem
+	Mul, Div, Rem,
+	//Read, change and write a word in one step, taking what it held before. Like a fence, nothing after one is
+	//fetched until it commits
+	AmoAdd, AmoSwap,
+	//Nothing after it is fetched until everything before it has committed
+	Fence,
+	//Work on every word of a vector register at once
+	VAdd, VSub, VMul, VAnd, VOr, VXor,
+	//vsplat vd rs copies rs into every word of vd; vsum rd vs adds up the words of vs; vlen rd reads the vector length
+	VSplat, VSum, VLen,
+	//vlda vd rs imm reads the words from rs + imm on into vd, vsta imm rs vs writes vs to the words from imm + rs on
+	VLda, VSta,
+	//Stops the program once everything before it has committed
+	Halt
 };
 
 namespace assembler {
@@ -33,15 +55,18 @@ namespace assembler {
 	private:
 		std::unordered_map<A, B> m;
 	};
-	const std::unordered_map<std::string, Opcode> opMappings = MapBuilder<std::string, Opcode>()
+	inline const std::unordered_map<std::string, Opcode> opMappings = MapBuilder<std::string, Opcode>()
 		("addi", IAdd)("andi", IAnd)("ori", IOr)("xori", IXor)("stli", ISlt)("lsli", ILsl)("lsri", ILsr)
 		("add", Add)("sub", Sub)("and", And)("or", Or)("xor", Xor)("stl", Slt)("lsl", Lsl)("lsr", Lsr)
 		("jmp", Jmp)("jlr", Jlr)("beq", Beq)("bne", Bne)("blt", Blt)("bge", Bge)("lda", Lda)("sta", Sta)
-		("mul", Mul)("div", Div)("rem", Rem)("rtl", Rtl)
+		("mul", Mul)("div", Div)("rem", Rem)("rtl", Rtl)("halt", Halt)
+		("amoadd", AmoAdd)("amoswap", AmoSwap)("fence", Fence)
+		("vadd", VAdd)("vsub", VSub)("vmul", VMul)("vand", VAnd)("vor", VOr)("vxor", VXor)
+		("vsplat", VSplat)("vsum", VSum)("vlen", VLen)("vlda", VLda)("vsta", VSta)
 		;
 }
 
-using word = int32_t;
+#include "MainMemory.h"
 
 struct Instruction {
 	Opcode operation;
@@ -68,16 +93,24 @@ struct Instruction {
 };
 
 namespace groups {
-	const std::unordered_set<Opcode> immediates = { IAdd, IAnd, IOr, IXor, ISlt, ILsl, ILsr };
-	const std::unordered_set<Opcode> simpleArithmetic = { IAdd, IAnd, IOr, IXor, ISlt, ILsl, ILsr, Add, Sub, And, Or, Xor, Slt, Lsl, Lsr};
-	const std::unordered_set<Opcode> conditionalBranches = { Beq, Bne, Blt, Bge };
-	const std::unordered_set<Opcode> jump = { Jmp, Jlr, Rtl};
-	const std::unordered_set<Opcode> loads = { Lda };
-	const std::unordered_set<Opcode> stores = { Sta };
-	const std::unordered_set<Opcode> complexArithmetic = { Mul, Div, Rem };
-	const std::unordered_set<Opcode> sourceAdders = { Jmp, Jlr };
-
-	const std::unordered_map<std::string, std::string> originalMacros = assembler::MapBuilder<std::string, std::string>()
+	inline const std::unordered_set<Opcode> immediates = { IAdd, IAnd, IOr, IXor, ISlt, ILsl, ILsr };
+	inline const std::unordered_set<Opcode> simpleArithmetic = { IAdd, IAnd, IOr, IXor, ISlt, ILsl, ILsr, Add, Sub, And, Or, Xor, Slt, Lsl, Lsr};
+	inline const std::unordered_set<Opcode> conditionalBranches = { Beq, Bne, Blt, Bge };
+	inline const std::unordered_set<Opcode> jump = { Jmp, Jlr, Rtl};
+	inline const std::unordered_set<Opcode> loads = { Lda };
+	inline const std::unordered_set<Opcode> stores = { Sta };
+	//amoadd rd rs1 rs2 adds rs2 to the word at rs1, amoswap rd rs1 rs2 writes rs2 there; either puts the old word in rd
+	inline const std::unordered_set<Opcode> atomics = { AmoAdd, AmoSwap };
+	inline const std::unordered_set<Opcode> complexArithmetic = { Mul, Div, Rem };
+	inline const std::unordered_set<Opcode> sourceAdders = { Jmp, Jlr };
+	//Each vector arithmetic instruction, and the scalar one it does to every word
+	inline const std::unordered_map<Opcode, Opcode> vectorArithmetic = { {VAdd, Add}, {VSub, Sub}, {VMul, Mul}, {VAnd, And}, {VOr, Or}, {VXor, Xor} };
+	//What the vector unit executes; vector loads and stores go to the load store unit
+	inline const std::unordered_set<Opcode> vectorUnit = { VAdd, VSub, VMul, VAnd, VOr, VXor, VSplat, VSum, VLen };
+	inline const std::unordered_set<Opcode> vectorLoads = { VLda };
+	inline const std::unordered_set<Opcode> vectorStores = { VSta };
+
+	inline const std::unordered_map<std::string, std::string> originalMacros = assembler::MapBuilder<std::string, std::string>()
 		("zero", "r0")("ra", "r1")("returnAddress", "r1")("sp", "r2")
 		("stackPointer", "r2")("gp", "r3")("globalPointer", "r3")
 		("tp", "r4")("threadPointer", "r4")("t0", "r5")("t1", "r6")
@@ -89,57 +122,51 @@ namespace groups {
 		;
 }
 
-namespace assembler {
+//v0 to v7, each holding GlobalData::vector.length words
+const int vectorRegisterCount = 8;
+
+//Which operands of op name vector registers: bit 0 the destination, bit 1 source1 and bit 2 source2
+inline int vectorOperands(Opcode op) {
+	if (groups::vectorArithmetic.count(op) > 0)
+		return 0b111;
+	if (op == VSplat || op == VLda)
+		return 0b001;
+	if (op == VSum)
+		return 0b010;
+	if (op == VSta)
+		return 0b100;
+	return 0;
+}
 
-	int parseOp(const std::unordered_map<std::string, int>& labels, const std::string& op, const std::unordered_map<std::string, std::string>& macros) {
-		if (macros.count(op) > 0)
-			return parseOp(labels, macros.at(op), macros);
-		if (labels.count(op) > 0)
-			return labels.at(op);
-		if (op[0] == 'r')
-			return std::atoi(op.substr(1).c_str());
-		return std::atoi(op.c_str());
-	}
+//True for an instruction that writes a vector register
+inline bool writesVector(Opcode op) {
+	return (vectorOperands(op) & 1) != 0;
+}
 
-	
-	Instruction parseRegularOp(
-		std::unordered_map<std::string, int>& labels,
-		std::unordered_map<std::string, std::string>& macros,
-		const std::vector<std::string>& splits, 
-		int lineNumber, 
-		const std::string& filename) {
-		Instruction i(opMappings.at(splits[0]));
-
-		if (splits.size() > 1) {
-			i.destination = parseOp(labels, splits[1], macros);
-			if (splits.size() > 2) {
-				i.source1 = parseOp(labels, splits[2], macros);
-				if (splits.size() > 3) {
-					i.source2 = parseOp(labels, splits[3], macros);
-					if (splits.size() > 4) {
-						printf("Cannot parse file %s line %d; too many things (from %s)\n", filename.c_str(), lineNumber, splits[4].c_str());
-						throw(0);
-					}
-				}
-			}
-		}
+//True for any instruction of the vector extension, which are numbered together
+inline bool isVector(Opcode op) {
+	return op >= VAdd && op <= VSta;
+}
 
-		return i;
-	}
+//Thrown when a run can't go on, such as when fetch leaves the program, rather than ending the host process; one
+//run failing this way leaves every other run going
+struct SimulationError : public std::runtime_error {
+	SimulationError(const std::string& message) :
+		std::runtime_error(message)
+	{}
+};
 
-	struct ParsedInstruction {
-		std::vector<std::string> splits;
-		std::string filename;
-		int lineNumber;
+//For accesses on the program's own path, where words outside memory are the program's mistake. Instruction is
+//its address in the program. Returns address
+inline int checkAccess(long long address, int length, size_t memoryWords, int instruction) {
+	if (address < 0 || size_t(address) + size_t(length) > memoryWords)
+		throw SimulationError("The instruction at " + std::to_string(instruction) + " accessed word " + std::to_string(address) + ", outside memory");
+	return int(address);
+}
 
-		ParsedInstruction(std::vector<std::string>& splits, std::string& filename, int lineNumber):
-			splits(splits),
-			filename(filename),
-			lineNumber(lineNumber)
-		{}
-	};
+namespace assembler {
 
-	std::vector<std::string> splitLine(const std::string& line) {
+	inline std::vector<std::string> splitLine(const std::string& line) {
 		std::vector<std::string> splits;
 		if (line.size() == 0)
 			return splits;
@@ -155,84 +182,336 @@ namespace assembler {
 		return splits;
 	}
 
-	struct ParseMemory {
-		std::vector<word>* memory;
-		int currentIndex = 0;
+	inline bool c_prettyPrint = false;
 
-		void write(word value) {
-			(*memory)[currentIndex] = value;
-			currentIndex += 1;
-		}
+	struct CompileResult {
+		std::vector<Instruction> instructions;
+		MainMemory memory;
+		std::unordered_map<std::string, int> labels;
+		//How much of memory the program's data directives filled
+		int dataLength = 0;
+		//Every file besides the one named that went into the program: .include'd source and .incbin data
+		std::vector<std::string> sources;
 	};
 
-	bool c_prettyPrint = false;
-
-	void parseFile(std::vector<ParsedInstruction>& parsedInstructions, std::string filename, std::unordered_map<std::string, int>& labels, ParseMemory& memory, std::unordered_map<std::string, std::string>& macros) {
-		std::ifstream file(filename);
-		std::string line;
-		int lineNum = -1;
-		if (!file.is_open()) {
-			printf("File %s is bad\n", filename.c_str());
-		}
-		while (std::getline(file, line)) {
-			if(c_prettyPrint)
-				printf("> %s\n", line.c_str());
-			lineNum += 1;
-			auto splits = splitLine(line);
-			if (splits.size() == 0)continue;
-			if (opMappings.count(splits[0]) > 0) {
-				parsedInstructions.emplace_back(splits, filename, lineNum);
-			}
-			//Macro
-			else if (splits[0][0] == '.') {
-				if (splits[0] == ".label") {
-					labels[splits[1]] = parsedInstructions.size();
-				}
-				else if (splits[0] == ".data") {
-					labels[splits[1]] = memory.currentIndex;
-					for (size_t i = 2; i < splits.size(); i++)
-						memory.write(std::atoi(splits[i].c_str()));
+	//Thrown when a program can't be turned into instructions
+	struct ProgramError : public std::runtime_error {
+		ProgramError(const std::string& message) :
+			std::runtime_error(message)
+		{}
+	};
+
+	//Single pass assembler working straight off the mapped source. Tokens are views into the mapping,
+	//labels and macros are interned once, and operands naming a label that isn't defined yet are patched
+	//when the last file has been read. Errors are collected and thrown together as one ProgramError
+	class Assembler {
+	public:
+		CompileResult compile(const std::string& filename) {
+			parseFile(filename, 0);
+			resolveFixups();
+			for (auto& [name, id] : symbolIds)
+				if (symbols[id].kind == SymbolKind::Label)
+					result.labels.emplace(std::string(name), symbols[id].value);
+
+			if (errors.size() > 0) {
+				std::string message = "";
+				size_t shown = std::min(errors.size(), size_t(20));
+				for (size_t i = 0; i < shown; i++)
+					message += errors[i] + "\n";
+				if (errors.size() > shown)
+					message += "... and " + std::to_string(errors.size() - shown) + " more errors\n";
+				throw ProgramError(message);
+			}
+			return std::move(result);
+		}
+
+		Assembler(int memorySize) {
+			result.memory = MainMemory(memorySize);
+			for (auto& [name, op] : opMappings)
+				opcodes.emplace(std::string_view(name), op);
+			for (auto& [name, target] : groups::originalMacros) {
+				int id = intern(name);
+				symbols[id].kind = SymbolKind::Macro;
+				symbols[id].macro = target;
+			}
+		}
+
+	private:
+		enum class SymbolKind {
+			Undefined, Label, Macro
+		};
+		struct Symbol {
+			SymbolKind kind = SymbolKind::Undefined;
+			int value = 0;
+			std::string_view macro;
+		};
+		//An operand that named a symbol before the symbol was defined
+		struct Fixup {
+			int instruction;
+			int operand;
+			std::string_view name;
+			int fileIndex;
+			int lineNumber;
+		};
+
+		CompileResult result;
+		std::unordered_map<std::string_view, Opcode> opcodes;
+		std::unordered_map<std::string_view, int> symbolIds;
+		std::vector<Symbol> symbols;
+		std::vector<Fixup> fixups;
+		std::vector<std::string> errors;
+		//Kept open until the end; every token and interned name points into one of these
+		std::vector<std::unique_ptr<MappedFile>> files;
+		std::vector<std::string> filenames;
+		int dataIndex = 0;
+
+		static const int maxTokens = 5;
+		static const int maxIncludeDepth = 32;
+
+		int intern(std::string_view name) {
+			auto found = symbolIds.find(name);
+			if (found != symbolIds.end())
+				return found->second;
+			int id = symbols.size();
+			symbols.emplace_back();
+			symbolIds.emplace(name, id);
+			return id;
+		}
+
+		void error(int fileIndex, int lineNumber, const std::string& message) {
+			errors.emplace_back(filenames[fileIndex] + ":" + std::to_string(lineNumber) + ": " + message);
+		}
+
+		static bool parseNumber(std::string_view token, int& value) {
+			const char* begin = token.data();
+			const char* end = begin + token.size();
+			if (begin != end && *begin == '+')
+				begin += 1;
+			auto [last, problem] = std::from_chars(begin, end, value);
+			return problem == std::errc() && last == end && begin != end;
+		}
+
+		//Register numbers and literals are final; anything else is a symbol which may not exist yet
+		bool resolve(std::string_view token, int& value, int depth = 0) {
+			auto found = symbolIds.find(token);
+			if (found != symbolIds.end()) {
+				Symbol& symbol = symbols[found->second];
+				if (symbol.kind == SymbolKind::Label) {
+					value = symbol.value;
+					return true;
 				}
-				else if (splits[0] == ".include") {
-					parseFile(parsedInstructions, splits[1], labels, memory, macros);
+				if (symbol.kind == SymbolKind::Macro && depth < 16)
+					return resolve(symbol.macro, value, depth + 1);
+			}
+			if (token.size() > 1 && token[0] == 'r' && parseNumber(token.substr(1), value))
+				return true;
+			return parseNumber(token, value);
+		}
+
+		void setOperand(Instruction& instruction, int operand, int value) {
+			if (operand == 0)instruction.destination = value;
+			else if (operand == 1)instruction.source1 = value;
+			else instruction.source2 = value;
+		}
+
+		void resolveFixups() {
+			for (auto& f : fixups) {
+				int value = 0;
+				if (resolve(f.name, value))
+					setOperand(result.instructions[f.instruction], f.operand, value);
+				else
+					error(f.fileIndex, f.lineNumber, "Unknown label '" + std::string(f.name) + "'");
+			}
+			fixups.clear();
+		}
+
+		void define(std::string_view name, SymbolKind kind, int value, std::string_view macro, int fileIndex, int lineNumber) {
+			Symbol& symbol = symbols[intern(name)];
+			if (symbol.kind != SymbolKind::Undefined) {
+				error(fileIndex, lineNumber, "'" + std::string(name) + "' is already defined");
+				return;
+			}
+			symbol.kind = kind;
+			symbol.value = value;
+			symbol.macro = macro;
+		}
+
+		void parseInstruction(Opcode op, std::string_view* tokens, int tokenCount, int fileIndex, int lineNumber) {
+			Instruction& instruction = result.instructions.emplace_back(op);
+			if (tokenCount > 4) {
+				error(fileIndex, lineNumber, "Too many operands (from " + std::string(tokens[4]) + ")");
+				return;
+			}
+			int vectors = vectorOperands(op);
+			for (int operand = 0; operand + 1 < tokenCount; operand++) {
+				int value = 0;
+				//Vector registers are only ever named outright, as v0 to v7
+				if ((vectors >> operand & 1) != 0) {
+					std::string_view token = tokens[operand + 1];
+					if (token.size() < 2 || token[0] != 'v' || !parseNumber(token.substr(1), value) || value < 0 || value >= vectorRegisterCount)
+						error(fileIndex, lineNumber, "'" + std::string(token) + "' is not a vector register");
+					else
+						setOperand(instruction, operand, value);
 				}
-				else if (splits[0] == ".macro") {
-					macros.emplace(splits[1], splits[2]);
+				else if (resolve(tokens[operand + 1], value))
+					setOperand(instruction, operand, value);
+				else
+					fixups.push_back(Fixup{ int(result.instructions.size()) - 1, operand, tokens[operand + 1], fileIndex, lineNumber });
+			}
+		}
+
+		void parseDirective(std::string_view* tokens, int tokenCount, std::string_view line, int fileIndex, int lineNumber, int depth) {
+			std::string_view directive = tokens[0];
+			if (directive == ".data") {
+				if (tokenCount < 2) {
+					error(fileIndex, lineNumber, ".data needs a name");
+					return;
 				}
-				else {
-					printf("Filename %s, line %d, Unknown macro '%s'\n", filename.c_str(), lineNum, line.c_str());
+				define(tokens[1], SymbolKind::Label, dataIndex, {}, fileIndex, lineNumber);
+				//.data lines can be any length, so values are read straight off the line rather than from tokens
+				size_t position = tokens[1].data() + tokens[1].size() - line.data();
+				while (true) {
+					std::string_view value = nextToken(line, position);
+					if (value.size() == 0 || value[0] == '#')
+						break;
+					int number;
+					if (!parseNumber(value, number))
+						error(fileIndex, lineNumber, "'" + std::string(value) + "' is not a number");
+					else if (dataIndex >= (int)result.memory.size()) {
+						error(fileIndex, lineNumber, "Data doesn't fit in " + std::to_string(result.memory.size()) + " words of memory");
+						return;
+					}
+					else
+						result.memory[dataIndex++] = number;
 				}
+				result.dataLength = dataIndex;
 			}
-			else if (splits[0][0] == '#') { continue; }
-			else {
-				printf("Filename %s, line %d, Unknown operator '%s'\n", filename.c_str(), lineNum, line.c_str());
-				throw(0);
+			else if (directive == ".incbin")
+				parseIncbin(tokens, tokenCount, fileIndex, lineNumber);
+			else if (directive == ".label" || directive == ".include" || directive == ".macro") {
+				if (tokenCount < (directive == ".macro" ? 3 : 2))
+					error(fileIndex, lineNumber, std::string(directive) + " is missing an argument");
+				else if (directive == ".label")
+					define(tokens[1], SymbolKind::Label, result.instructions.size(), {}, fileIndex, lineNumber);
+				else if (directive == ".macro")
+					define(tokens[1], SymbolKind::Macro, 0, tokens[2], fileIndex, lineNumber);
+				else if (depth >= maxIncludeDepth)
+					error(fileIndex, lineNumber, "Includes nested too deeply");
+				else
+					parseFile(std::string(tokens[1]), depth + 1);
 			}
+			else
+				error(fileIndex, lineNumber, "Unknown macro '" + std::string(line) + "'");
 		}
 
-	}
+		//.incbin name file [offset] [count] puts raw little endian words from a file into memory. Big blobs are
+		//moved up to the next page so they can be mapped in rather than copied
+		void parseIncbin(std::string_view* tokens, int tokenCount, int fileIndex, int lineNumber) {
+			if (tokenCount < 3) {
+				error(fileIndex, lineNumber, ".incbin needs a name and a file");
+				return;
+			}
+			std::string path(tokens[2]);
+			std::error_code problem;
+			uintmax_t fileBytes = std::filesystem::file_size(path, problem);
+			if (problem) {
+				error(fileIndex, lineNumber, "File " + path + " is bad");
+				return;
+			}
+			int fileWords = int(fileBytes / sizeof(word));
+			int offset = 0;
+			int count = 0;
+			if (tokenCount > 3 && (!parseNumber(tokens[3], offset) || offset < 0 || offset > fileWords)) {
+				error(fileIndex, lineNumber, "'" + std::string(tokens[3]) + "' is not an offset into " + path);
+				return;
+			}
+			count = fileWords - offset;
+			if (tokenCount > 4 && (!parseNumber(tokens[4], count) || count < 0 || count > fileWords - offset)) {
+				error(fileIndex, lineNumber, "'" + std::string(tokens[4]) + "' words aren't available in " + path);
+				return;
+			}
 
+			int base = dataIndex;
+			int alignment = (int)MainMemory::mappingAlignment();
+			if (count >= alignment && offset % alignment == 0) {
+				int aligned = (base + alignment - 1) / alignment * alignment;
+				if (aligned + count <= (int)result.memory.size())
+					base = aligned;
+			}
+			if (base + count > (int)result.memory.size()) {
+				error(fileIndex, lineNumber, path + " doesn't fit in " + std::to_string(result.memory.size()) + " words of memory");
+				return;
+			}
+			define(tokens[1], SymbolKind::Label, base, {}, fileIndex, lineNumber);
+			result.sources.emplace_back(path);
+			if (!result.memory.loadFile(base, path, offset, count))
+				error(fileIndex, lineNumber, "Could not read " + path);
+			dataIndex = base + count;
+			result.dataLength = dataIndex;
+		}
 
-	struct CompileResult {
-		std::vector<Instruction> instructions;
-		std::vector<word> memory;
-		std::unordered_map<std::string, int> labels;
-	};
+		static bool isSpace(char c) {
+			return c == ' ' || c == '\t' || c == '\r';
+		}
 
-	CompileResult compile(std::string filename, int memorySize) {
-		std::vector<ParsedInstruction> parsedInstructions;
-		std::unordered_map<std::string, std::string> macros = groups::originalMacros;
-		CompileResult result;
-		result.memory = std::vector<word>(memorySize);
-		ParseMemory mem;
-		mem.memory = &result.memory;
-		mem.currentIndex = 0;
+		static std::string_view nextToken(std::string_view line, size_t& position) {
+			while (position < line.size() && isSpace(line[position]))
+				position += 1;
+			size_t start = position;
+			while (position < line.size() && !isSpace(line[position]))
+				position += 1;
+			return line.substr(start, position - start);
+		}
 
-		parseFile(parsedInstructions, filename, result.labels, mem, macros);
+		void parseFile(const std::string& filename, int depth) {
+			int fileIndex = filenames.size();
+			filenames.emplace_back(filename);
+			if (depth > 0)
+				result.sources.emplace_back(filename);
+			files.emplace_back(std::make_unique<MappedFile>(filename));
+			MappedFile& file = *files.back();
+			if (!file.isOpen()) {
+				errors.emplace_back("File " + filename + " is bad");
+				return;
+			}
 
-		for (auto& pi : parsedInstructions)
-			result.instructions.emplace_back(parseRegularOp(result.labels, macros, pi.splits, pi.lineNumber, pi.filename));
+			std::string_view text(file.data(), file.size());
+			size_t lineStart = 0;
+			int lineNumber = 0;
+			std::string_view tokens[maxTokens];
+			while (lineStart < text.size()) {
+				size_t lineEnd = text.find('\n', lineStart);
+				if (lineEnd == std::string_view::npos)
+					lineEnd = text.size();
+				std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+				lineStart = lineEnd + 1;
+				lineNumber += 1;
+				if (c_prettyPrint)
+					printf("> %.*s\n", int(line.size()), line.data());
+
+				int tokenCount = 0;
+				size_t position = 0;
+				while (tokenCount < maxTokens) {
+					std::string_view token = nextToken(line, position);
+					if (token.size() == 0 || token[0] == '#')
+						break;
+					tokens[tokenCount++] = token;
+				}
+				if (tokenCount == 0)
+					continue;
+
+				auto op = opcodes.find(tokens[0]);
+				if (op != opcodes.end())
+					parseInstruction(op->second, tokens, tokenCount, fileIndex, lineNumber);
+				else if (tokens[0][0] == '.')
+					parseDirective(tokens, tokenCount, line, fileIndex, lineNumber, depth);
+				else
+					error(fileIndex, lineNumber, "Unknown operator '" + std::string(line) + "'");
+			}
+		}
+	};
 
-		return result;
+	inline CompileResult compile(std::string filename, int memorySize) {
+		return Assembler(memorySize).compile(filename);
 	}
-}
\ No newline at end of file
+}
@@ -1,129 +1,363 @@
 #pragma once
 
 #include "riscv.h"
+#include "RegisterFile.h"
 
-enum class InstructionType {
-	Branch, Store, RegisterOp
+//Vector writes a vector register, and VectorStore writes a vector register's words to memory
+enum class InstructionType : uint8_t {
+	Branch, Store, RegisterOp, Halt, Atomic, Fence, Vector, VectorStore
 };
 
 enum class CommitResult {
-	Complete, BranchCorrect, FlushEverything, Jumped
+	Complete, BranchCorrect, FlushEverything, Jumped, Halt
 };
 
+//What fetch knows about an instruction as it enters the ROB
 struct RobEntry {
 	InstructionType type;
 	word desination;
-	//Either the value to write, or a boolean of the branch being predicted correct
+	//Either the value to write, or a boolean of the branch being taken
 	word valueField;
 	bool ready = false;
-	bool active = false;
 
-	int pcIfBadlyPredicted;
-	bool predictedToJump;
-
-	Instruction instruction = Instruction(Add);
-	int instructionIndex = -1;//Used for return address bodging
+	int pcIfBadlyPredicted = 0;
+	bool predictedToJump = false;
+	//Where a replayed rtl really returns to, from the trace
+	int returnTarget = 0;
 
-	RobEntry() = default;
+	int instructionIndex = -1;//One past the instruction's address; also its return address
 
 	RobEntry(InstructionType type) :
-		type(type),
-		instruction(Add)
+		type(type)
 	{
 		desination = valueField = ready = 0;
 	}
+};
+
+//What commit still needs once an entry has left the ROB
+struct RetiredEntry {
+	Opcode operation;
+	int pcIfBadlyPredicted;
+	bool predictedToJump;
+	int returnTarget;
+};
+
+//The ROB is kept as arrays of fields rather than an array of entries. What is read every cycle (type, ready,
+//destination, value) is packed together, while what is only needed at commit sits apart, with the
+//instruction itself looked up in the program by its address. Which entry last writes each register is kept
+//up to date as entries come and go, so renaming a source doesn't search the whole ROB
+class ReOrderBuffer {
+public:
+	bool hasRoom() {
+		return size < capacity;
+	}
+	int length() {
+		return size;
+	}
+	int headIndex() {
+		return head;
+	}
+
+	bool isReady(int index) {
+		return ready[index] != 0;
+	}
+	//False once popped; a flush leaves entries as they were
+	bool isActive(int index) {
+		return active[index] != 0;
+	}
+	InstructionType typeOf(int index) {
+		return types[index];
+	}
+	word destinationOf(int index) {
+		return destinations[index];
+	}
+	word valueOf(int index) {
+		return values[index];
+	}
 
-	CommitResult commit(std::vector<word>& memory, std::vector<word>& registers) {
-		switch (type)
+	void complete(int index, word value) {
+		if (valueStates[index] == ValuePredicted && values[index] != value)
+			valueStates[index] = ValueWrong;
+		ready[index] = 1;
+		values[index] = value;
+	}
+
+	//Younger instructions may take value from a load before it has read memory; complete checks it
+	void predictValue(int index, word value) {
+		values[index] = value;
+		valueStates[index] = ValuePredicted;
+	}
+
+	//Whether valueOf can be read yet: the entry is complete, or its value was predicted
+	bool hasValue(int index) {
+		return ready[index] != 0 || valueStates[index] != NotPredicted;
+	}
+
+	//True for a load whose value was predicted and turned out different
+	bool isValueWrong(int index) {
+		return valueStates[index] == ValueWrong;
+	}
+	void completeStore(int index, word address, word value) {
+		ready[index] = 1;
+		destinations[index] = address;
+		values[index] = value;
+	}
+
+	//The address of the instruction in an entry
+	int addressOf(int index) {
+		return cold[index].instructionIndex - 1;
+	}
+
+	//Notes where a load read from, for checking against older stores that resolve later.
+	//forwardedFrom is the store it took its value from, or -1 if it read memory. A vector load reads length words,
+	//and counts as having read memory if any of them did
+	void recordLoad(int index, word address, int forwardedFrom, int length = 1) {
+		loadStates[index] = LoadRead;
+		loadAddresses[index] = address;
+		loadLengths[index] = length;
+		loadSources[index] = forwardedFrom == -1 ? -1 : sequences[forwardedFrom];
+	}
+
+	//A store has found its address, and writes length words from it. Any younger load of those words which has
+	//already read, and didn't take its value from a store younger than this one, read a stale value and must run
+	//again. Returns the oldest such load, or -1
+	int checkLoadsAfterStore(int storeIndex, word address, int length = 1) {
+		int oldest = -1;
+		int checkIndex = storeIndex;
+		incrimentIndex(checkIndex);
+		for (int age = ageOf(storeIndex) + 1; age < size; age++) {
+			if (loadStates[checkIndex] == LoadRead && overlaps(checkIndex, address, length) && loadSources[checkIndex] < sequences[storeIndex]) {
+				loadStates[checkIndex] = LoadStale;
+				if (oldest == -1)
+					oldest = checkIndex;
+			}
+			incrimentIndex(checkIndex);
+		}
+		return oldest;
+	}
+
+	//Another core took the words from first up to first + count. Every load that read them from memory, rather
+	//than from a store, must run again once it is the oldest instruction. Returns whether there were any.
+	//Loads are only noted this way while recordLoad is being called
+	bool loseLoadsFrom(word first, int count) {
+		bool lost = false;
+		int checkIndex = head;
+		for (int age = 0; age < size; age++) {
+			if (loadStates[checkIndex] == LoadRead && loadSources[checkIndex] == -1 && overlaps(checkIndex, first, count)) {
+				loadStates[checkIndex] = LoadLost;
+				lost = true;
+			}
+			incrimentIndex(checkIndex);
+		}
+		return lost;
+	}
+
+	//True for a load that read before an older store to the same address had resolved, or that read a line
+	//another core has since taken
+	bool isStale(int index) {
+		return loadStates[index] == LoadStale || loadStates[index] == LoadLost;
+	}
+	bool lostLine(int index) {
+		return loadStates[index] == LoadLost;
+	}
+
+	int push(const RobEntry& entry) {
+		int index = next;
+		sequences[index] = pushed++;
+		loadStates[index] = NotLoad;
+		valueStates[index] = NotPredicted;
+		types[index] = entry.type;
+		ready[index] = entry.ready;
+		active[index] = 1;
+		destinations[index] = entry.desination;
+		values[index] = entry.valueField;
+		cold[index] = Cold{ entry.instructionIndex, entry.pcIfBadlyPredicted, entry.predictedToJump, entry.returnTarget };
+		if (entry.type == InstructionType::RegisterOp && entry.desination >= 0 && entry.desination < 32)
+			lastWriters[entry.desination] = index;
+		else if (operationOf(index) == Jlr)
+			lastWriters[1] = index;
+		incrimentIndex(next);
+		size += 1;
+		return index;
+	}
+
+	//Writes the head's result to the registers or memory, or for an atomic both. The head must be ready. A vector
+	//store's value is the physical vector register holding its words
+	CommitResult commitHead(MainMemory& memory, std::vector<word>& registers, VectorRegisterFile* vectors = nullptr) {
+		switch (types[head])
 		{
 		case InstructionType::Branch:
-			if (valueField > 0) {
-				if (instruction.operation == Jlr)
-					registers[1] = instructionIndex;
-				if (groups::jump.count(instruction.operation))
+			if (values[head] > 0) {
+				Opcode operation = operationOf(head);
+				if (operation == Jlr)
+					registers[1] = cold[head].instructionIndex;
+				if (groups::jump.count(operation))
 					return CommitResult::Jumped;
 				return CommitResult::BranchCorrect;
 			}
 			return CommitResult::FlushEverything;
 		case InstructionType::Store:
-			memory[desination] = valueField;
+			checkAccess(destinations[head], 1, memory.size(), addressOf(head));
+			memory[destinations[head]] = values[head];
 			return CommitResult::Complete;
 		case InstructionType::RegisterOp:
-			registers[desination] = valueField;
+			registers[destinations[head]] = values[head];
 			return CommitResult::Complete;
+		case InstructionType::Halt:
+			return CommitResult::Halt;
+		//Nothing younger is in flight, so the old word only has to reach the register and valueOf
+		case InstructionType::Atomic: {
+			const Instruction& instruction = instructions[addressOf(head)];
+			checkAccess(destinations[head], 1, memory.size(), addressOf(head));
+			word old = memory[destinations[head]];
+			memory[destinations[head]] = instruction.operation == AmoAdd ? old + values[head] : values[head];
+			values[head] = old;
+			if (instruction.destination > 0 && instruction.destination < 32)
+				registers[instruction.destination] = old;
+			return CommitResult::Complete;
+		}
+		case InstructionType::Fence:
+		case InstructionType::Vector:
+			return CommitResult::Complete;
+		case InstructionType::VectorStore: {
+			word* lanes = vectors->lanes(values[head]);
+			checkAccess(destinations[head], vectorLength, memory.size(), addressOf(head));
+			for (int i = 0; i < vectorLength; i++)
+				memory[destinations[head] + i] = lanes[i];
+			return CommitResult::Complete;
+		}
 		default:
-			printf("Unknown instruction type in rob\n");
-			throw(0);
+			throw SimulationError("Unknown instruction type in the ROB");
 		}
 	}
-};
 
-class ReOrderBuffer {
-public:
-	bool hasRoom() {
-		return size < capacity;
-	}
-	RobEntry& operator[](int index) {
-		return entries[index];
-	}
-	RobEntry& head() {
-		return entries[headIndex];
-	}
-	RobEntry pop() {
-		head().active = false;
-		RobEntry copy = head();
-		incrimentIndex(headIndex);
+	RetiredEntry pop() {
+		active[head] = 0;
+		RetiredEntry retired{ operationOf(head), cold[head].pcIfBadlyPredicted, cold[head].predictedToJump, cold[head].returnTarget };
+		//Being the oldest, it can only still be the last writer if nothing younger writes the same register
+		if (types[head] == InstructionType::RegisterOp && destinations[head] >= 0 && destinations[head] < 32 && lastWriters[destinations[head]] == head)
+			lastWriters[destinations[head]] = -1;
+		if (lastWriters[1] == head)
+			lastWriters[1] = -1;
+		incrimentIndex(head);
 		size -= 1;
-		return copy;
-	}
-	int push(RobEntry entry) {
-		entries[nextIndex] = entry;
-		entries[nextIndex].active = true;
-		int returningIndex = nextIndex;
-		incrimentIndex(nextIndex);
-		size += 1;
-		return returningIndex;
-	}
-	int length() {
-		return size;
+		return retired;
 	}
 
 	void flushEverything() {
 		size = 0;
-		nextIndex = 0;
-		headIndex = 0;
+		next = first;
+		head = first;
+		std::fill(std::begin(lastWriters), std::end(lastWriters), -1);
 	}
 
-	word getRobOrMinus(bool(*predicate)(RobEntry&, word), word secondryArg) {
-		word finalResult = -1;
-		int lookedAt = 0;
-		while (lookedAt < size) {
-			int checkIndex = headIndex + lookedAt;
-			if (checkIndex >= capacity)checkIndex -= capacity;
+	//The youngest entry that will write register, or -1 if the register file already holds its value.
+	//A jump and link writes ra
+	word lastWriter(word reg) {
+		return lastWriters[reg];
+	}
 
-			if (predicate(entries[checkIndex], secondryArg)) {
-				finalResult = checkIndex;
-			}
-			lookedAt += 1;
+	//The youngest ready store to address older than robIndex, or -1. It may be a vector store of several words
+	word olderStoreTo(word robIndex, word address) {
+		word found = -1;
+		int checkIndex = head;
+		for (int lookedAt = 0; lookedAt < size && checkIndex != robIndex; lookedAt++) {
+			if (types[checkIndex] == InstructionType::Store && ready[checkIndex] && destinations[checkIndex] == address)
+				found = checkIndex;
+			else if (types[checkIndex] == InstructionType::VectorStore && ready[checkIndex] && address >= destinations[checkIndex]
+				&& (long long)address < (long long)destinations[checkIndex] + vectorLength)
+				found = checkIndex;
+			incrimentIndex(checkIndex);
 		}
-		return finalResult;
+		return found;
 	}
 
-	ReOrderBuffer(int capacity):
+	//Entries are numbered from first, so the ROBs of threads sharing reservation stations never use the same tags.
+	//The arrays are sized to first + capacity to keep indexing direct; below first they are never touched.
+	//vectorLength is the words vector loads and stores work on
+	ReOrderBuffer(int capacity, const std::vector<Instruction>& instructions, int first = 0, int vectorLength = 1):
+		instructions(instructions),
 		capacity(capacity),
+		first(first),
 		size(0),
-		nextIndex(0),
-		headIndex(0)
+		next(first),
+		head(first),
+		types(first + capacity, InstructionType::RegisterOp),
+		ready(first + capacity, 0),
+		active(first + capacity, 0),
+		destinations(first + capacity, 0),
+		values(first + capacity, 0),
+		cold(first + capacity, Cold{ -1, 0, false }),
+		loadStates(first + capacity, NotLoad),
+		loadAddresses(first + capacity, 0),
+		loadLengths(first + capacity, 1),
+		loadSources(first + capacity, -1),
+		sequences(first + capacity, 0),
+		valueStates(first + capacity, NotPredicted),
+		vectorLength(vectorLength)
 	{
-		for (size_t i = 0; i < capacity; i++)
-			entries.emplace_back();
+		std::fill(std::begin(lastWriters), std::end(lastWriters), -1);
 	}
 private:
-	std::vector<RobEntry> entries;
-	int capacity, size, nextIndex, headIndex;
+	struct Cold {
+		int instructionIndex;
+		int pcIfBadlyPredicted;
+		bool predictedToJump;
+		int returnTarget;
+	};
+
+	//The CPU's program, which outlives the ROB
+	const std::vector<Instruction>& instructions;
+	int capacity, first, size, next, head;
+
+	std::vector<InstructionType> types;
+	std::vector<uint8_t> ready;
+	std::vector<uint8_t> active;
+	std::vector<word> destinations;
+	std::vector<word> values;
+	std::vector<Cold> cold;
+	int lastWriters[32];
+
+	//Only filled in when loads may run ahead of stores, or when cores share memory
+	enum LoadState : uint8_t {
+		NotLoad, LoadRead, LoadStale, LoadLost
+	};
+	std::vector<LoadState> loadStates;
+	std::vector<word> loadAddresses;
+	std::vector<int> loadLengths;
+	//By sequence number, as the store may have committed and its entry been reused since
+	std::vector<long long> loadSources;
+	//Counts every push, so entries can be ordered even after they have left
+	std::vector<long long> sequences;
+	long long pushed = 0;
+
+	enum ValueState : uint8_t {
+		NotPredicted, ValuePredicted, ValueWrong
+	};
+	std::vector<ValueState> valueStates;
+	int vectorLength;
+
+	//Whether the words a load read meet the count words from first
+	bool overlaps(int index, word first, int count) {
+		return (long long)loadAddresses[index] < (long long)first + count && (long long)first < (long long)loadAddresses[index] + loadLengths[index];
+	}
+
+	//0 for the head, counting up to the youngest
+	int ageOf(int index) {
+		int age = index - head;
+		return age < 0 ? age + capacity : age;
+	}
+
+	Opcode operationOf(int index) {
+		int address = cold[index].instructionIndex - 1;
+		if (address < 0 || address >= (int)instructions.size())
+			return Add;
+		return instructions[address].operation;
+	}
+
 	void incrimentIndex(int& index) {
 		index += 1;
-		if (index == capacity)
-			index = 0;
+		if (index == first + capacity)
+			index = first;
 	}
-};
\ No newline at end of file
+};